@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <linux/limits.h>
+#elif defined(__APPLE__)
+#include <sys/syslimits.h>
+#endif
+
+#include "meshlink/meshlink.h"
+
+// Measure the aggregate packet throughput of many independent meshes in one process.
+// Each pair of meshlink instances forms its own mesh; one side floods the other with
+// packets. Since the instances share no state, the aggregate rate should grow
+// linearly with the number of pairs until we run out of cores.
+
+typedef struct pair {
+	meshlink_handle_t *sender;
+	meshlink_handle_t *receiver;
+	meshlink_node_t *destination;
+	pthread_t thread;
+	volatile bool reachable;
+	volatile bool running;
+	volatile unsigned long received;
+	unsigned long sent;
+	unsigned long full;
+} pair_t;
+
+static size_t packetsize = 1000;
+
+static void log_message(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *text) {
+	if(level >= MESHLINK_WARNING)
+		fprintf(stderr, "%s: %s\n", mesh ? mesh->name : "global", text);
+}
+
+static void status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	pair_t *pair = mesh->priv;
+	if(!strcmp(node->name, pair->receiver->name))
+		pair->reachable = reachable;
+}
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	pair_t *pair = mesh->priv;
+	pair->received++;
+}
+
+static void *send_thread(void *arg) {
+	pair_t *pair = arg;
+	char *buf = calloc(1, packetsize);
+
+	while(pair->running) {
+		if(meshlink_send(pair->sender, pair->destination, buf, packetsize)) {
+			pair->sent++;
+		} else if(meshlink_errno == MESHLINK_ENOMEM) {
+			// the queue towards the event loop is full, give it a chance to drain
+			pair->full++;
+			sched_yield();
+		} else {
+			fprintf(stderr, "Could not send to %s: %s\n", pair->destination->name, meshlink_strerror(meshlink_errno));
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static bool link_pair(pair_t *pair) {
+	char *data = meshlink_export(pair->sender);
+	if(!data || !meshlink_import(pair->receiver, data))
+		return false;
+	free(data);
+
+	data = meshlink_export(pair->receiver);
+	if(!data || !meshlink_import(pair->sender, data))
+		return false;
+	free(data);
+
+	return true;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Run the benchmark with n pairs, returns the aggregate rate in packets per second.
+static double run(const char *basebase, int n, double duration) {
+	pair_t *pairs = calloc(n, sizeof *pairs);
+	char filename[PATH_MAX];
+	char nodename[100];
+	double rate = -1;
+
+	for(int i = 0; i < n; i++) {
+		pair_t *pair = &pairs[i];
+
+		snprintf(nodename, sizeof nodename, "sender%d", i);
+		snprintf(filename, sizeof filename, "%s/%d/%s", basebase, n, nodename);
+		pair->sender = meshlink_open(filename, nodename, "manymeshes", DEV_CLASS_BACKBONE, MESHLINK_WARNING, log_message, pair);
+
+		snprintf(nodename, sizeof nodename, "receiver%d", i);
+		snprintf(filename, sizeof filename, "%s/%d/%s", basebase, n, nodename);
+		pair->receiver = meshlink_open(filename, nodename, "manymeshes", DEV_CLASS_BACKBONE, MESHLINK_WARNING, log_message, pair);
+
+		if(!pair->sender || !pair->receiver) {
+			fprintf(stderr, "Could not open %s: %s\n", filename, meshlink_strerror(meshlink_errno));
+			goto out;
+		}
+
+		if(!link_pair(pair)) {
+			fprintf(stderr, "Could not link pair %d: %s\n", i, meshlink_strerror(meshlink_errno));
+			goto out;
+		}
+
+		pair->destination = meshlink_get_node(pair->sender, pair->receiver->name);
+		meshlink_set_node_status_cb(pair->sender, status_cb);
+		meshlink_set_receive_cb(pair->receiver, receive_cb);
+
+		if(!meshlink_start(pair->sender) || !meshlink_start(pair->receiver)) {
+			fprintf(stderr, "Could not start pair %d: %s\n", i, meshlink_strerror(meshlink_errno));
+			goto out;
+		}
+	}
+
+	// Wait until all pairs can talk to each other over UDP.
+
+	for(int i = 0; i < n; i++) {
+		pair_t *pair = &pairs[i];
+
+		for(int j = 0; j < 200 && (!pair->reachable || meshlink_get_pmtu(pair->sender, pair->destination) < (ssize_t)packetsize); j++)
+			usleep(100000);
+
+		if(!pair->reachable) {
+			fprintf(stderr, "Pair %d did not connect after 20 seconds\n", i);
+			goto out;
+		}
+	}
+
+	for(int i = 0; i < n; i++) {
+		pairs[i].running = true;
+		pthread_create(&pairs[i].thread, NULL, send_thread, &pairs[i]);
+	}
+
+	double start = now();
+	unsigned long before = 0;
+	for(int i = 0; i < n; i++)
+		before += pairs[i].received;
+
+	usleep(duration * 1e6);
+
+	unsigned long after = 0;
+	for(int i = 0; i < n; i++)
+		after += pairs[i].received;
+	double elapsed = now() - start;
+
+	unsigned long full = 0;
+	for(int i = 0; i < n; i++) {
+		pairs[i].running = false;
+		pthread_join(pairs[i].thread, NULL);
+		full += pairs[i].full;
+	}
+
+	rate = (after - before) / elapsed;
+	fprintf(stderr, "%4d meshes: %12.2lf packets/s aggregate, %12.2lf packets/s per mesh, %lu times queue full\n", n, rate, rate / n, full);
+
+out:
+	for(int i = 0; i < n; i++) {
+		if(pairs[i].sender) {
+			meshlink_stop(pairs[i].sender);
+			meshlink_close(pairs[i].sender);
+		}
+		if(pairs[i].receiver) {
+			meshlink_stop(pairs[i].receiver);
+			meshlink_close(pairs[i].receiver);
+		}
+	}
+
+	free(pairs);
+	return rate;
+}
+
+int main(int argc, char *argv[]) {
+	int maxmeshes = argc > 1 ? atoi(argv[1]) : 16;
+	double duration = argc > 2 ? atof(argv[2]) : 5;
+	const char *basebase = argc > 3 ? argv[3] : ".manymeshes";
+
+	if(maxmeshes < 1 || duration <= 0) {
+		fprintf(stderr, "Usage: %s [maximum number of meshes] [seconds per run] [confbase]\n", argv[0]);
+		return 1;
+	}
+
+	meshlink_set_log_cb(NULL, MESHLINK_WARNING, log_message);
+
+	char dirname[PATH_MAX];
+	mkdir(basebase, 0750);
+
+	double base = 0;
+
+	for(int n = 1; n <= maxmeshes; n *= 2) {
+		snprintf(dirname, sizeof dirname, "%s/%d", basebase, n);
+		mkdir(dirname, 0750);
+
+		double rate = run(basebase, n, duration);
+		if(rate < 0)
+			return 1;
+
+		if(n == 1)
+			base = rate;
+		else if(base > 0)
+			fprintf(stderr, "%4d meshes: scaling %.2lf (ideal %d)\n", n, rate / base, n);
+	}
+
+	return 0;
+}
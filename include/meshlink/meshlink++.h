@@ -37,6 +37,9 @@ namespace meshlink {
     /// Code of most recent error encountered.
     typedef meshlink_errno_t errno_t;
 
+    /// Compression algorithms for packets.
+    typedef meshlink_compression_t compression_t;
+
     /// A callback for receiving data from the mesh.
     /** @param mesh      A handle which represents an instance of MeshLink.
      *  @param source    A pointer to a meshlink::node describing the source of the data.
@@ -304,6 +307,60 @@ namespace meshlink {
             return meshlink_send(handle, destination, data, len);
         }
 
+        /// Set the send budget.
+        /** This functions sets how many queued packets MeshLink's own thread sends out in one go,
+         *  before it checks its sockets for incoming data again.
+         *
+         *  @param budget       The maximum number of queued packets to send per iteration, or 0 to restore the default.
+         */
+        void set_send_budget(unsigned int budget) {
+            meshlink_set_send_budget(handle, budget);
+        }
+
+        /// Set the maximum MTU of the network links.
+        /** By default, MeshLink assumes links with an MTU of 1500 bytes.
+         *  On networks that support jumbo frames, a larger MTU lets MeshLink send larger packets.
+         *  It may only be called when the mesh is not running.
+         *
+         *  @param mtu          The largest IP packet size MeshLink should try to use, between 576 and 9000 bytes.
+         *
+         *  @return             This function returns true if the MTU was set, false otherwise.
+         */
+        bool set_max_mtu(uint16_t mtu) {
+            return meshlink_set_max_mtu(handle, mtu);
+        }
+
+        /// Set how other nodes should compress packets they send to the local node.
+        /** Every packet is compressed on its own, so small packets often do not get any smaller.
+         *  A dictionary with data that is typical for the application's packets helps a lot with that.
+         *  It is only used with LZ4 and zstd, and all nodes must be given exactly the same dictionary.
+         *  Nodes that do not support the requested compression send their packets uncompressed.
+         *  The setting applies to key exchanges that happen after this call.
+         *
+         *  @param codec        The compression algorithm to use.
+         *  @param dictionary   A pointer to a buffer containing the dictionary, or NULL if no dictionary is used.
+         *  @param len          The length of the dictionary, 0 if no dictionary is used.
+         *
+         *  @return             This function returns true if the compression was changed, false otherwise.
+         */
+        bool set_compression(compression_t codec, const void *dictionary = NULL, size_t len = 0) {
+            return meshlink_set_compression(handle, codec, dictionary, len);
+        }
+
+        /// Set the size of the replay window for a node.
+        /** MeshLink drops packets from a node that it has already received, or that arrive too late.
+         *  The replay window determines how far packets may be reordered on their way from the node to us before they are considered too late.
+         *  The window is rounded up to a multiple of 64 packets.
+         *
+         *  @param node         A pointer to a meshlink::node describing the node.
+         *  @param packets      The number of packets in the replay window, or 0 to restore the default.
+         *
+         *  @return             This function returns true if the replay window has been changed, false otherwise.
+         */
+        bool set_node_replay_window(node *node, unsigned int packets) {
+            return meshlink_set_node_replay_window(handle, node, packets);
+        }
+
         /// Get a handle for a specific node.
         /** This function returns a handle for the node with the given name.
          *
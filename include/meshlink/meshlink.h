@@ -36,6 +36,9 @@ extern "C" {
 // The maximum length of fingerprints
 #define MESHLINK_FINGERPRINTLEN  (64)
 
+/// The largest replay window in packets that meshlink_set_node_replay_window() accepts
+#define MESHLINK_MAX_REPLAY_WINDOW  (65536)
+
 /// A handle for an instance of MeshLink.
 typedef struct meshlink_handle meshlink_handle_t;
 
@@ -83,6 +86,14 @@ typedef enum {
     _DEV_CLASS_MAX = 3
 } dev_class_t;
 
+/// Compression algorithms for packets sent with meshlink_send().
+typedef enum {
+    MESHLINK_COMPRESSION_NONE,  ///< Do not compress packets.
+    MESHLINK_COMPRESSION_ZLIB,  ///< zlib at its fastest level, slow but available everywhere.
+    MESHLINK_COMPRESSION_LZ4,   ///< LZ4, very fast with a moderate compression ratio.
+    MESHLINK_COMPRESSION_ZSTD,  ///< zstd at its fastest level, a better ratio than LZ4 at a somewhat higher cost.
+} meshlink_compression_t;
+
 /// A variable holding the last encountered error from MeshLink.
 /** Is not thread-local on APPLE and Windows.
  *  On other platforms, this is a thread local variable that contains the error code of the most recent error
@@ -333,9 +344,21 @@ extern void meshlink_set_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t le
  *  @param len          The length of the data.
  *  @return             This function will return true if MeshLink has queued the message for transmission, and false otherwise.
  *                      A return value of true does not guarantee that the message will actually arrive at the destination.
+ *                      If the send queue is full, false is returned and meshlink_errno is set to MESHLINK_ENOMEM.
  */
 extern bool meshlink_send(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len);
 
+/// Set the send budget.
+/** This functions sets how many packets queued with meshlink_send() MeshLink's own thread sends out in one go,
+ *  before it checks its sockets for incoming data again.
+ *  A larger budget gives a higher throughput for bursts of outgoing packets,
+ *  a smaller budget gives a lower latency for incoming packets and meta connections.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param budget       The maximum number of queued packets to send per iteration, or 0 to restore the default.
+ */
+extern void meshlink_set_send_budget(meshlink_handle_t *mesh, unsigned int budget);
+
 /// A callback for maximum transmission unit changes for a node
  /* @param mesh         A handle which represents an instance of MeshLink.
  *  @param node         A pointer to a meshlink_node_t describing the node for that the mtu changed.
@@ -371,6 +394,59 @@ extern void meshlink_set_node_pmtu_cb(meshlink_handle_t *mesh, meshlink_node_pmt
  */
 extern ssize_t meshlink_get_pmtu(meshlink_handle_t *mesh, meshlink_node_t *destination);
 
+/// Set the maximum MTU of the network links.
+/** By default, MeshLink assumes links with an MTU of 1500 bytes, like most Ethernet and Wi-Fi networks.
+ *  On networks that support jumbo frames, a larger MTU lets MeshLink send larger packets,
+ *  which path MTU discovery then uses for nodes that can be reached over such a network.
+ *  Buffers for incoming and queued packets are sized to match, so a larger MTU also uses more memory.
+ *  The queue used by meshlink_send() is only ever grown, lowering the MTU again does not free memory until meshlink_close().
+ *  It may only be called when the mesh is not running, and takes effect the next time meshlink_start() is called.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param mtu          The largest IP packet size MeshLink should try to use, between 576 and 9000 bytes.
+ *
+ *  @return             This function returns true if the MTU was set, false otherwise.
+ */
+extern bool meshlink_set_max_mtu(meshlink_handle_t *mesh, uint16_t mtu);
+
+/// Set how other nodes should compress packets they send to the local node.
+/** Every packet is compressed on its own, so small packets often do not get any smaller.
+ *  A dictionary with data that is typical for the application's packets helps a lot with that.
+ *  It is only used with LZ4 and zstd, and only between nodes that were given exactly the same dictionary,
+ *  other nodes use the same algorithm without it.
+ *  Nodes that do not support the requested compression send their packets uncompressed.
+ *  The setting applies to key exchanges that happen after this call.
+ *  If the dictionary is changed while MeshLink is running, MeshLink immediately starts a new key exchange with nodes that agreed on the old one.
+ *  Until that has finished, packets to them are sent uncompressed, and packets from them compressed with the old dictionary are dropped.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param codec        The compression algorithm to use.
+ *  @param dictionary   A pointer to a buffer containing the dictionary, or NULL if no dictionary is used.
+ *                      MeshLink makes a copy of it.
+ *  @param len          The length of the dictionary, 0 if no dictionary is used.
+ *
+ *  @return             This function returns true if the compression was changed, false otherwise,
+ *                      for example if MeshLink was built without support for the requested algorithm.
+ *                      In that case the previous compression and dictionary stay in use.
+ */
+extern bool meshlink_set_compression(meshlink_handle_t *mesh, meshlink_compression_t codec, const void *dictionary, size_t len);
+
+/// Set the size of the replay window for a node.
+/** MeshLink drops packets from a node that it has already received, or that arrive too late.
+ *  The replay window determines how far packets may be reordered on their way from the node to us before they are considered too late.
+ *  A larger window can be useful for nodes that send at a high rate over several paths with different latencies.
+ *  The window is rounded up to a multiple of 64 packets.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param node         A pointer to a meshlink_node_t describing the node.
+ *  @param packets      The number of packets in the replay window, or 0 to restore the default.
+ *                      It may be at most MESHLINK_MAX_REPLAY_WINDOW.
+ *
+ *  @return             This function returns true if the replay window has been changed, false otherwise,
+ *                      for example if packets is larger than MESHLINK_MAX_REPLAY_WINDOW.
+ */
+extern bool meshlink_set_node_replay_window(meshlink_handle_t *mesh, meshlink_node_t *node, unsigned int packets);
+
 /// Get a handle for our own node.
 /** This function returns a handle for the local node.
  *
@@ -508,6 +584,24 @@ extern bool meshlink_add_external_address(meshlink_handle_t *mesh);
  */
 extern int meshlink_get_port(meshlink_handle_t *mesh);
 
+/// Set the number of threads receiving UDP packets.
+/** By default, all packets are received, decrypted and handled by MeshLink's own thread.
+ *  This function adds threads that each receive a share of the incoming UDP packets,
+ *  so decryption of packets from different nodes can happen on multiple CPU cores.
+ *  All packets from one node are always handled by the same thread.
+ *  This is only supported on platforms that have SO_REUSEPORT and recvmmsg().
+ *  It may only be called when the mesh is not running, and takes effect the next time meshlink_start() is called.
+ *
+ *  Note that callbacks, in particular the receive callback, can then be called from any of these threads,
+ *  although never concurrently.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param threads      The number of threads per listening address, or 0 to handle everything in MeshLink's own thread.
+ *
+ *  @return             This function returns true if the number of threads was set, false otherwise.
+ */
+extern bool meshlink_set_receive_threads(meshlink_handle_t *mesh, int threads);
+
 /// Set the network port used by the local node.
 /** This function sets the network port that the local node is listening on.
  *  It may only be called when the mesh is not running.
@@ -0,0 +1,25 @@
+dnl Check to find the LZ4 headers/libraries
+
+AC_DEFUN([MeshLink_LZ4],
+[
+  AC_ARG_ENABLE([lz4],
+    AS_HELP_STRING([--disable-lz4], [disable LZ4 compression support]))
+
+  AS_IF([test "x$enable_lz4" != "xno"], [
+    AC_ARG_WITH(lz4,
+      AS_HELP_STRING([--with-lz4=DIR], [LZ4 base directory]),
+      [lz4="$withval"
+       CPPFLAGS="$CPPFLAGS -I$withval/include"
+       LDFLAGS="$LDFLAGS -L$withval/lib"]
+    )
+
+    AC_CHECK_HEADERS(lz4.h,
+      [AC_CHECK_LIB(lz4, LZ4_compress_fast_continue,
+        [LIBS="$LIBS -llz4"
+         AC_DEFINE(HAVE_LZ4, 1, [have LZ4 compression support])],
+        [AS_IF([test "x$enable_lz4" = "xyes"], [AC_MSG_ERROR("LZ4 library not found.")])]
+      )],
+      [AS_IF([test "x$enable_lz4" = "xyes"], [AC_MSG_ERROR("LZ4 header files not found.")])]
+    )
+  ])
+])
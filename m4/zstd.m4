@@ -0,0 +1,25 @@
+dnl Check to find the zstd headers/libraries
+
+AC_DEFUN([MeshLink_ZSTD],
+[
+  AC_ARG_ENABLE([zstd],
+    AS_HELP_STRING([--disable-zstd], [disable zstd compression support]))
+
+  AS_IF([test "x$enable_zstd" != "xno"], [
+    AC_ARG_WITH(zstd,
+      AS_HELP_STRING([--with-zstd=DIR], [zstd base directory]),
+      [zstd="$withval"
+       CPPFLAGS="$CPPFLAGS -I$withval/include"
+       LDFLAGS="$LDFLAGS -L$withval/lib"]
+    )
+
+    AC_CHECK_HEADERS(zstd.h,
+      [AC_CHECK_LIB(zstd, ZSTD_compress_usingCDict,
+        [LIBS="$LIBS -lzstd"
+         AC_DEFINE(HAVE_ZSTD, 1, [have zstd compression support])],
+        [AS_IF([test "x$enable_zstd" = "xyes"], [AC_MSG_ERROR("zstd library not found.")])]
+      )],
+      [AS_IF([test "x$enable_zstd" = "xyes"], [AC_MSG_ERROR("zstd header files not found.")])]
+    )
+  ])
+])
@@ -6,6 +6,13 @@
 #include "chacha-poly1305.h"
 #include "poly1305.h"
 
+/*
+ * Amount of data encrypted and authenticated in one go. This is small enough
+ * to stay in the L1 cache between the two steps, and large enough to amortize
+ * the per-call overhead of the ChaCha and Poly1305 primitives.
+ */
+#define CHUNKLEN (8 * CHACHA_BLOCKLEN)
+
 struct chacha_poly1305_ctx {
 	struct chacha_ctx main_ctx, header_ctx;
 };
@@ -28,6 +35,11 @@ bool chacha_poly1305_set_key(chacha_poly1305_ctx_t *ctx, const void *key)
 	return true;
 }
 
+void chacha_poly1305_copy(chacha_poly1305_ctx_t *dst, const chacha_poly1305_ctx_t *src)
+{
+	*dst = *src;
+}
+
 static void put_u64(void *vp, uint64_t v)
 {
 	uint8_t *p = (uint8_t *) vp;
@@ -42,25 +54,82 @@ static void put_u64(void *vp, uint64_t v)
 	p[7] = (uint8_t) v & 0xff;
 }
 
-bool chacha_poly1305_encrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen, void *outdata, size_t *outlen) {
-	uint8_t seqbuf[8];
-	const uint8_t one[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };	/* NB little-endian */
+/*
+ * Run ChaCha20 once to generate the Poly1305 key. The IV is the packet
+ * sequence number. This leaves ChaCha's block counter at 1, ready to
+ * process the payload.
+ */
+static void poly1305_setup(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, uint8_t seqbuf[8], poly1305_state_t *poly) {
 	uint8_t poly_key[POLY1305_KEYLEN];
 
-	/*
-	 * Run ChaCha20 once to generate the Poly1305 key. The IV is the
-	 * packet sequence number.
-	 */
 	memset(poly_key, 0, sizeof(poly_key));
 	put_u64(seqbuf, seqnr);
 	chacha_ivsetup(&ctx->main_ctx, seqbuf, NULL);
 	chacha_encrypt_bytes(&ctx->main_ctx, poly_key, poly_key, sizeof(poly_key));
+	poly1305_init(poly, poly_key);
+}
 
-	/* Set Chacha's block counter to 1 */
-	chacha_ivsetup(&ctx->main_ctx, seqbuf, one);
+static const uint8_t one[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };	/* NB little-endian */
+
+/*
+ * Encryption and authentication are done in a single pass: each chunk is
+ * fed to Poly1305 right after it is written, while it is still in the L1
+ * cache. ChaCha's block counter must be at 1, the tag is written after
+ * the ciphertext.
+ */
+static void seal(chacha_poly1305_ctx_t *ctx, poly1305_state_t *poly, const uint8_t *in, size_t inlen, uint8_t *out) {
+	for (size_t left = inlen; left;) {
+		size_t chunk = left < CHUNKLEN ? left : CHUNKLEN;
+		chacha_encrypt_bytes(&ctx->main_ctx, in, out, chunk);
+		poly1305_update(poly, out, chunk);
+		in += chunk;
+		out += chunk;
+		left -= chunk;
+	}
+
+	poly1305_finish(poly, out);
+}
+
+/*
+ * Each chunk is authenticated before it is decrypted, so this works in
+ * place. If the tag turns out to be wrong, the keystream is applied once
+ * more, so no unauthenticated plaintext is left behind and an in-place
+ * buffer holds the original ciphertext again. The inlen includes the tag.
+ */
+static bool unseal(chacha_poly1305_ctx_t *ctx, poly1305_state_t *poly, const uint8_t seqbuf[8], const uint8_t *in, size_t inlen, uint8_t *out) {
+	uint8_t expected_tag[POLY1305_TAGLEN];
+	uint8_t tag[POLY1305_TAGLEN];
+	uint8_t *outdata = out;
 
-	chacha_encrypt_bytes(&ctx->main_ctx, indata, outdata, inlen);
-	poly1305_auth(outdata + inlen, outdata, inlen, poly_key);
+	inlen -= POLY1305_TAGLEN;
+	memcpy(tag, in + inlen, POLY1305_TAGLEN);
+
+	for (size_t left = inlen; left;) {
+		size_t chunk = left < CHUNKLEN ? left : CHUNKLEN;
+		poly1305_update(poly, in, chunk);
+		chacha_encrypt_bytes(&ctx->main_ctx, in, out, chunk);
+		in += chunk;
+		out += chunk;
+		left -= chunk;
+	}
+
+	poly1305_finish(poly, expected_tag);
+
+	if (memcmp(expected_tag, tag, POLY1305_TAGLEN)) {
+		chacha_ivsetup(&ctx->main_ctx, seqbuf, one);
+		chacha_encrypt_bytes(&ctx->main_ctx, outdata, outdata, inlen);
+		return false;
+	}
+
+	return true;
+}
+
+bool chacha_poly1305_encrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen, void *outdata, size_t *outlen) {
+	uint8_t seqbuf[8];
+	poly1305_state_t poly;
+
+	poly1305_setup(ctx, seqnr, seqbuf, &poly);
+	seal(ctx, &poly, indata, inlen, outdata);
 
 	if (outlen)
 		*outlen = inlen + POLY1305_TAGLEN;
@@ -70,33 +139,99 @@ bool chacha_poly1305_encrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const v
 
 bool chacha_poly1305_decrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen, void *outdata, size_t *outlen) {
 	uint8_t seqbuf[8];
-	const uint8_t one[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };	/* NB little-endian */
-	uint8_t expected_tag[POLY1305_TAGLEN], poly_key[POLY1305_KEYLEN];
+	poly1305_state_t poly;
 
-	/*
-	 * Run ChaCha20 once to generate the Poly1305 key. The IV is the
-	 * packet sequence number.
-	 */
-	memset(poly_key, 0, sizeof(poly_key));
-	put_u64(seqbuf, seqnr);
-	chacha_ivsetup(&ctx->main_ctx, seqbuf, NULL);
-	chacha_encrypt_bytes(&ctx->main_ctx, poly_key, poly_key, sizeof(poly_key));
-
-	/* Set Chacha's block counter to 1 */
-	chacha_ivsetup(&ctx->main_ctx, seqbuf, one);
+	if (inlen < POLY1305_TAGLEN)
+		return false;
 
-	/* Check tag before anything else */
-	inlen -= POLY1305_TAGLEN;
-	const uint8_t *tag = indata + inlen;
+	poly1305_setup(ctx, seqnr, seqbuf, &poly);
 
-	poly1305_auth(expected_tag, indata, inlen, poly_key);
-	if (memcmp(expected_tag, tag, POLY1305_TAGLEN))
+	if (!unseal(ctx, &poly, seqbuf, indata, inlen, outdata))
 		return false;
 
-	chacha_encrypt_bytes(&ctx->main_ctx, indata, outdata, inlen);
-
 	if (outlen)
-		*outlen = inlen;
+		*outlen = inlen - POLY1305_TAGLEN;
 
 	return true;
 }
+
+/*
+ * The batch versions generate the Poly1305 keys of a whole group of
+ * records with a single multi-nonce ChaCha call, and then handle each
+ * record like the functions above.
+ */
+#define BATCH 8
+
+static void batch_keys(chacha_poly1305_ctx_t *ctx, const uint64_t *seqnr, size_t count, uint8_t *seqbufs, uint8_t *blocks) {
+	for (size_t i = 0; i < count; i++)
+		put_u64(seqbufs + i * CHACHA_NONCELEN, seqnr[i]);
+
+	chacha_first_blocks(&ctx->main_ctx, seqbufs, count, blocks);
+}
+
+void chacha_poly1305_encrypt_batch(chacha_poly1305_ctx_t *ctx, size_t count, const uint64_t *seqnr, void *const *data, const size_t *len) {
+	uint8_t seqbufs[BATCH * CHACHA_NONCELEN];
+	uint8_t blocks[BATCH * CHACHA_BLOCKLEN];
+	poly1305_state_t poly;
+
+	for (size_t i = 0; i < count; i += BATCH) {
+		size_t n = count - i < BATCH ? count - i : BATCH;
+
+		batch_keys(ctx, seqnr + i, n, seqbufs, blocks);
+
+		for (size_t j = 0; j < n; j++) {
+			chacha_ivsetup(&ctx->main_ctx, seqbufs + j * CHACHA_NONCELEN, one);
+			poly1305_init(&poly, blocks + j * CHACHA_BLOCKLEN);
+			seal(ctx, &poly, data[i + j], len[i + j], data[i + j]);
+		}
+	}
+}
+
+size_t chacha_poly1305_decrypt_batch(chacha_poly1305_ctx_t *ctx, size_t count, const uint64_t *seqnr, void *const *data, const size_t *len, bool *valid) {
+	uint8_t seqbufs[BATCH * CHACHA_NONCELEN];
+	uint8_t blocks[BATCH * CHACHA_BLOCKLEN];
+	poly1305_state_t poly;
+	size_t nvalid = 0;
+
+	for (size_t i = 0; i < count; i += BATCH) {
+		size_t n = count - i < BATCH ? count - i : BATCH;
+
+		batch_keys(ctx, seqnr + i, n, seqbufs, blocks);
+
+		for (size_t j = 0; j < n; j++) {
+			const uint8_t *seqbuf = seqbufs + j * CHACHA_NONCELEN;
+
+			valid[i + j] = false;
+
+			if (len[i + j] < POLY1305_TAGLEN)
+				continue;
+
+			chacha_ivsetup(&ctx->main_ctx, seqbuf, one);
+			poly1305_init(&poly, blocks + j * CHACHA_BLOCKLEN);
+
+			if (unseal(ctx, &poly, seqbuf, data[i + j], len[i + j], data[i + j])) {
+				valid[i + j] = true;
+				nvalid++;
+			}
+		}
+	}
+
+	return nvalid;
+}
+
+bool chacha_poly1305_verify(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen) {
+	uint8_t seqbuf[8];
+	uint8_t expected_tag[POLY1305_TAGLEN];
+	poly1305_state_t poly;
+
+	if (inlen < POLY1305_TAGLEN)
+		return false;
+
+	inlen -= POLY1305_TAGLEN;
+
+	poly1305_setup(ctx, seqnr, seqbuf, &poly);
+	poly1305_update(&poly, indata, inlen);
+	poly1305_finish(&poly, expected_tag);
+
+	return !memcmp(expected_tag, (const uint8_t *)indata + inlen, POLY1305_TAGLEN);
+}
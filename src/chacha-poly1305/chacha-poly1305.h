@@ -8,8 +8,15 @@ typedef struct chacha_poly1305_ctx chacha_poly1305_ctx_t;
 extern chacha_poly1305_ctx_t *chacha_poly1305_init(void);
 extern void chacha_poly1305_exit(chacha_poly1305_ctx_t *);
 extern bool chacha_poly1305_set_key(chacha_poly1305_ctx_t *ctx, const void *key);
+extern void chacha_poly1305_copy(chacha_poly1305_ctx_t *dst, const chacha_poly1305_ctx_t *src);
 
 extern bool chacha_poly1305_encrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen, void *outdata, size_t *outlen);
 extern bool chacha_poly1305_decrypt(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen, void *outdata, size_t *outlen);
+extern bool chacha_poly1305_verify(chacha_poly1305_ctx_t *ctx, uint64_t seqnr, const void *indata, size_t inlen);
+
+// Encrypt or decrypt a number of records in place. Encrypted records must have room for the tag after their data,
+// the lengths of records to decrypt include the tag. Decryption returns the number of valid records.
+extern void chacha_poly1305_encrypt_batch(chacha_poly1305_ctx_t *ctx, size_t count, const uint64_t *seqnr, void *const *data, const size_t *len);
+extern size_t chacha_poly1305_decrypt_batch(chacha_poly1305_ctx_t *ctx, size_t count, const uint64_t *seqnr, void *const *data, const size_t *len, bool *valid);
 
 #endif //CHACHA_POLY1305_H
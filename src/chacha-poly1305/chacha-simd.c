@@ -0,0 +1,298 @@
+/*
+ * Multi-block ChaCha20 kernels for x86 SSE2, SSSE3 and AVX2.
+ *
+ * Each kernel runs four or eight independent ChaCha blocks side by side,
+ * with one vector register per state word and one lane per block. After
+ * the rounds, the lanes are transposed back into consecutive blocks of
+ * keystream. The kernels only process whole groups of blocks; the caller
+ * in chacha.c handles the rest.
+ *
+ * The lanes normally hold consecutive blocks of one stream. The
+ * chacha_first_blocks_*() kernels instead give each lane its own nonce,
+ * to generate the first block of several streams at once.
+ *
+ * The instruction sets are enabled per function, so this file does not
+ * need any special compiler flags. chacha_set_impl() checks at runtime
+ * which kernels the CPU supports.
+ */
+
+#include "../system.h"
+
+#include "chacha.h"
+
+#ifdef CHACHA_X86
+
+#include <immintrin.h>
+
+#define TARGET(isa) __attribute__((target(isa)))
+
+/* Per-lane values of state words 12 to 15, for consecutive blocks of one stream */
+static inline void get_counters(const struct chacha_ctx *x, uint32_t w[4][8], int lanes)
+{
+	for (int i = 0; i < lanes; i++) {
+		w[0][i] = x->input[12] + i;
+		w[1][i] = x->input[13] + (w[0][i] < x->input[12]);
+		w[2][i] = x->input[14];
+		w[3][i] = x->input[15];
+	}
+}
+
+/* Per-lane values of state words 12 to 15, for block 0 of streams with different nonces */
+static inline void get_nonces(const uint8_t *iv, uint32_t w[4][8], int lanes)
+{
+	for (int i = 0; i < lanes; i++) {
+		w[0][i] = 0;
+		w[1][i] = 0;
+		memcpy(&w[2][i], iv + i * CHACHA_NONCELEN, 4);
+		memcpy(&w[3][i], iv + i * CHACHA_NONCELEN + 4, 4);
+	}
+}
+
+static const uint8_t zero[8 * CHACHA_BLOCKLEN];
+
+static inline void advance_counter(struct chacha_ctx *x, uint32_t blocks)
+{
+	uint32_t lo = x->input[12] + blocks;
+
+	if (lo < x->input[12])
+		x->input[13]++;
+	x->input[12] = lo;
+}
+
+/* 128 bit vectors, four blocks at a time */
+
+#define ROTL4(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define ROTL4_16_SSE2(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1)
+#define ROTL4_8_SSE2(v) ROTL4(v, 8)
+#define ROTL4_16_SSSE3(v) _mm_shuffle_epi8(v, rot16)
+#define ROTL4_8_SSSE3(v) _mm_shuffle_epi8(v, rot8)
+
+#define QUARTERROUND4(a, b, c, d, ROTL16, ROTL8) \
+	a = _mm_add_epi32(a, b); d = ROTL16(_mm_xor_si128(d, a)); \
+	c = _mm_add_epi32(c, d); b = ROTL4(_mm_xor_si128(b, c), 12); \
+	a = _mm_add_epi32(a, b); d = ROTL8(_mm_xor_si128(d, a)); \
+	c = _mm_add_epi32(c, d); b = ROTL4(_mm_xor_si128(b, c), 7);
+
+#define DOUBLEROUND4(v, ROTL16, ROTL8) \
+	QUARTERROUND4(v[0], v[4], v[8], v[12], ROTL16, ROTL8) \
+	QUARTERROUND4(v[1], v[5], v[9], v[13], ROTL16, ROTL8) \
+	QUARTERROUND4(v[2], v[6], v[10], v[14], ROTL16, ROTL8) \
+	QUARTERROUND4(v[3], v[7], v[11], v[15], ROTL16, ROTL8) \
+	QUARTERROUND4(v[0], v[5], v[10], v[15], ROTL16, ROTL8) \
+	QUARTERROUND4(v[1], v[6], v[11], v[12], ROTL16, ROTL8) \
+	QUARTERROUND4(v[2], v[7], v[8], v[13], ROTL16, ROTL8) \
+	QUARTERROUND4(v[3], v[4], v[9], v[14], ROTL16, ROTL8)
+
+static inline TARGET("sse2") void setup4(const struct chacha_ctx *x, uint32_t w[4][8], __m128i s[16])
+{
+	for (int i = 0; i < 12; i++)
+		s[i] = _mm_set1_epi32(x->input[i]);
+
+	for (int i = 0; i < 4; i++)
+		s[12 + i] = _mm_loadu_si128((const __m128i *)w[i]);
+}
+
+/* Add the input state, transpose, and XOR four blocks of keystream into the data */
+static inline TARGET("sse2") void output4(__m128i v[16], const __m128i s[16], const uint8_t *m, uint8_t *c)
+{
+	for (int i = 0; i < 16; i++)
+		v[i] = _mm_add_epi32(v[i], s[i]);
+
+	for (int i = 0; i < 16; i += 4) {
+		__m128i t0 = _mm_unpacklo_epi32(v[i + 0], v[i + 1]);
+		__m128i t1 = _mm_unpacklo_epi32(v[i + 2], v[i + 3]);
+		__m128i t2 = _mm_unpackhi_epi32(v[i + 0], v[i + 1]);
+		__m128i t3 = _mm_unpackhi_epi32(v[i + 2], v[i + 3]);
+		__m128i b[4] = {
+			_mm_unpacklo_epi64(t0, t1),
+			_mm_unpackhi_epi64(t0, t1),
+			_mm_unpacklo_epi64(t2, t3),
+			_mm_unpackhi_epi64(t2, t3),
+		};
+
+		for (int j = 0; j < 4; j++) {
+			const __m128i *in = (const __m128i *)(m + j * CHACHA_BLOCKLEN + i * 4);
+			__m128i *out = (__m128i *)(c + j * CHACHA_BLOCKLEN + i * 4);
+			_mm_storeu_si128(out, _mm_xor_si128(b[j], _mm_loadu_si128(in)));
+		}
+	}
+}
+
+static inline TARGET("sse2") void block4_sse2(const __m128i s[16], const uint8_t *m, uint8_t *c)
+{
+	__m128i v[16];
+
+	for (int i = 0; i < 16; i++)
+		v[i] = s[i];
+	for (int i = 0; i < 10; i++) {
+		DOUBLEROUND4(v, ROTL4_16_SSE2, ROTL4_8_SSE2)
+	}
+	output4(v, s, m, c);
+}
+
+static inline TARGET("ssse3") void block4_ssse3(const __m128i s[16], const uint8_t *m, uint8_t *c)
+{
+	const __m128i rot16 = _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m128i rot8 = _mm_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+	__m128i v[16];
+
+	for (int i = 0; i < 16; i++)
+		v[i] = s[i];
+	for (int i = 0; i < 10; i++) {
+		DOUBLEROUND4(v, ROTL4_16_SSSE3, ROTL4_8_SSSE3)
+	}
+	output4(v, s, m, c);
+}
+
+TARGET("sse2") size_t chacha_blocks_sse2(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes)
+{
+	size_t done;
+
+	for (done = 0; bytes - done >= 4 * CHACHA_BLOCKLEN; done += 4 * CHACHA_BLOCKLEN) {
+		uint32_t w[4][8];
+		__m128i s[16];
+
+		get_counters(x, w, 4);
+		setup4(x, w, s);
+		block4_sse2(s, m + done, c + done);
+		advance_counter(x, 4);
+	}
+
+	return done;
+}
+
+TARGET("sse2") void chacha_first_blocks_sse2(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out)
+{
+	uint32_t w[4][8];
+	__m128i s[16];
+
+	get_nonces(iv, w, 4);
+	setup4(x, w, s);
+	block4_sse2(s, zero, out);
+}
+
+TARGET("ssse3") size_t chacha_blocks_ssse3(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes)
+{
+	size_t done;
+
+	for (done = 0; bytes - done >= 4 * CHACHA_BLOCKLEN; done += 4 * CHACHA_BLOCKLEN) {
+		uint32_t w[4][8];
+		__m128i s[16];
+
+		get_counters(x, w, 4);
+		setup4(x, w, s);
+		block4_ssse3(s, m + done, c + done);
+		advance_counter(x, 4);
+	}
+
+	return done;
+}
+
+TARGET("ssse3") void chacha_first_blocks_ssse3(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out)
+{
+	uint32_t w[4][8];
+	__m128i s[16];
+
+	get_nonces(iv, w, 4);
+	setup4(x, w, s);
+	block4_ssse3(s, zero, out);
+}
+
+/* 256 bit vectors, eight blocks at a time */
+
+#define ROTL8(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QUARTERROUND8(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+	c = _mm256_add_epi32(c, d); b = ROTL8(_mm256_xor_si256(b, c), 12); \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+	c = _mm256_add_epi32(c, d); b = ROTL8(_mm256_xor_si256(b, c), 7);
+
+static inline TARGET("avx2") void block8(const struct chacha_ctx *x, uint32_t w[4][8], const uint8_t *m, uint8_t *c)
+{
+	const __m256i rot16 = _mm256_set_epi8(
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rot8 = _mm256_set_epi8(
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+	__m256i s[16], v[16];
+
+	for (int i = 0; i < 12; i++)
+		s[i] = _mm256_set1_epi32(x->input[i]);
+
+	for (int i = 0; i < 4; i++)
+		s[12 + i] = _mm256_loadu_si256((const __m256i *)w[i]);
+
+	for (int i = 0; i < 16; i++)
+		v[i] = s[i];
+
+	for (int i = 0; i < 10; i++) {
+		QUARTERROUND8(v[0], v[4], v[8], v[12])
+		QUARTERROUND8(v[1], v[5], v[9], v[13])
+		QUARTERROUND8(v[2], v[6], v[10], v[14])
+		QUARTERROUND8(v[3], v[7], v[11], v[15])
+		QUARTERROUND8(v[0], v[5], v[10], v[15])
+		QUARTERROUND8(v[1], v[6], v[11], v[12])
+		QUARTERROUND8(v[2], v[7], v[8], v[13])
+		QUARTERROUND8(v[3], v[4], v[9], v[14])
+	}
+
+	for (int i = 0; i < 16; i++)
+		v[i] = _mm256_add_epi32(v[i], s[i]);
+
+	/*
+	 * Transpose four words at a time within each 128 bit half. This
+	 * gives, for words i to i + 3, block j in the low half and block
+	 * j + 4 in the high half of b[i / 4][j].
+	 */
+	__m256i b[4][4];
+
+	for (int i = 0; i < 16; i += 4) {
+		__m256i t0 = _mm256_unpacklo_epi32(v[i + 0], v[i + 1]);
+		__m256i t1 = _mm256_unpacklo_epi32(v[i + 2], v[i + 3]);
+		__m256i t2 = _mm256_unpackhi_epi32(v[i + 0], v[i + 1]);
+		__m256i t3 = _mm256_unpackhi_epi32(v[i + 2], v[i + 3]);
+		b[i / 4][0] = _mm256_unpacklo_epi64(t0, t1);
+		b[i / 4][1] = _mm256_unpackhi_epi64(t0, t1);
+		b[i / 4][2] = _mm256_unpacklo_epi64(t2, t3);
+		b[i / 4][3] = _mm256_unpackhi_epi64(t2, t3);
+	}
+
+	for (int j = 0; j < 4; j++) {
+		for (int half = 0; half < 2; half++) {
+			__m256i lower = _mm256_permute2x128_si256(b[2 * half][j], b[2 * half + 1][j], 0x20);
+			__m256i upper = _mm256_permute2x128_si256(b[2 * half][j], b[2 * half + 1][j], 0x31);
+			size_t lower_offset = j * CHACHA_BLOCKLEN + half * 32;
+			size_t upper_offset = lower_offset + 4 * CHACHA_BLOCKLEN;
+			_mm256_storeu_si256((__m256i *)(c + lower_offset), _mm256_xor_si256(lower, _mm256_loadu_si256((const __m256i *)(m + lower_offset))));
+			_mm256_storeu_si256((__m256i *)(c + upper_offset), _mm256_xor_si256(upper, _mm256_loadu_si256((const __m256i *)(m + upper_offset))));
+		}
+	}
+}
+
+TARGET("avx2") size_t chacha_blocks_avx2(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes)
+{
+	size_t done;
+
+	for (done = 0; bytes - done >= 8 * CHACHA_BLOCKLEN; done += 8 * CHACHA_BLOCKLEN) {
+		uint32_t w[4][8];
+
+		get_counters(x, w, 8);
+		block8(x, w, m + done, c + done);
+		advance_counter(x, 8);
+	}
+
+	/* A remaining group of four blocks is still worth doing with 128 bit vectors */
+	return done + chacha_blocks_ssse3(x, m + done, c + done, bytes - done);
+}
+
+TARGET("avx2") void chacha_first_blocks_avx2(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out)
+{
+	uint32_t w[4][8];
+
+	get_nonces(iv, w, 8);
+	block8(x, w, zero, out);
+}
+
+#endif /* CHACHA_X86 */
@@ -47,6 +47,79 @@ typedef struct chacha_ctx chacha_ctx;
 static const char sigma[16] = "expand 32-byte k";
 static const char tau[16] = "expand 16-byte k";
 
+struct chacha_impl {
+	const char *name;
+	size_t (*blocks)(chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes);
+	void (*first_blocks)(const chacha_ctx *x, const uint8_t *iv, uint8_t *out);
+	size_t lanes;
+};
+
+#ifdef CHACHA_X86
+static const struct chacha_impl chacha_impls[] = {
+	{"avx2", chacha_blocks_avx2, chacha_first_blocks_avx2, 8},
+	{"ssse3", chacha_blocks_ssse3, chacha_first_blocks_ssse3, 4},
+	{"sse2", chacha_blocks_sse2, chacha_first_blocks_sse2, 4},
+};
+#endif
+
+static const struct chacha_impl chacha_scalar = {"scalar", NULL, NULL, 1};
+
+/*
+ * The best implementation is picked once when the program starts, see
+ * chacha_init() below. Several threads may be encrypting at any time, so
+ * an implementation is published as a whole through this one pointer,
+ * and every operation loads it once.
+ */
+static const struct chacha_impl *chacha_impl = &chacha_scalar;
+
+static const struct chacha_impl *chacha_get(void)
+{
+	return __atomic_load_n(&chacha_impl, __ATOMIC_ACQUIRE);
+}
+
+bool chacha_set_impl(const char *name)
+{
+	const struct chacha_impl *impl = NULL;
+
+#ifdef CHACHA_X86
+	__builtin_cpu_init();
+
+	const bool supported[] = {
+		__builtin_cpu_supports("avx2"),
+		__builtin_cpu_supports("ssse3"),
+		__builtin_cpu_supports("sse2"),
+	};
+
+	for (size_t i = 0; i < sizeof chacha_impls / sizeof *chacha_impls; i++) {
+		if (name ? strcmp(name, chacha_impls[i].name) : !supported[i])
+			continue;
+		if (!supported[i])
+			return false;
+		impl = &chacha_impls[i];
+		break;
+	}
+#endif
+
+	if (!impl) {
+		if (name && strcmp(name, "scalar"))
+			return false;
+		impl = &chacha_scalar;
+	}
+
+	__atomic_store_n(&chacha_impl, impl, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void __attribute__((constructor)) chacha_init(void)
+{
+	chacha_set_impl(NULL);
+}
+
+const char *chacha_get_impl(void)
+{
+	return chacha_get()->name;
+}
+
 void chacha_keysetup(chacha_ctx *x, const uint8_t *k, uint32_t kbits)
 {
 	const char *constants;
@@ -79,8 +152,8 @@ void chacha_ivsetup(chacha_ctx *x, const uint8_t *iv, const uint8_t *counter)
 	x->input[15] = U8TO32_LITTLE(iv + 4);
 }
 
-void
-chacha_encrypt_bytes(chacha_ctx *x, const uint8_t *m, uint8_t *c, uint32_t bytes)
+static void
+chacha_encrypt_bytes_scalar(chacha_ctx *x, const uint8_t *m, uint8_t *c, uint32_t bytes)
 {
 	uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
 	uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -213,3 +286,74 @@ chacha_encrypt_bytes(chacha_ctx *x, const uint8_t *m, uint8_t *c, uint32_t bytes
 		m += 64;
 	}
 }
+
+void
+chacha_encrypt_bytes(chacha_ctx *x, const uint8_t *m, uint8_t *c, uint32_t bytes)
+{
+	const struct chacha_impl *impl = chacha_get();
+
+	if (impl->blocks && bytes > CHACHA_BLOCKLEN) {
+		size_t done = impl->blocks(x, m, c, bytes);
+		m += done;
+		c += done;
+		bytes -= done;
+
+		/*
+		 * If more than one block is left, it is still faster to run
+		 * them through the vector kernel via a temporary buffer. The
+		 * counter must end up where the scalar code would leave it.
+		 */
+		if (bytes > CHACHA_BLOCKLEN) {
+			uint8_t tmp[4 * CHACHA_BLOCKLEN];
+			uint32_t lo = x->input[12], hi = x->input[13];
+			uint32_t blocks = (bytes + CHACHA_BLOCKLEN - 1) / CHACHA_BLOCKLEN;
+
+			memcpy(tmp, m, bytes);
+			impl->blocks(x, tmp, tmp, sizeof tmp);
+			memcpy(c, tmp, bytes);
+
+			x->input[12] = lo + blocks;
+			x->input[13] = hi + (x->input[12] < lo);
+			return;
+		}
+	}
+
+	chacha_encrypt_bytes_scalar(x, m, c, bytes);
+}
+
+void
+chacha_first_blocks(const chacha_ctx *x, const uint8_t *iv, size_t count, uint8_t *out)
+{
+	const struct chacha_impl *impl = chacha_get();
+
+	if (impl->first_blocks) {
+		for (; count >= impl->lanes; count -= impl->lanes) {
+			impl->first_blocks(x, iv, out);
+			iv += impl->lanes * CHACHA_NONCELEN;
+			out += impl->lanes * CHACHA_BLOCKLEN;
+		}
+
+		/* Pad a partial group with copies of the first nonce */
+		if (count > 1) {
+			uint8_t ivs[8 * CHACHA_NONCELEN];
+			uint8_t blocks[8 * CHACHA_BLOCKLEN];
+
+			for (size_t i = 0; i < impl->lanes; i++)
+				memcpy(ivs + i * CHACHA_NONCELEN, iv + (i < count ? i : 0) * CHACHA_NONCELEN, CHACHA_NONCELEN);
+
+			impl->first_blocks(x, ivs, blocks);
+			memcpy(out, blocks, count * CHACHA_BLOCKLEN);
+			return;
+		}
+	}
+
+	for (; count; count--) {
+		chacha_ctx tmp = *x;
+
+		memset(out, 0, CHACHA_BLOCKLEN);
+		chacha_ivsetup(&tmp, iv, NULL);
+		chacha_encrypt_bytes_scalar(&tmp, out, out, CHACHA_BLOCKLEN);
+		iv += CHACHA_NONCELEN;
+		out += CHACHA_BLOCKLEN;
+	}
+}
@@ -21,4 +21,34 @@ void chacha_keysetup(struct chacha_ctx *x, const uint8_t *k, uint32_t kbits);
 void chacha_ivsetup(struct chacha_ctx *x, const uint8_t *iv, const uint8_t *ctr);
 void chacha_encrypt_bytes(struct chacha_ctx *x, const uint8_t *m, uint8_t * c, uint32_t bytes);
 
+/*
+ * Generate block 0 of the keystream for count different nonces at once.
+ * The nonces are stored back to back in iv, out receives count blocks.
+ * The context itself is not modified.
+ */
+void chacha_first_blocks(const struct chacha_ctx *x, const uint8_t *iv, size_t count, uint8_t *out);
+
+/*
+ * Select the implementation used by chacha_encrypt_bytes(): "scalar",
+ * "sse2", "ssse3" or "avx2". NULL selects the fastest one the CPU
+ * supports, which is also what happens when the program starts.
+ * Returns false if the implementation is unknown or not supported.
+ */
+bool chacha_set_impl(const char *name);
+const char *chacha_get_impl(void);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA_X86 1
+
+/* Multi-block kernels, they return the number of bytes processed. */
+size_t chacha_blocks_sse2(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes);
+size_t chacha_blocks_ssse3(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes);
+size_t chacha_blocks_avx2(struct chacha_ctx *x, const uint8_t *m, uint8_t *c, size_t bytes);
+
+/* Multi-nonce kernels, for four (SSE2, SSSE3) or eight (AVX2) nonces. */
+void chacha_first_blocks_sse2(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out);
+void chacha_first_blocks_ssse3(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out);
+void chacha_first_blocks_avx2(const struct chacha_ctx *x, const uint8_t *iv, uint8_t *out);
+#endif
+
 #endif /* CHACHA_H */
@@ -0,0 +1,180 @@
+/*
+ * AVX2 Poly1305 kernel, processing four blocks in parallel.
+ *
+ * Each 64 bit lane holds one of four interleaved accumulators in 26 bit
+ * limbs, the same representation as the 32 bit code in poly1305.c. For
+ * every group of four blocks, the accumulators are multiplied by r^4 and
+ * the next four blocks are added. At the end, the lanes are multiplied by
+ * r^4, r^3, r^2 and r respectively and summed, which gives the same result
+ * as the one block at a time Horner evaluation.
+ *
+ * AVX2 is enabled for these functions only, so this file does not need
+ * any special compiler flags. poly1305_set_impl() checks at runtime whether
+ * the CPU supports it.
+ */
+
+#include "../system.h"
+
+#include "poly1305.h"
+
+#ifdef POLY1305_X86_64
+
+#include <immintrin.h>
+
+#define TARGET(isa) __attribute__((target(isa)))
+
+/* Multiply two numbers in 26 bit limbs modulo 2^130 - 5, with partial reduction */
+static void mul26(uint32_t out[5], const uint32_t a[5], const uint32_t b[5])
+{
+	uint64_t t[5], c;
+	uint32_t s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+
+	t[0] = (uint64_t) a[0] * b[0] + (uint64_t) a[1] * s4 + (uint64_t) a[2] * s3 + (uint64_t) a[3] * s2 + (uint64_t) a[4] * s1;
+	t[1] = (uint64_t) a[0] * b[1] + (uint64_t) a[1] * b[0] + (uint64_t) a[2] * s4 + (uint64_t) a[3] * s3 + (uint64_t) a[4] * s2;
+	t[2] = (uint64_t) a[0] * b[2] + (uint64_t) a[1] * b[1] + (uint64_t) a[2] * b[0] + (uint64_t) a[3] * s4 + (uint64_t) a[4] * s3;
+	t[3] = (uint64_t) a[0] * b[3] + (uint64_t) a[1] * b[2] + (uint64_t) a[2] * b[1] + (uint64_t) a[3] * b[0] + (uint64_t) a[4] * s4;
+	t[4] = (uint64_t) a[0] * b[4] + (uint64_t) a[1] * b[3] + (uint64_t) a[2] * b[2] + (uint64_t) a[3] * b[1] + (uint64_t) a[4] * b[0];
+
+	c = t[0] >> 26;
+	out[0] = t[0] & 0x3ffffff;
+	t[1] += c;
+	c = t[1] >> 26;
+	out[1] = t[1] & 0x3ffffff;
+	t[2] += c;
+	c = t[2] >> 26;
+	out[2] = t[2] & 0x3ffffff;
+	t[3] += c;
+	c = t[3] >> 26;
+	out[3] = t[3] & 0x3ffffff;
+	t[4] += c;
+	c = t[4] >> 26;
+	out[4] = t[4] & 0x3ffffff;
+	out[0] += c * 5;
+	c = out[0] >> 26;
+	out[0] &= 0x3ffffff;
+	out[1] += c;
+}
+
+/* Split four blocks into 26 bit limbs, one block per lane */
+static inline TARGET("avx2") void load4(const uint8_t *m, __m256i l[5])
+{
+	const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+	__m256i a = _mm256_loadu_si256((const __m256i *)(m + 0));
+	__m256i b = _mm256_loadu_si256((const __m256i *)(m + 32));
+	__m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8);
+	__m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xd8);
+
+	l[0] = _mm256_and_si256(lo, mask);
+	l[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+	l[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask);
+	l[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+	l[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), _mm256_set1_epi64x(1 << 24));
+}
+
+#define MUL(a, b) _mm256_mul_epu32(a, b)
+#define ADD(a, b) _mm256_add_epi64(a, b)
+
+/* h = h * r in every lane, with s = 5 * r */
+static inline TARGET("avx2") void mul4(__m256i h[5], const __m256i r[5], const __m256i s[5])
+{
+	const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+	__m256i t[5], c;
+
+	t[0] = ADD(ADD(ADD(ADD(MUL(h[0], r[0]), MUL(h[1], s[4])), MUL(h[2], s[3])), MUL(h[3], s[2])), MUL(h[4], s[1]));
+	t[1] = ADD(ADD(ADD(ADD(MUL(h[0], r[1]), MUL(h[1], r[0])), MUL(h[2], s[4])), MUL(h[3], s[3])), MUL(h[4], s[2]));
+	t[2] = ADD(ADD(ADD(ADD(MUL(h[0], r[2]), MUL(h[1], r[1])), MUL(h[2], r[0])), MUL(h[3], s[4])), MUL(h[4], s[3]));
+	t[3] = ADD(ADD(ADD(ADD(MUL(h[0], r[3]), MUL(h[1], r[2])), MUL(h[2], r[1])), MUL(h[3], r[0])), MUL(h[4], s[4]));
+	t[4] = ADD(ADD(ADD(ADD(MUL(h[0], r[4]), MUL(h[1], r[3])), MUL(h[2], r[2])), MUL(h[3], r[1])), MUL(h[4], r[0]));
+
+	c = _mm256_srli_epi64(t[0], 26);
+	h[0] = _mm256_and_si256(t[0], mask);
+	t[1] = ADD(t[1], c);
+	c = _mm256_srli_epi64(t[1], 26);
+	h[1] = _mm256_and_si256(t[1], mask);
+	t[2] = ADD(t[2], c);
+	c = _mm256_srli_epi64(t[2], 26);
+	h[2] = _mm256_and_si256(t[2], mask);
+	t[3] = ADD(t[3], c);
+	c = _mm256_srli_epi64(t[3], 26);
+	h[3] = _mm256_and_si256(t[3], mask);
+	t[4] = ADD(t[4], c);
+	c = _mm256_srli_epi64(t[4], 26);
+	h[4] = _mm256_and_si256(t[4], mask);
+	h[0] = ADD(h[0], ADD(c, _mm256_slli_epi64(c, 2)));
+	c = _mm256_srli_epi64(h[0], 26);
+	h[0] = _mm256_and_si256(h[0], mask);
+	h[1] = ADD(h[1], c);
+}
+
+static inline TARGET("avx2") uint64_t hsum(__m256i v)
+{
+	__m128i x = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	return _mm_cvtsi128_si64(x) + _mm_extract_epi64(x, 1);
+}
+
+TARGET("avx2") size_t poly1305_blocks_avx2(poly1305_state_t *st, const uint8_t *m, size_t inlen)
+{
+	const uint32_t *r = st->u.l26.r;
+	uint32_t (*rpow)[5] = st->u.l26.rpow;
+	__m256i r4[5], s4[5], rl[5], sl[5], h[5], l[5];
+	uint64_t t[5], c;
+	size_t done;
+
+	if (inlen < 4 * POLY1305_BLOCKLEN)
+		return 0;
+
+	if (!st->u.l26.rpow_valid) {
+		mul26(rpow[0], r, r);
+		mul26(rpow[1], rpow[0], r);
+		mul26(rpow[2], rpow[1], r);
+		st->u.l26.rpow_valid = true;
+	}
+
+	for (int i = 0; i < 5; i++) {
+		/* r^4 in all lanes, and r^4 to r in the lanes for the final step */
+		r4[i] = _mm256_set1_epi64x(rpow[2][i]);
+		s4[i] = _mm256_set1_epi64x(rpow[2][i] * 5);
+		rl[i] = _mm256_set_epi64x(r[i], rpow[0][i], rpow[1][i], rpow[2][i]);
+		sl[i] = _mm256_set_epi64x(r[i] * 5, rpow[0][i] * 5, rpow[1][i] * 5, rpow[2][i] * 5);
+	}
+
+	/* the current accumulator goes into the first lane */
+	load4(m, h);
+	for (int i = 0; i < 5; i++)
+		h[i] = ADD(h[i], _mm256_set_epi64x(0, 0, 0, st->u.l26.h[i]));
+
+	for (done = 4 * POLY1305_BLOCKLEN; inlen - done >= 4 * POLY1305_BLOCKLEN; done += 4 * POLY1305_BLOCKLEN) {
+		mul4(h, r4, s4);
+		load4(m + done, l);
+		for (int i = 0; i < 5; i++)
+			h[i] = ADD(h[i], l[i]);
+	}
+
+	mul4(h, rl, sl);
+
+	for (int i = 0; i < 5; i++)
+		t[i] = hsum(h[i]);
+
+	c = t[0] >> 26;
+	st->u.l26.h[0] = t[0] & 0x3ffffff;
+	t[1] += c;
+	c = t[1] >> 26;
+	st->u.l26.h[1] = t[1] & 0x3ffffff;
+	t[2] += c;
+	c = t[2] >> 26;
+	st->u.l26.h[2] = t[2] & 0x3ffffff;
+	t[3] += c;
+	c = t[3] >> 26;
+	st->u.l26.h[3] = t[3] & 0x3ffffff;
+	t[4] += c;
+	c = t[4] >> 26;
+	st->u.l26.h[4] = t[4] & 0x3ffffff;
+	st->u.l26.h[0] += c * 5;
+	c = st->u.l26.h[0] >> 26;
+	st->u.l26.h[0] &= 0x3ffffff;
+	st->u.l26.h[1] += c;
+
+	return done;
+}
+
+#endif /* POLY1305_X86_64 */
@@ -23,20 +23,86 @@
 		(p)[3] = (uint8_t)((v) >> 24); \
 	} while (0)
 
-void
-poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN])
+/*
+ * Process full 16 byte blocks. The final flag is set for the padded last
+ * block of a message, which already contains its own high bit.
+ */
+static void
+poly1305_blocks_26(poly1305_state_t *st, const unsigned char *m, size_t inlen, int final)
 {
-	uint32_t t0, t1, t2, t3;
-	uint32_t h0, h1, h2, h3, h4;
+	const uint32_t hibit = final ? 0 : (1UL << 24);
 	uint32_t r0, r1, r2, r3, r4;
 	uint32_t s1, s2, s3, s4;
-	uint32_t b, nb;
-	size_t j;
+	uint32_t h0, h1, h2, h3, h4;
+	uint32_t t0, t1, t2, t3;
 	uint64_t t[5];
-	uint64_t f0, f1, f2, f3;
-	uint32_t g0, g1, g2, g3, g4;
-	uint64_t c;
-	unsigned char mp[16];
+	uint32_t b;
+
+	r0 = st->u.l26.r[0];
+	r1 = st->u.l26.r[1];
+	r2 = st->u.l26.r[2];
+	r3 = st->u.l26.r[3];
+	r4 = st->u.l26.r[4];
+
+	s1 = r1 * 5;
+	s2 = r2 * 5;
+	s3 = r3 * 5;
+	s4 = r4 * 5;
+
+	h0 = st->u.l26.h[0];
+	h1 = st->u.l26.h[1];
+	h2 = st->u.l26.h[2];
+	h3 = st->u.l26.h[3];
+	h4 = st->u.l26.h[4];
+
+	while (inlen >= POLY1305_BLOCKLEN) {
+		t0 = U8TO32_LE(m + 0);
+		t1 = U8TO32_LE(m + 4);
+		t2 = U8TO32_LE(m + 8);
+		t3 = U8TO32_LE(m + 12);
+
+		h0 += t0 & 0x3ffffff;
+		h1 += ((((uint64_t) t1 << 32) | t0) >> 26) & 0x3ffffff;
+		h2 += ((((uint64_t) t2 << 32) | t1) >> 20) & 0x3ffffff;
+		h3 += ((((uint64_t) t3 << 32) | t2) >> 14) & 0x3ffffff;
+		h4 += (t3 >> 8) | hibit;
+
+		t[0] = mul32x32_64(h0, r0) + mul32x32_64(h1, s4) + mul32x32_64(h2, s3) + mul32x32_64(h3, s2) + mul32x32_64(h4, s1);
+		t[1] = mul32x32_64(h0, r1) + mul32x32_64(h1, r0) + mul32x32_64(h2, s4) + mul32x32_64(h3, s3) + mul32x32_64(h4, s2);
+		t[2] = mul32x32_64(h0, r2) + mul32x32_64(h1, r1) + mul32x32_64(h2, r0) + mul32x32_64(h3, s4) + mul32x32_64(h4, s3);
+		t[3] = mul32x32_64(h0, r3) + mul32x32_64(h1, r2) + mul32x32_64(h2, r1) + mul32x32_64(h3, r0) + mul32x32_64(h4, s4);
+		t[4] = mul32x32_64(h0, r4) + mul32x32_64(h1, r3) + mul32x32_64(h2, r2) + mul32x32_64(h3, r1) + mul32x32_64(h4, r0);
+
+		h0 = (uint32_t) t[0] & 0x3ffffff;
+		t[1] += (t[0] >> 26);
+		h1 = (uint32_t) t[1] & 0x3ffffff;
+		b = (uint32_t) (t[1] >> 26);
+		t[2] += b;
+		h2 = (uint32_t) t[2] & 0x3ffffff;
+		b = (uint32_t) (t[2] >> 26);
+		t[3] += b;
+		h3 = (uint32_t) t[3] & 0x3ffffff;
+		b = (uint32_t) (t[3] >> 26);
+		t[4] += b;
+		h4 = (uint32_t) t[4] & 0x3ffffff;
+		b = (uint32_t) (t[4] >> 26);
+		h0 += b * 5;
+
+		m += POLY1305_BLOCKLEN;
+		inlen -= POLY1305_BLOCKLEN;
+	}
+
+	st->u.l26.h[0] = h0;
+	st->u.l26.h[1] = h1;
+	st->u.l26.h[2] = h2;
+	st->u.l26.h[3] = h3;
+	st->u.l26.h[4] = h4;
+}
+
+static void
+poly1305_init_26(poly1305_state_t *st, const unsigned char key[POLY1305_KEYLEN])
+{
+	uint32_t t0, t1, t2, t3;
 
 	/* clamp key */
 	t0 = U8TO32_LE(key + 0);
@@ -45,102 +111,43 @@ poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t
 	t3 = U8TO32_LE(key + 12);
 
 	/* precompute multipliers */
-	r0 = t0 & 0x3ffffff;
+	st->u.l26.r[0] = t0 & 0x3ffffff;
 	t0 >>= 26;
 	t0 |= t1 << 6;
-	r1 = t0 & 0x3ffff03;
+	st->u.l26.r[1] = t0 & 0x3ffff03;
 	t1 >>= 20;
 	t1 |= t2 << 12;
-	r2 = t1 & 0x3ffc0ff;
+	st->u.l26.r[2] = t1 & 0x3ffc0ff;
 	t2 >>= 14;
 	t2 |= t3 << 18;
-	r3 = t2 & 0x3f03fff;
+	st->u.l26.r[3] = t2 & 0x3f03fff;
 	t3 >>= 8;
-	r4 = t3 & 0x00fffff;
-
-	s1 = r1 * 5;
-	s2 = r2 * 5;
-	s3 = r3 * 5;
-	s4 = r4 * 5;
+	st->u.l26.r[4] = t3 & 0x00fffff;
 
 	/* init state */
-	h0 = 0;
-	h1 = 0;
-	h2 = 0;
-	h3 = 0;
-	h4 = 0;
+	st->u.l26.h[0] = 0;
+	st->u.l26.h[1] = 0;
+	st->u.l26.h[2] = 0;
+	st->u.l26.h[3] = 0;
+	st->u.l26.h[4] = 0;
 
-	/* full blocks */
-	if (inlen < 16)
-		goto poly1305_donna_atmost15bytes;
-
- poly1305_donna_16bytes:
-	m += 16;
-	inlen -= 16;
-
-	t0 = U8TO32_LE(m - 16);
-	t1 = U8TO32_LE(m - 12);
-	t2 = U8TO32_LE(m - 8);
-	t3 = U8TO32_LE(m - 4);
-
-	h0 += t0 & 0x3ffffff;
-	h1 += ((((uint64_t) t1 << 32) | t0) >> 26) & 0x3ffffff;
-	h2 += ((((uint64_t) t2 << 32) | t1) >> 20) & 0x3ffffff;
-	h3 += ((((uint64_t) t3 << 32) | t2) >> 14) & 0x3ffffff;
-	h4 += (t3 >> 8) | (1 << 24);
-
- poly1305_donna_mul:
-	t[0] = mul32x32_64(h0, r0) + mul32x32_64(h1, s4) + mul32x32_64(h2, s3) + mul32x32_64(h3, s2) + mul32x32_64(h4, s1);
-	t[1] = mul32x32_64(h0, r1) + mul32x32_64(h1, r0) + mul32x32_64(h2, s4) + mul32x32_64(h3, s3) + mul32x32_64(h4, s2);
-	t[2] = mul32x32_64(h0, r2) + mul32x32_64(h1, r1) + mul32x32_64(h2, r0) + mul32x32_64(h3, s4) + mul32x32_64(h4, s3);
-	t[3] = mul32x32_64(h0, r3) + mul32x32_64(h1, r2) + mul32x32_64(h2, r1) + mul32x32_64(h3, r0) + mul32x32_64(h4, s4);
-	t[4] = mul32x32_64(h0, r4) + mul32x32_64(h1, r3) + mul32x32_64(h2, r2) + mul32x32_64(h3, r1) + mul32x32_64(h4, r0);
-
-	h0 = (uint32_t) t[0] & 0x3ffffff;
-	c = (t[0] >> 26);
-	t[1] += c;
-	h1 = (uint32_t) t[1] & 0x3ffffff;
-	b = (uint32_t) (t[1] >> 26);
-	t[2] += b;
-	h2 = (uint32_t) t[2] & 0x3ffffff;
-	b = (uint32_t) (t[2] >> 26);
-	t[3] += b;
-	h3 = (uint32_t) t[3] & 0x3ffffff;
-	b = (uint32_t) (t[3] >> 26);
-	t[4] += b;
-	h4 = (uint32_t) t[4] & 0x3ffffff;
-	b = (uint32_t) (t[4] >> 26);
-	h0 += b * 5;
+	st->u.l26.rpow_valid = false;
+}
 
-	if (inlen >= 16)
-		goto poly1305_donna_16bytes;
+static void
+poly1305_finish_26(poly1305_state_t *st, unsigned char out[POLY1305_TAGLEN])
+{
+	uint32_t h0, h1, h2, h3, h4;
+	uint32_t g0, g1, g2, g3, g4;
+	uint64_t f0, f1, f2, f3;
+	uint32_t b, nb;
+
+	h0 = st->u.l26.h[0];
+	h1 = st->u.l26.h[1];
+	h2 = st->u.l26.h[2];
+	h3 = st->u.l26.h[3];
+	h4 = st->u.l26.h[4];
 
-	/* final bytes */
- poly1305_donna_atmost15bytes:
-	if (!inlen)
-		goto poly1305_donna_finish;
-
-	for (j = 0; j < inlen; j++)
-		mp[j] = m[j];
-	mp[j++] = 1;
-	for (; j < 16; j++)
-		mp[j] = 0;
-	inlen = 0;
-
-	t0 = U8TO32_LE(mp + 0);
-	t1 = U8TO32_LE(mp + 4);
-	t2 = U8TO32_LE(mp + 8);
-	t3 = U8TO32_LE(mp + 12);
-
-	h0 += t0 & 0x3ffffff;
-	h1 += ((((uint64_t) t1 << 32) | t0) >> 26) & 0x3ffffff;
-	h2 += ((((uint64_t) t2 << 32) | t1) >> 20) & 0x3ffffff;
-	h3 += ((((uint64_t) t3 << 32) | t2) >> 14) & 0x3ffffff;
-	h4 += (t3 >> 8);
-
-	goto poly1305_donna_mul;
-
- poly1305_donna_finish:
 	b = h0 >> 26;
 	h0 = h0 & 0x3ffffff;
 	h1 += b;
@@ -182,10 +189,10 @@ poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t
 	h3 = (h3 & nb) | (g3 & b);
 	h4 = (h4 & nb) | (g4 & b);
 
-	f0 = ((h0) | (h1 << 26)) + (uint64_t) U8TO32_LE(&key[16]);
-	f1 = ((h1 >> 6) | (h2 << 20)) + (uint64_t) U8TO32_LE(&key[20]);
-	f2 = ((h2 >> 12) | (h3 << 14)) + (uint64_t) U8TO32_LE(&key[24]);
-	f3 = ((h3 >> 18) | (h4 << 8)) + (uint64_t) U8TO32_LE(&key[28]);
+	f0 = ((h0) | (h1 << 26)) + (uint64_t) st->pad[0];
+	f1 = ((h1 >> 6) | (h2 << 20)) + (uint64_t) st->pad[1];
+	f2 = ((h2 >> 12) | (h3 << 14)) + (uint64_t) st->pad[2];
+	f3 = ((h3 >> 18) | (h4 << 8)) + (uint64_t) st->pad[3];
 
 	U32TO8_LE(&out[0], f0);
 	f1 += (f0 >> 32);
@@ -195,3 +202,339 @@ poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t
 	f3 += (f2 >> 32);
 	U32TO8_LE(&out[12], f3);
 }
+
+#ifdef __SIZEOF_INT128__
+/*
+ * poly1305-donna-64.h from https://github.com/floodyberry/poly1305-donna,
+ * using three 44 bit limbs and 64x64 bit multiplications.
+ */
+
+typedef unsigned __int128 uint128_t;
+
+#define U8TO64_LE(p) \
+	(((uint64_t) U8TO32_LE(p)) | ((uint64_t) U8TO32_LE((p) + 4) << 32))
+
+#define U64TO8_LE(p, v) \
+	do { \
+		U32TO8_LE((p), (uint32_t) (v)); \
+		U32TO8_LE((p) + 4, (uint32_t) ((v) >> 32)); \
+	} while (0)
+
+static void
+poly1305_init_44(poly1305_state_t *st, const unsigned char key[POLY1305_KEYLEN])
+{
+	uint64_t t0, t1;
+
+	/* clamp key */
+	t0 = U8TO64_LE(key + 0);
+	t1 = U8TO64_LE(key + 8);
+
+	st->u.l44.r[0] = t0 & 0xffc0fffffff;
+	st->u.l44.r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+	st->u.l44.r[2] = (t1 >> 24) & 0x00ffffffc0f;
+
+	/* init state */
+	st->u.l44.h[0] = 0;
+	st->u.l44.h[1] = 0;
+	st->u.l44.h[2] = 0;
+}
+
+static void
+poly1305_blocks_44(poly1305_state_t *st, const unsigned char *m, size_t inlen, int final)
+{
+	const uint64_t hibit = final ? 0 : ((uint64_t) 1 << 40);
+	uint64_t r0, r1, r2;
+	uint64_t s1, s2;
+	uint64_t h0, h1, h2;
+	uint64_t t0, t1;
+	uint128_t d0, d1, d2;
+	uint64_t c;
+
+	r0 = st->u.l44.r[0];
+	r1 = st->u.l44.r[1];
+	r2 = st->u.l44.r[2];
+
+	s1 = r1 * (5 << 2);
+	s2 = r2 * (5 << 2);
+
+	h0 = st->u.l44.h[0];
+	h1 = st->u.l44.h[1];
+	h2 = st->u.l44.h[2];
+
+	while (inlen >= POLY1305_BLOCKLEN) {
+		t0 = U8TO64_LE(m + 0);
+		t1 = U8TO64_LE(m + 8);
+
+		h0 += t0 & 0xfffffffffff;
+		h1 += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffff;
+		h2 += ((t1 >> 24) & 0x3ffffffffff) | hibit;
+
+		d0 = (uint128_t) h0 * r0 + (uint128_t) h1 * s2 + (uint128_t) h2 * s1;
+		d1 = (uint128_t) h0 * r1 + (uint128_t) h1 * r0 + (uint128_t) h2 * s2;
+		d2 = (uint128_t) h0 * r2 + (uint128_t) h1 * r1 + (uint128_t) h2 * r0;
+
+		c = (uint64_t) (d0 >> 44);
+		h0 = (uint64_t) d0 & 0xfffffffffff;
+		d1 += c;
+		c = (uint64_t) (d1 >> 44);
+		h1 = (uint64_t) d1 & 0xfffffffffff;
+		d2 += c;
+		c = (uint64_t) (d2 >> 42);
+		h2 = (uint64_t) d2 & 0x3ffffffffff;
+		h0 += c * 5;
+		c = h0 >> 44;
+		h0 &= 0xfffffffffff;
+		h1 += c;
+
+		m += POLY1305_BLOCKLEN;
+		inlen -= POLY1305_BLOCKLEN;
+	}
+
+	st->u.l44.h[0] = h0;
+	st->u.l44.h[1] = h1;
+	st->u.l44.h[2] = h2;
+}
+
+static void
+poly1305_finish_44(poly1305_state_t *st, unsigned char out[POLY1305_TAGLEN])
+{
+	uint64_t h0, h1, h2, c;
+	uint64_t g0, g1, g2;
+	uint64_t t0, t1;
+
+	h0 = st->u.l44.h[0];
+	h1 = st->u.l44.h[1];
+	h2 = st->u.l44.h[2];
+
+	/* fully carry h */
+	c = h1 >> 44;
+	h1 &= 0xfffffffffff;
+	h2 += c;
+	c = h2 >> 42;
+	h2 &= 0x3ffffffffff;
+	h0 += c * 5;
+	c = h0 >> 44;
+	h0 &= 0xfffffffffff;
+	h1 += c;
+	c = h1 >> 44;
+	h1 &= 0xfffffffffff;
+	h2 += c;
+	c = h2 >> 42;
+	h2 &= 0x3ffffffffff;
+	h0 += c * 5;
+	c = h0 >> 44;
+	h0 &= 0xfffffffffff;
+	h1 += c;
+
+	/* compute h + -p */
+	g0 = h0 + 5;
+	c = g0 >> 44;
+	g0 &= 0xfffffffffff;
+	g1 = h1 + c;
+	c = g1 >> 44;
+	g1 &= 0xfffffffffff;
+	g2 = h2 + c - ((uint64_t) 1 << 42);
+
+	/* select h if h < p, or h + -p if h >= p */
+	c = (g2 >> 63) - 1;
+	g0 &= c;
+	g1 &= c;
+	g2 &= c;
+	c = ~c;
+	h0 = (h0 & c) | g0;
+	h1 = (h1 & c) | g1;
+	h2 = (h2 & c) | g2;
+
+	/* h = h + pad */
+	t0 = ((uint64_t) st->pad[1] << 32) | st->pad[0];
+	t1 = ((uint64_t) st->pad[3] << 32) | st->pad[2];
+
+	h0 += t0 & 0xfffffffffff;
+	c = h0 >> 44;
+	h0 &= 0xfffffffffff;
+	h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + c;
+	c = h1 >> 44;
+	h1 &= 0xfffffffffff;
+	h2 += ((t1 >> 24) & 0x3ffffffffff) + c;
+	h2 &= 0x3ffffffffff;
+
+	/* mac = h % 2^128 */
+	h0 = h0 | (h1 << 44);
+	h1 = (h1 >> 20) | (h2 << 24);
+
+	U64TO8_LE(&out[0], h0);
+	U64TO8_LE(&out[8], h1);
+}
+#endif
+
+enum {
+	POLY1305_SCALAR32,
+	POLY1305_SCALAR64,
+	POLY1305_AVX2,
+};
+
+static const char *const poly1305_impl_names[] = {"scalar32", "scalar64", "avx2"};
+
+/*
+ * The best implementation is picked once when the program starts, see
+ * poly1305_select() below. Other threads may be starting a MAC at any
+ * time, so it is only read and written atomically.
+ */
+static int poly1305_impl = POLY1305_SCALAR32;
+
+bool
+poly1305_set_impl(const char *name)
+{
+	bool supported[3] = {true, false, false};
+
+#ifdef __SIZEOF_INT128__
+	supported[POLY1305_SCALAR64] = true;
+#endif
+#ifdef POLY1305_X86_64
+	__builtin_cpu_init();
+	supported[POLY1305_AVX2] = __builtin_cpu_supports("avx2");
+#endif
+
+	if (!name) {
+		/* the vector kernel is the fastest, then the 64 bit code */
+		int order[3] = {POLY1305_AVX2, POLY1305_SCALAR64, POLY1305_SCALAR32};
+
+		for (int i = 0; i < 3; i++) {
+			if (supported[order[i]]) {
+				__atomic_store_n(&poly1305_impl, order[i], __ATOMIC_RELEASE);
+				return true;
+			}
+		}
+	}
+
+	for (int i = 0; i < 3; i++) {
+		if (name && !strcmp(name, poly1305_impl_names[i])) {
+			if (!supported[i])
+				return false;
+			__atomic_store_n(&poly1305_impl, i, __ATOMIC_RELEASE);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void __attribute__((constructor))
+poly1305_select(void)
+{
+	poly1305_set_impl(NULL);
+}
+
+const char *
+poly1305_get_impl(void)
+{
+	return poly1305_impl_names[__atomic_load_n(&poly1305_impl, __ATOMIC_ACQUIRE)];
+}
+
+static void
+poly1305_blocks(poly1305_state_t *st, const unsigned char *m, size_t inlen, int final)
+{
+#ifdef __SIZEOF_INT128__
+	if (st->impl == POLY1305_SCALAR64) {
+		poly1305_blocks_44(st, m, inlen, final);
+		return;
+	}
+#endif
+#ifdef POLY1305_X86_64
+	/* the vector kernel only pays off for a few groups of four blocks */
+	if (st->impl == POLY1305_AVX2 && inlen >= 16 * POLY1305_BLOCKLEN && !final) {
+		size_t done = poly1305_blocks_avx2(st, m, inlen);
+		m += done;
+		inlen -= done;
+	}
+#endif
+	poly1305_blocks_26(st, m, inlen, final);
+}
+
+void
+poly1305_init(poly1305_state_t *st, const unsigned char key[POLY1305_KEYLEN])
+{
+	st->impl = __atomic_load_n(&poly1305_impl, __ATOMIC_ACQUIRE);
+
+#ifdef __SIZEOF_INT128__
+	if (st->impl == POLY1305_SCALAR64)
+		poly1305_init_44(st, key);
+	else
+#endif
+		poly1305_init_26(st, key);
+
+	st->pad[0] = U8TO32_LE(key + 16);
+	st->pad[1] = U8TO32_LE(key + 20);
+	st->pad[2] = U8TO32_LE(key + 24);
+	st->pad[3] = U8TO32_LE(key + 28);
+
+	st->leftover = 0;
+}
+
+void
+poly1305_update(poly1305_state_t *st, const unsigned char *m, size_t inlen)
+{
+	size_t i, want;
+
+	/* complete a partial block left over from the previous call */
+	if (st->leftover) {
+		want = POLY1305_BLOCKLEN - st->leftover;
+		if (want > inlen)
+			want = inlen;
+		for (i = 0; i < want; i++)
+			st->buffer[st->leftover + i] = m[i];
+		inlen -= want;
+		m += want;
+		st->leftover += want;
+		if (st->leftover < POLY1305_BLOCKLEN)
+			return;
+		poly1305_blocks(st, st->buffer, POLY1305_BLOCKLEN, 0);
+		st->leftover = 0;
+	}
+
+	/* full blocks */
+	if (inlen >= POLY1305_BLOCKLEN) {
+		want = inlen & ~(size_t)(POLY1305_BLOCKLEN - 1);
+		poly1305_blocks(st, m, want, 0);
+		m += want;
+		inlen -= want;
+	}
+
+	/* keep the rest for later */
+	for (i = 0; i < inlen; i++)
+		st->buffer[i] = m[i];
+	st->leftover = inlen;
+}
+
+void
+poly1305_finish(poly1305_state_t *st, unsigned char out[POLY1305_TAGLEN])
+{
+	size_t i;
+
+	/* final bytes */
+	if (st->leftover) {
+		i = st->leftover;
+		st->buffer[i++] = 1;
+		for (; i < POLY1305_BLOCKLEN; i++)
+			st->buffer[i] = 0;
+		poly1305_blocks(st, st->buffer, POLY1305_BLOCKLEN, 1);
+	}
+
+#ifdef __SIZEOF_INT128__
+	if (st->impl == POLY1305_SCALAR64) {
+		poly1305_finish_44(st, out);
+		return;
+	}
+#endif
+	poly1305_finish_26(st, out);
+}
+
+void
+poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN])
+{
+	poly1305_state_t st;
+
+	poly1305_init(&st, key);
+	poly1305_update(&st, m, inlen);
+	poly1305_finish(&st, out);
+}
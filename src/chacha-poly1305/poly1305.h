@@ -11,6 +11,50 @@
 #define POLY1305_KEYLEN		32
 #define POLY1305_TAGLEN		16
 
+#define POLY1305_BLOCKLEN	16
+
+typedef struct poly1305_state {
+	union {
+		/* 26 bit limbs, used by the 32 bit and the AVX2 implementation */
+		struct {
+			uint32_t r[5];
+			uint32_t h[5];
+			uint32_t rpow[3][5];	/* r^2, r^3 and r^4, for the AVX2 kernel */
+			bool rpow_valid;
+		} l26;
+		/* 44 bit limbs, used by the 64 bit implementation */
+		struct {
+			uint64_t r[3];
+			uint64_t h[3];
+		} l44;
+	} u;
+	uint32_t pad[4];
+	size_t leftover;
+	uint8_t buffer[POLY1305_BLOCKLEN];
+	uint8_t impl;
+} poly1305_state_t;
+
+void poly1305_init(poly1305_state_t *st, const uint8_t key[POLY1305_KEYLEN]);
+void poly1305_update(poly1305_state_t *st, const uint8_t *m, size_t inlen);
+void poly1305_finish(poly1305_state_t *st, uint8_t out[POLY1305_TAGLEN]);
+
 void poly1305_auth(uint8_t out[POLY1305_TAGLEN], const uint8_t *m, size_t inlen, const uint8_t key[POLY1305_KEYLEN]);
 
+/*
+ * Select the implementation used by poly1305_init(): "scalar32", "scalar64"
+ * or "avx2". NULL selects the fastest one the CPU supports, which is also
+ * what happens when the program starts. A state keeps using the
+ * implementation it was initialized with. Returns false if the
+ * implementation is unknown or not supported.
+ */
+bool poly1305_set_impl(const char *name);
+const char *poly1305_get_impl(void);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define POLY1305_X86_64 1
+
+/* Vector kernel, returns the number of bytes processed. */
+size_t poly1305_blocks_avx2(poly1305_state_t *st, const uint8_t *m, size_t inlen);
+#endif
+
 #endif				/* POLY1305_H */
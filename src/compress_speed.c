@@ -0,0 +1,252 @@
+/*
+    compress_speed.c -- packet compression benchmark
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "compression.h"
+
+// Compresses a corpus of packets one at a time with every supported compression level,
+// and reports the size of the compressed packets relative to the original ones,
+// and how many bytes of original data per second are compressed and uncompressed.
+// Packets that do not get smaller are counted at their original size, since those are sent uncompressed.
+// The dictionary levels use a dictionary built from other packets of the same kind.
+// Besides the built-in corpora, files can be given on the command line, which are split into packets.
+
+#define MAXPACKET 1500
+#define NPACKETS 1000
+#define DICTSIZE 16384
+
+typedef struct corpus_t {
+	const char *name;
+	int count;
+	uint16_t len[NPACKETS];
+	uint8_t data[NPACKETS][MAXPACKET];
+	uint8_t dict[DICTSIZE];
+	size_t dictlen;
+} corpus_t;
+
+static const int levels[] = {1, COMPRESS_LZ4, COMPRESS_LZ4_DICT, COMPRESS_ZSTD, COMPRESS_ZSTD_DICT};
+
+struct timespec start;
+struct timespec end;
+double elapsed;
+double rate;
+unsigned int count;
+
+static void clock_start() {
+	count = 0;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+}
+
+static bool clock_countto(double seconds) {
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	elapsed = end.tv_sec + end.tv_nsec * 1e-9 - start.tv_sec - start.tv_nsec * 1e-9;
+	if(elapsed < seconds)
+		return ++count;
+
+	rate = count / elapsed;
+	return false;
+}
+
+/* Corpus generators, seed 0 is used for the dictionary and 1 for the packets that are measured */
+
+// JSON telemetry records, a few per packet
+static int telemetry_json(uint8_t *buf, unsigned int *seed, int i) {
+	int len = 0;
+
+	for(int j = 0; j < 3; j++) {
+		int r = rand_r(seed);
+		len += snprintf((char *)buf + len, MAXPACKET - len,
+			"{\"device\":\"sensor-%04d\",\"timestamp\":%d,\"temperature\":%.2f,\"humidity\":%.1f,\"battery\":%d,\"status\":\"%s\"}\n",
+			r % 200, 1500000000 + i * 10 + j, 20 + (r % 1000) / 100.0, 40 + (r % 300) / 10.0, r % 101, r % 17 ? "ok" : "degraded");
+	}
+
+	return len;
+}
+
+// Binary sensor samples, a small header and 32 slowly changing 16 bit values
+static int telemetry_binary(uint8_t *buf, unsigned int *seed, int i) {
+	uint32_t hdr[3] = {htonl(0x4d4c5431), htonl(i), htonl(rand_r(seed) % 64)};
+	memcpy(buf, hdr, sizeof hdr);
+
+	int16_t value = rand_r(seed) % 1000;
+	for(int j = 0; j < 32; j++) {
+		value += rand_r(seed) % 7 - 3;
+		uint16_t v = htons(value);
+		memcpy(buf + sizeof hdr + 2 * j, &v, 2);
+	}
+
+	return sizeof hdr + 64;
+}
+
+// Log lines, filling up most of a packet
+static int log_text(uint8_t *buf, unsigned int *seed, int i) {
+	static const char *const facility[] = {"net", "storage", "auth", "scheduler"};
+	static const char *const message[] = {
+		"connection established to peer",
+		"request completed successfully in",
+		"retrying operation after timeout of",
+		"cache miss for key, fetching from backend, latency",
+	};
+	int len = 0;
+
+	while(len < 1000) {
+		int r = rand_r(seed);
+		len += snprintf((char *)buf + len, MAXPACKET - len, "2024-05-%02d %02d:%02d:%02d host-%02d %s[%d]: %s %d ms\n",
+			1 + r % 28, r % 24, r % 60, (r / 60) % 60, r % 16, facility[r % 4], 1000 + r % 9000, message[(r / 7) % 4], r % 500);
+	}
+
+	return len;
+}
+
+// Random data, like already compressed or encrypted payloads
+static int random_data(uint8_t *buf, unsigned int *seed, int i) {
+	for(int j = 0; j < 1000; j++)
+		buf[j] = rand_r(seed);
+
+	return 1000;
+}
+
+static void generate(corpus_t *c, const char *name, int (*generator)(uint8_t *buf, unsigned int *seed, int i)) {
+	unsigned int seed = 0;
+	uint8_t buf[MAXPACKET];
+
+	c->name = name;
+	c->dictlen = 0;
+
+	for(int i = 0; c->dictlen < DICTSIZE; i++) {
+		int len = generator(buf, &seed, i);
+		if(len > DICTSIZE - c->dictlen)
+			len = DICTSIZE - c->dictlen;
+		memcpy(c->dict + c->dictlen, buf, len);
+		c->dictlen += len;
+	}
+
+	seed = 1;
+
+	for(c->count = 0; c->count < NPACKETS; c->count++)
+		c->len[c->count] = generator(c->data[c->count], &seed, c->count);
+}
+
+// Use the start of a file as the dictionary, and split the rest into packets
+static bool load(corpus_t *c, const char *filename, int packetsize) {
+	FILE *f = fopen(filename, "rb");
+	if(!f) {
+		fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	c->name = filename;
+	c->dictlen = fread(c->dict, 1, DICTSIZE, f);
+
+	for(c->count = 0; c->count < NPACKETS; c->count++) {
+		c->len[c->count] = fread(c->data[c->count], 1, packetsize, f);
+		if(!c->len[c->count])
+			break;
+	}
+
+	fclose(f);
+
+	if(!c->count) {
+		fprintf(stderr, "%s is too small\n", filename);
+		return false;
+	}
+
+	return true;
+}
+
+static void run(corpus_t *c, double duration) {
+	compression_t *comp = compression_init();
+	uint8_t compressed[NPACKETS][MAXPACKET + 64];
+	int clen[NPACKETS];
+	uint8_t out[MAXPACKET];
+	size_t total = 0;
+
+	for(int i = 0; i < c->count; i++)
+		total += c->len[i];
+
+	if(!compression_set_dictionary(comp, c->dict, c->dictlen)) {
+		fprintf(stderr, "Could not load dictionary\n");
+		exit(1);
+	}
+
+	fprintf(stderr, "%s, %d packets of %zu bytes on average:\n", c->name, c->count, total / c->count);
+
+	for(size_t l = 0; l < sizeof levels / sizeof *levels; l++) {
+		int level = levels[l];
+
+		if(!compression_supported(comp, level))
+			continue;
+
+		// Check that all packets survive the round trip, and measure the compression ratio
+		size_t ctotal = 0;
+
+		for(int i = 0; i < c->count; i++) {
+			clen[i] = compress_packet(comp, compressed[i], sizeof compressed[i], c->data[i], c->len[i], level);
+
+			if(clen[i] < 0 || uncompress_packet(comp, out, sizeof out, compressed[i], clen[i], level) != c->len[i] || memcmp(out, c->data[i], c->len[i])) {
+				fprintf(stderr, "Error: packet %d does not survive compression with %s\n", i, compression_name(level));
+				exit(1);
+			}
+
+			ctotal += clen[i] < c->len[i] ? clen[i] : c->len[i];
+		}
+
+		fprintf(stderr, "  %-9s ratio %5.1lf%%", compression_name(level), 100.0 * ctotal / total);
+
+		for(clock_start(); clock_countto(duration);)
+			for(int i = 0; i < c->count; i++)
+				compress_packet(comp, compressed[i], sizeof compressed[i], c->data[i], c->len[i], level);
+
+		fprintf(stderr, ", compress %9.2lf MB/s", rate * total / 1e6);
+
+		for(clock_start(); clock_countto(duration);)
+			for(int i = 0; i < c->count; i++)
+				uncompress_packet(comp, out, sizeof out, compressed[i], clen[i], level);
+
+		fprintf(stderr, ", uncompress %9.2lf MB/s\n", rate * total / 1e6);
+	}
+
+	compression_exit(comp);
+}
+
+int main(int argc, char *argv[]) {
+	double duration = argc > 1 ? atof(argv[1]) : 1;
+	static corpus_t corpus;
+
+	if(duration <= 0) {
+		fprintf(stderr, "Usage: %s [seconds] [file...]\n", argv[0]);
+		return 1;
+	}
+
+	generate(&corpus, "JSON telemetry", telemetry_json);
+	run(&corpus, duration);
+	generate(&corpus, "binary telemetry", telemetry_binary);
+	run(&corpus, duration);
+	generate(&corpus, "log lines", log_text);
+	run(&corpus, duration);
+	generate(&corpus, "random data", random_data);
+	run(&corpus, duration);
+
+	for(int i = 2; i < argc; i++)
+		if(load(&corpus, argv[i], 1000))
+			run(&corpus, duration);
+
+	return 0;
+}
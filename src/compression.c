@@ -0,0 +1,341 @@
+/*
+    compression.c -- packet compression
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compression.h"
+#include "xalloc.h"
+#include "ed25519/sha512.h"
+
+/* Every packet is compressed on its own, so the receiver can uncompress it even if earlier ones were lost.
+   The codecs keep their working state here, so it does not have to be allocated for every packet.
+   Small packets compress badly without any history, a dictionary with typical packet contents,
+   shared by all nodes beforehand, gives them something to refer to. */
+
+struct compression_t {
+	uint8_t *dict;
+	size_t dictlen;
+	int dictid;                     /* identifies the dictionary to other nodes */
+#ifdef HAVE_LZ4
+	LZ4_stream_t *lz4;              /* working state */
+	LZ4_stream_t *lz4dict;          /* state with the dictionary loaded, copied to the working state for every packet */
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd_cctx;
+	ZSTD_DCtx *zstd_dctx;
+	ZSTD_CDict *zstd_cdict;
+	ZSTD_DDict *zstd_ddict;
+#endif
+};
+
+#define ZSTD_LEVEL 1
+
+compression_t *compression_init(void) {
+	compression_t *c = xzalloc(sizeof *c);
+
+#ifdef HAVE_LZ4
+	c->lz4 = LZ4_createStream();
+#endif
+#ifdef HAVE_ZSTD
+	c->zstd_cctx = ZSTD_createCCtx();
+	c->zstd_dctx = ZSTD_createDCtx();
+#endif
+
+	return c;
+}
+
+static void free_dictionary(compression_t *c) {
+#ifdef HAVE_LZ4
+	if(c->lz4dict)
+		LZ4_freeStream(c->lz4dict);
+	c->lz4dict = NULL;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(c->zstd_cdict);
+	ZSTD_freeDDict(c->zstd_ddict);
+	c->zstd_cdict = NULL;
+	c->zstd_ddict = NULL;
+#endif
+	free(c->dict);
+	c->dict = NULL;
+	c->dictlen = 0;
+}
+
+void compression_exit(compression_t *c) {
+	if(!c)
+		return;
+
+	free_dictionary(c);
+#ifdef HAVE_LZ4
+	if(c->lz4)
+		LZ4_freeStream(c->lz4);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(c->zstd_cctx);
+	ZSTD_freeDCtx(c->zstd_dctx);
+#endif
+	free(c);
+}
+
+// Set the dictionary used by the COMPRESS_*_DICT levels, or remove it if len is 0.
+// If the new dictionary cannot be loaded, the old one is kept.
+bool compression_set_dictionary(compression_t *c, const void *dict, size_t len) {
+	if(!len) {
+		free_dictionary(c);
+		return true;
+	}
+
+	compression_t d = {.dict = xmalloc(len), .dictlen = len};
+	memcpy(d.dict, dict, len);
+
+#ifdef HAVE_LZ4
+	// LZ4 only looks at the last 64 kB of the dictionary
+	d.lz4dict = LZ4_createStream();
+	if(!d.lz4dict || LZ4_loadDict(d.lz4dict, (const char *)d.dict, len) < 0) {
+		free_dictionary(&d);
+		return false;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	d.zstd_cdict = ZSTD_createCDict(d.dict, len, ZSTD_LEVEL);
+	d.zstd_ddict = ZSTD_createDDict(d.dict, len);
+	if(!d.zstd_cdict || !d.zstd_ddict) {
+		free_dictionary(&d);
+		return false;
+	}
+#endif
+
+	// Nothing in a compressed packet says which dictionary was used, and LZ4 cannot tell if it was the wrong one
+	uint8_t hash[64];
+	sha512(d.dict, len, hash);
+	d.dictid = hash[0] | hash[1] << 8 | hash[2] << 16 | (hash[3] & 0x7f) << 24;
+
+	free_dictionary(c);
+	c->dict = d.dict;
+	c->dictlen = d.dictlen;
+	c->dictid = d.dictid;
+#ifdef HAVE_LZ4
+	c->lz4dict = d.lz4dict;
+#endif
+#ifdef HAVE_ZSTD
+	c->zstd_cdict = d.zstd_cdict;
+	c->zstd_ddict = d.zstd_ddict;
+#endif
+
+	return true;
+}
+
+// The ID that nodes exchange to check that they have the same dictionary, -1 if there is none.
+int compression_dictionary_id(const compression_t *c) {
+	return c && c->dict ? c->dictid : -1;
+}
+
+// The level that uses the same codec without the dictionary, for nodes that do not have the same one.
+int compression_without_dictionary(int level) {
+	switch(level) {
+	case COMPRESS_LZ4_DICT:
+		return COMPRESS_LZ4;
+	case COMPRESS_ZSTD_DICT:
+		return COMPRESS_ZSTD;
+	default:
+		return level;
+	}
+}
+
+// The level to use with a node that asks for the given level and has the dictionary with the ID dictid.
+// The dictionary levels need the same dictionary on both sides, otherwise the codec is used without it.
+int compression_negotiate(const compression_t *c, int level, int dictid) {
+	return dictid == compression_dictionary_id(c) ? level : compression_without_dictionary(level);
+}
+
+// The level to use with a node that agreed on the given level while our dictionary had the ID dictid.
+// If the dictionary was changed since, the node still has the old one until the next key exchange.
+// Using the codec without it is not safe either, since zstd decodes a frame differently with a dictionary loaded,
+// so packets are not compressed at all until then.
+int compression_usable_level(const compression_t *c, int level, int dictid) {
+	if(level != compression_without_dictionary(level) && dictid != compression_dictionary_id(c))
+		return COMPRESS_NONE;
+
+	return level;
+}
+
+// Check whether we can compress and uncompress packets with the given level.
+bool compression_supported(const compression_t *c, int level) {
+	switch(level) {
+	case COMPRESS_NONE:
+		return true;
+#ifdef HAVE_ZLIB
+	case COMPRESS_ZLIB_MIN ... COMPRESS_ZLIB_MAX:
+		return true;
+#endif
+#ifdef HAVE_LZ4
+	case COMPRESS_LZ4:
+		return c && c->lz4;
+	case COMPRESS_LZ4_DICT:
+		return c && c->lz4 && c->lz4dict;
+#endif
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+		return c && c->zstd_cctx && c->zstd_dctx;
+	case COMPRESS_ZSTD_DICT:
+		return c && c->zstd_cctx && c->zstd_dctx && c->zstd_cdict;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *compression_name(int level) {
+	switch(level) {
+	case COMPRESS_NONE:
+		return "none";
+	case COMPRESS_ZLIB_MIN ... COMPRESS_ZLIB_MAX:
+		return "zlib";
+	case COMPRESS_LZO_LO:
+	case COMPRESS_LZO_HI:
+		return "lzo";
+	case COMPRESS_LZ4:
+		return "lz4";
+	case COMPRESS_LZ4_DICT:
+		return "lz4+dict";
+	case COMPRESS_ZSTD:
+		return "zstd";
+	case COMPRESS_ZSTD_DICT:
+		return "zstd+dict";
+	default:
+		return "unknown";
+	}
+}
+
+int compress_packet(compression_t *c, uint8_t *dest, size_t destlen, const uint8_t *source, size_t len, int level) {
+	if(!compression_supported(c, level))
+		return -1;
+
+	switch(level) {
+	case COMPRESS_NONE:
+		if(len > destlen)
+			return -1;
+		memcpy(dest, source, len);
+		return len;
+
+#ifdef HAVE_ZLIB
+	case COMPRESS_ZLIB_MIN ... COMPRESS_ZLIB_MAX: {
+		unsigned long zlen = destlen;
+		if(compress2(dest, &zlen, source, len, level) == Z_OK)
+			return zlen;
+		return -1;
+	}
+#endif
+
+#ifdef HAVE_LZ4
+	case COMPRESS_LZ4: {
+		int result = LZ4_compress_fast_extState(c->lz4, (const char *)source, (char *)dest, len, destlen, 1);
+		return result > 0 ? result : -1;
+	}
+
+	case COMPRESS_LZ4_DICT: {
+		memcpy(c->lz4, c->lz4dict, sizeof *c->lz4);
+		int result = LZ4_compress_fast_continue(c->lz4, (const char *)source, (char *)dest, len, destlen, 1);
+		return result > 0 ? result : -1;
+	}
+#endif
+
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+	case COMPRESS_ZSTD_DICT: {
+		size_t result;
+
+		if(level == COMPRESS_ZSTD_DICT)
+			result = ZSTD_compress_usingCDict(c->zstd_cctx, dest, destlen, source, len, c->zstd_cdict);
+		else
+			result = ZSTD_compressCCtx(c->zstd_cctx, dest, destlen, source, len, ZSTD_LEVEL);
+
+		return ZSTD_isError(result) ? -1 : (int)result;
+	}
+#endif
+
+	default:
+		return -1;
+	}
+}
+
+int uncompress_packet(compression_t *c, uint8_t *dest, size_t destlen, const uint8_t *source, size_t len, int level) {
+	if(!compression_supported(c, level))
+		return -1;
+
+	switch(level) {
+	case COMPRESS_NONE:
+		if(len > destlen)
+			return -1;
+		memcpy(dest, source, len);
+		return len;
+
+#ifdef HAVE_ZLIB
+	case COMPRESS_ZLIB_MIN ... COMPRESS_ZLIB_MAX: {
+		unsigned long zlen = destlen;
+		if(uncompress(dest, &zlen, source, len) == Z_OK)
+			return zlen;
+		return -1;
+	}
+#endif
+
+#ifdef HAVE_LZ4
+	case COMPRESS_LZ4:
+	case COMPRESS_LZ4_DICT: {
+		int result;
+
+		if(level == COMPRESS_LZ4_DICT)
+			result = LZ4_decompress_safe_usingDict((const char *)source, (char *)dest, len, destlen, (const char *)c->dict, c->dictlen);
+		else
+			result = LZ4_decompress_safe((const char *)source, (char *)dest, len, destlen);
+
+		return result >= 0 ? result : -1;
+	}
+#endif
+
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+	case COMPRESS_ZSTD_DICT: {
+		size_t result;
+
+		if(level == COMPRESS_ZSTD_DICT)
+			result = ZSTD_decompress_usingDDict(c->zstd_dctx, dest, destlen, source, len, c->zstd_ddict);
+		else
+			result = ZSTD_decompressDCtx(c->zstd_dctx, dest, destlen, source, len);
+
+		return ZSTD_isError(result) ? -1 : (int)result;
+	}
+#endif
+
+	default:
+		return -1;
+	}
+}
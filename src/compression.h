@@ -0,0 +1,53 @@
+/*
+    compression.h -- header file for compression.c
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef __MESHLINK_COMPRESSION_H__
+#define __MESHLINK_COMPRESSION_H__
+
+/* Compression levels, as exchanged in ANS_KEY requests.
+   The numbering follows tinc, 10 and 11 are its LZO levels which we do not support. */
+
+#define COMPRESS_NONE 0
+#define COMPRESS_ZLIB_MIN 1
+#define COMPRESS_ZLIB_MAX 9
+#define COMPRESS_LZO_LO 10
+#define COMPRESS_LZO_HI 11
+#define COMPRESS_LZ4 12
+#define COMPRESS_LZ4_DICT 13            /* LZ4 with the pre-shared dictionary */
+#define COMPRESS_ZSTD 14
+#define COMPRESS_ZSTD_DICT 15           /* zstd with the pre-shared dictionary */
+#define COMPRESS_MAX 15
+
+typedef struct compression_t compression_t;
+
+extern compression_t *compression_init(void);
+extern void compression_exit(compression_t *c);
+extern bool compression_set_dictionary(compression_t *c, const void *dict, size_t len);
+extern int compression_dictionary_id(const compression_t *c);
+extern int compression_without_dictionary(int level);
+extern int compression_negotiate(const compression_t *c, int level, int dictid);
+extern int compression_usable_level(const compression_t *c, int level, int dictid);
+extern bool compression_supported(const compression_t *c, int level);
+extern const char *compression_name(int level);
+// @return the compressed length, or -1 if the data could not be compressed
+extern int compress_packet(compression_t *c, uint8_t *dest, size_t destlen, const uint8_t *source, size_t len, int level);
+// @return the uncompressed length, or -1 if the data could not be uncompressed
+extern int uncompress_packet(compression_t *c, uint8_t *dest, size_t destlen, const uint8_t *source, size_t len, int level);
+
+#endif /* __MESHLINK_COMPRESSION_H__ */
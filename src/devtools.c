@@ -158,3 +158,116 @@ done:
 
 	return result;
 }
+
+unsigned int devtool_get_send_stalls(meshlink_handle_t *mesh)
+{
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return 0;
+	}
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	unsigned int stalls = mesh->loop.signal_stalls;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+	return stalls;
+}
+
+void devtool_get_receive_copy_stats(meshlink_handle_t *mesh, uint64_t *copied, uint64_t *delivered)
+{
+	if(!mesh || !copied || !delivered) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	*copied = mesh->receive_bytes_copied;
+	*delivered = mesh->receive_bytes_delivered;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+}
+
+bool devtool_get_compression_stats(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_compression_stats_t *stats)
+{
+	if(!mesh || !node || !stats) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	node_t *n = (node_t *)node;
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	stats->tried = n->compress_tried;
+	stats->skipped = n->compress_skipped;
+	stats->bytes_in = n->compress_bytes_in;
+	stats->bytes_saved = n->compress_bytes_in - n->compress_bytes_out;
+	stats->nsec = n->compress_nsec;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+	return true;
+}
+
+bool devtool_get_pmtu_state(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_pmtu_state_t *state)
+{
+	if(!mesh || !node || !state) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	node_t *n = (node_t *)node;
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	state->complete = n->status.validkey && n->pmtu_state == PMTU_COMPLETE;
+	state->mtu = n->mtu;
+	state->search_start = n->mtu_search_start;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+	return true;
+}
+
+bool devtool_force_key_exchange(meshlink_handle_t *mesh, meshlink_node_t *node)
+{
+	if(!mesh || !node) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	node_t *n = (node_t *)node;
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	bool result = n->status.validkey && sptps_force_kex(&n->sptps);
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+	// the handshake might have been queued on a meta connection, make sure the event loop notices
+	if(result)
+		signalio_trigger(&mesh->loop);
+
+	return result;
+}
+
+uint32_t devtool_get_receive_key_generation(meshlink_handle_t *mesh, meshlink_node_t *node)
+{
+	if(!mesh || !node) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return 0;
+	}
+
+	node_t *n = (node_t *)node;
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	uint32_t keygen = n->sptps.instate ? n->sptps.inkeygen : 0;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+	return keygen;
+}
+
+void devtool_set_udp_drop_size(meshlink_handle_t *mesh, uint16_t size)
+{
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+	mesh->udp_drop_size = size;
+	MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+}
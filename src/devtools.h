@@ -3,4 +3,54 @@
 
 extern bool devtool_export_json_all_edges_state(meshlink_handle_t *mesh, FILE* stream);
 
+/// Get the number of times sending a packet queued by meshlink_send() had to wait for a writable socket.
+extern unsigned int devtool_get_send_stalls(meshlink_handle_t *mesh);
+
+/// Get the number of bytes of received packets that were copied, and the number of payload bytes delivered to the application.
+/** Dividing the two gives the average number of times a payload byte was copied on the way from the socket to the receive callback.
+ *  Decryption and decompression are not counted as copies.
+ */
+extern void devtool_get_receive_copy_stats(meshlink_handle_t *mesh, uint64_t *copied, uint64_t *delivered);
+
+/// Statistics about compressing the packets sent to a node.
+typedef struct devtool_compression_stats {
+	uint64_t tried;         ///< Number of packets we tried to compress.
+	uint64_t skipped;       ///< Number of packets sent without trying, because recent ones did not compress.
+	uint64_t bytes_in;      ///< Size of the packets we tried to compress.
+	uint64_t bytes_saved;   ///< Number of bytes those packets were made smaller by.
+	uint64_t nsec;          ///< Time spent compressing, in nanoseconds.
+} devtool_compression_stats_t;
+
+/// Get the statistics about compressing the packets sent to a node.
+/** @return true if the statistics were stored in @a stats, false otherwise.
+ */
+extern bool devtool_get_compression_stats(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_compression_stats_t *stats);
+
+/// The state of path MTU discovery towards a node.
+typedef struct devtool_pmtu_state {
+	bool complete;                  ///< Whether keys have been exchanged and the search for the path MTU has finished.
+	uint16_t mtu;                   ///< The largest SPTPS payload known to fit in a UDP packet to the node.
+	struct timeval search_start;    ///< When the current search started, according to gettimeofday().
+} devtool_pmtu_state_t;
+
+/// Get the state of path MTU discovery towards a node.
+/** @return true if the state was stored in @a state, false otherwise.
+ */
+extern bool devtool_get_pmtu_state(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_pmtu_state_t *state);
+
+/// Start a new key exchange with a node, while the current session stays in use until it has finished.
+/** @return true if the key exchange was started, false if there is no session with the node or a key exchange is already going on.
+ */
+extern bool devtool_force_key_exchange(meshlink_handle_t *mesh, meshlink_node_t *node);
+
+/// Get a number that changes every time a new key is used to decrypt the packets from a node.
+/** @return the key generation, or 0 if there is no key yet.
+ */
+extern uint32_t devtool_get_receive_key_generation(meshlink_handle_t *mesh, meshlink_node_t *node);
+
+/// Simulate a smaller path MTU by silently dropping outgoing UDP packets that are larger than a given size.
+/** @param size     The maximum size of the UDP payload of packets that are still sent, or 0 to send all packets again.
+ */
+extern void devtool_set_udp_drop_size(meshlink_handle_t *mesh, uint16_t size);
+
 #endif
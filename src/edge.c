@@ -82,6 +82,10 @@ void edge_add(meshlink_handle_t *mesh, edge_t *e) {
 	splay_insert(mesh->edges, e);
 	splay_insert(e->from->edge_tree, e);
 
+	// the address in this edge is a UDP candidate address of e->to
+	e->from->status.udp_candidates = false;
+	e->to->status.udp_candidates = false;
+
 	e->reverse = lookup_edge(e->to, e->from);
 
 	if(e->reverse)
@@ -92,6 +96,9 @@ void edge_del(meshlink_handle_t *mesh, edge_t *e) {
 	if(e->reverse)
 		e->reverse->reverse = NULL;
 
+	e->from->status.udp_candidates = false;
+	e->to->status.udp_candidates = false;
+
 	splay_delete(mesh->edges, e);
 	splay_delete(e->from->edge_tree, e);
 }
@@ -32,32 +32,10 @@
 
 #include <pthread.h>
 
-static meshlink_queue_t outpacketqueue;
-static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-static event_t *pending_event = NULL;
-
 static int io_compare(const io_t *a, const io_t *b) {
 	return a->fd - b->fd;
 }
 
-static int timeout_compare(const timeout_t *a, const timeout_t *b) {
-	struct timeval diff;
-	timersub(&a->tv, &b->tv, &diff);
-	if(diff.tv_sec < 0)
-		return -1;
-	if(diff.tv_sec > 0)
-		return 1;
-	if(diff.tv_usec < 0)
-		return -1;
-	if(diff.tv_usec > 0)
-		return 1;
-	if(a < b)
-		return -1;
-	if(a > b)
-		return 1;
-	return 0;
-}
-
 void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int flags) {
 	if(io->cb)
 		return;
@@ -65,6 +43,7 @@ void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int fl
 	io->fd = fd;
 	io->cb = cb;
 	io->data = data;
+	io->flags = 0;
 	io->node.data = io;
 
 	io_set(loop, io, flags);
@@ -75,9 +54,47 @@ void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int fl
 	}
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+// register, modify or remove the io in the epoll set based on the change of its flags
+static void io_set_epoll(event_loop_t *loop, io_t *io, int oldflags) {
+	if(io->flags == oldflags)
+		return;
+
+	if(!io->flags) {
+		// the fd might already have been closed, which removed it from the set
+		epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, io->fd, NULL);
+		return;
+	}
+
+	struct epoll_event ev = {
+		.events = ((io->flags & IO_READ) ? EPOLLIN : 0) | ((io->flags & IO_WRITE) ? EPOLLOUT : 0),
+		.data.ptr = io,
+	};
+
+	int op = oldflags ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if(epoll_ctl(loop->epollfd, op, io->fd, &ev)) {
+		// retry with the opposite operation in case our idea of the registration was stale
+		op = (op == EPOLL_CTL_MOD) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+		if(epoll_ctl(loop->epollfd, op, io->fd, &ev)) {
+			logger(NULL, MESHLINK_ERROR, "Error: io_set epoll_ctl failed for fd %d: %s", io->fd, strerror(errno));
+			abort();
+		}
+	}
+}
+#endif
+
 void io_set(event_loop_t *loop, io_t *io, int flags) {
+	int oldflags = io->flags;
 	io->flags = flags;
 
+#ifdef HAVE_SYS_EPOLL_H
+	// with epoll the fd sets are not used, so fds beyond FD_SETSIZE are fine
+	if(loop->epollfd != -1) {
+		io_set_epoll(loop, io, oldflags);
+		return;
+	}
+#endif
+
 	if(flags & IO_READ)
 		FD_SET(io->fd, &loop->readfds);
 	else
@@ -119,30 +136,201 @@ void io_del(event_loop_t *loop, io_t *io) {
 	io->cb = NULL;
 }
 
-void timeout_add(event_loop_t *loop, timeout_t *timeout, timeout_cb_t cb, void *data, struct timeval *tv) {
-	if(!timeout->cb)
-		timeout->tv = (struct timeval){0, 0};
+/* Timing wheel helpers */
+
+#define TIMEOUT_WHEEL_MASK (TIMEOUT_WHEEL_SLOTS - 1)
+#define TIMEOUT_MAX ((UINT64_C(1) << (TIMEOUT_WHEEL_BITS * TIMEOUT_WHEELS)) - 1)
+
+static inline uint64_t rotl(uint64_t v, int n) {
+	return (v << n) | (v >> (-n & 63));
+}
+
+static inline uint64_t rotr(uint64_t v, int n) {
+	return (v >> n) | (v << (-n & 63));
+}
+
+static inline int fls64(uint64_t v) {
+	return 64 - __builtin_clzll(v);
+}
+
+static uint64_t tv_to_tick(const struct timeval *tv) {
+	return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static void timeout_link(timeout_t **head, timeout_t *timeout) {
+	timeout->next = *head;
+	if(timeout->next)
+		timeout->next->pprev = &timeout->next;
+	*head = timeout;
+	timeout->pprev = head;
+}
+
+static void timeout_unlink(event_loop_t *loop, timeout_t *timeout) {
+	if(!timeout->pprev)
+		return;
+
+	*timeout->pprev = timeout->next;
+	if(timeout->next)
+		timeout->next->pprev = timeout->pprev;
+
+	if(timeout->wheel < TIMEOUT_WHEELS && !loop->timeout_wheel[timeout->wheel][timeout->slot])
+		loop->timeout_pending[timeout->wheel] &= ~(UINT64_C(1) << timeout->slot);
+
+	timeout->next = NULL;
+	timeout->pprev = NULL;
+}
+
+// Put a timeout in the wheel matching the number of ticks remaining,
+// or on the expired list if it is due already.
+static void timeout_schedule(event_loop_t *loop, timeout_t *timeout) {
+	if(timeout->expires <= loop->timeout_tick) {
+		timeout->wheel = TIMEOUT_WHEELS;
+		timeout_link(&loop->timeout_expired, timeout);
+		return;
+	}
+
+	uint64_t remaining = timeout->expires - loop->timeout_tick;
+	if(remaining > TIMEOUT_MAX)
+		remaining = TIMEOUT_MAX;
+
+	// higher wheels use the slot before the one of the expiry time,
+	// so the timeout cascades into a lower wheel before it is due
+	int wheel = (fls64(remaining) - 1) / TIMEOUT_WHEEL_BITS;
+	int slot = TIMEOUT_WHEEL_MASK & ((timeout->expires >> (wheel * TIMEOUT_WHEEL_BITS)) - !!wheel);
+
+	timeout->wheel = wheel;
+	timeout->slot = slot;
+	timeout_link(&loop->timeout_wheel[wheel][slot], timeout);
+	loop->timeout_pending[wheel] |= UINT64_C(1) << slot;
+}
+
+// Advance the wheels to the current time. Every slot that has been passed is emptied
+// and its timeouts are rescheduled, which either cascades them to a lower wheel
+// or moves them to the expired list.
+static void timeout_update(event_loop_t *loop) {
+	uint64_t tick = tv_to_tick(&loop->now);
+	timeout_t *todo = NULL;
+
+	if(tick < loop->timeout_tick) {
+		// the clock went backwards, rehash everything
+		for(int wheel = 0; wheel < TIMEOUT_WHEELS; wheel++) {
+			while(loop->timeout_pending[wheel]) {
+				int slot = __builtin_ctzll(loop->timeout_pending[wheel]);
+				while(loop->timeout_wheel[wheel][slot]) {
+					timeout_t *timeout = loop->timeout_wheel[wheel][slot];
+					timeout_unlink(loop, timeout);
+					timeout_link(&todo, timeout);
+				}
+			}
+		}
+	} else {
+		uint64_t elapsed = tick - loop->timeout_tick;
+
+		for(int wheel = 0; wheel < TIMEOUT_WHEELS; wheel++) {
+			uint64_t pending;
+
+			if((elapsed >> (wheel * TIMEOUT_WHEEL_BITS)) > TIMEOUT_WHEEL_MASK) {
+				pending = ~UINT64_C(0);
+			} else {
+				int passed = TIMEOUT_WHEEL_MASK & (elapsed >> (wheel * TIMEOUT_WHEEL_BITS));
+				int oldslot = TIMEOUT_WHEEL_MASK & (loop->timeout_tick >> (wheel * TIMEOUT_WHEEL_BITS));
+				int newslot = TIMEOUT_WHEEL_MASK & (tick >> (wheel * TIMEOUT_WHEEL_BITS));
+				pending = rotl((UINT64_C(1) << passed) - 1, oldslot);
+				pending |= rotr(rotl((UINT64_C(1) << passed) - 1, newslot), passed);
+				pending |= UINT64_C(1) << newslot;
+			}
+
+			while(pending & loop->timeout_pending[wheel]) {
+				int slot = __builtin_ctzll(pending & loop->timeout_pending[wheel]);
+				while(loop->timeout_wheel[wheel][slot]) {
+					timeout_t *timeout = loop->timeout_wheel[wheel][slot];
+					timeout_unlink(loop, timeout);
+					timeout_link(&todo, timeout);
+				}
+			}
+
+			// stop unless this wheel wrapped around, in which case the next one ticks at least once
+			if(!(pending & 1))
+				break;
+
+			if(elapsed < (uint64_t)TIMEOUT_WHEEL_SLOTS << (wheel * TIMEOUT_WHEEL_BITS))
+				elapsed = (uint64_t)TIMEOUT_WHEEL_SLOTS << (wheel * TIMEOUT_WHEEL_BITS);
+		}
+	}
+
+	loop->timeout_tick = tick;
+
+	while(todo) {
+		timeout_t *timeout = todo;
+		todo = timeout->next;
+		timeout->next = NULL;
+		timeout->pprev = NULL;
+		timeout_schedule(loop, timeout);
+	}
+}
+
+// Calculate how long to wait until the next timeout might be due.
+// @return false if there are no timeouts
+static bool timeout_next(event_loop_t *loop, struct timeval *diff) {
+	if(loop->timeout_expired) {
+		*diff = (struct timeval){0, 0};
+		return true;
+	}
+
+	uint64_t ticks = UINT64_MAX;
+	uint64_t relmask = 0;
+
+	for(int wheel = 0; wheel < TIMEOUT_WHEELS; wheel++) {
+		if(loop->timeout_pending[wheel]) {
+			int slot = TIMEOUT_WHEEL_MASK & (loop->timeout_tick >> (wheel * TIMEOUT_WHEEL_BITS));
+
+			// higher wheels are one rotation ahead, otherwise the timeout would be in a lower wheel
+			uint64_t t = (uint64_t)(__builtin_ctzll(rotr(loop->timeout_pending[wheel], slot)) + !!wheel) << (wheel * TIMEOUT_WHEEL_BITS);
+
+			// subtract what the lower wheels already progressed
+			t -= relmask & loop->timeout_tick;
+
+			if(t < ticks)
+				ticks = t;
+		}
 
+		relmask = (relmask << TIMEOUT_WHEEL_BITS) | TIMEOUT_WHEEL_MASK;
+	}
+
+	if(ticks == UINT64_MAX)
+		return false;
+
+	struct timeval due = {
+		.tv_sec = (loop->timeout_tick + ticks) / 1000,
+		.tv_usec = ((loop->timeout_tick + ticks) % 1000) * 1000,
+	};
+
+	if(timercmp(&due, &loop->now, <))
+		*diff = (struct timeval){0, 0};
+	else
+		timersub(&due, &loop->now, diff);
+
+	return true;
+}
+
+void timeout_add(event_loop_t *loop, timeout_t *timeout, timeout_cb_t cb, void *data, struct timeval *tv) {
 	timeout->cb = cb;
 	timeout->data = data;
-	timeout->node.data = timeout;
 
 	timeout_set(loop, timeout, tv);
 }
 
 void timeout_set(event_loop_t *loop, timeout_t *timeout, struct timeval *tv) {
-	if(timerisset(&timeout->tv))
-		splay_unlink_node(&loop->timeouts, &timeout->node);
+	timeout_unlink(loop, timeout);
 
 	if(!loop->now.tv_sec)
 		gettimeofday(&loop->now, NULL);
 
 	timeradd(&loop->now, tv, &timeout->tv);
 
-	if(!splay_insert_node(&loop->timeouts, &timeout->node)) {
-		logger(NULL, MESHLINK_ERROR, "Error: timeout_set splay_insert_node failed");
-		abort();
-	}
+	// round up to the next tick, so a timeout never fires early
+	timeout->expires = tv_to_tick(&timeout->tv) + !!(timeout->tv.tv_usec % 1000);
+	timeout_schedule(loop, timeout);
 }
 
 void timeout_del(event_loop_t *loop, timeout_t *timeout) {
@@ -151,7 +339,7 @@ void timeout_del(event_loop_t *loop, timeout_t *timeout) {
 
 	loop->deletion = true;
 
-	splay_unlink_node(&loop->timeouts, &timeout->node);
+	timeout_unlink(loop, timeout);
 	timeout->cb = 0;
 	timeout->tv = (struct timeval){0, 0};
 }
@@ -160,15 +348,38 @@ static int signal_compare(const signal_t *a, const signal_t *b) {
 	return (int)a->signum - (int)b->signum;
 }
 
-static void free_event(struct event_t *event) {
-	if(event) {
-		if(event->data)
-			free(event->data);
-		free(event);
-	}
+/* Signal queue
+
+   The queue is a bounded multi-producer, single-consumer ring of preallocated packet slots.
+   Each slot carries a sequence number: a producer may claim the slot at position pos when its
+   sequence number equals pos, and publishes it by setting it to pos + 1. The event loop consumes
+   the slot when it equals pos + 1 and hands it back to the producers by setting it to pos + SIGNALIO_QUEUE_SIZE.
+*/
+
+static signalio_slot_t *signalio_slot(signalio_queue_t *queue, unsigned int pos) {
+    return (signalio_slot_t *)(queue->slots + (pos % SIGNALIO_QUEUE_SIZE) * queue->stride);
+}
+
+// find a packet that is ready to be consumed, in the current queue or one it replaced
+static signalio_slot_t *signalio_peek(event_loop_t *loop, signalio_queue_t **found) {
+    for(signalio_queue_t *queue = __atomic_load_n(&loop->queue, __ATOMIC_ACQUIRE); queue; queue = queue->prev) {
+        signalio_slot_t *slot = signalio_slot(queue, queue->head);
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == queue->head + 1) {
+            if(found)
+                *found = queue;
+            return slot;
+        }
+    }
+
+    return NULL;
 }
 
-// called from event_loop_run to process queued data from the outpacketqueue
+static void signalio_release(signalio_queue_t *queue, signalio_slot_t *slot) {
+    __atomic_store_n(&slot->seq, queue->head + SIGNALIO_QUEUE_SIZE, __ATOMIC_RELEASE);
+    queue->head++;
+}
+
+// called from event_loop_run to process queued data from the signal queue
 static bool signalio_handler(event_loop_t *loop, void *data, int flags) {
     // check whether we got triggered by the event pipe
     if(flags & IO_READ) {
@@ -176,48 +387,44 @@ static bool signalio_handler(event_loop_t *loop, void *data, int flags) {
         unsigned char signum;
         while(sizeof signum == meshlink_readpipe(loop->pipefd[0], &signum, sizeof signum));
 
-        // retrieve the next event if none pending
-        if(!pending_event) {
-            MESHLINK_MUTEX_LOCK(&queue_mutex);
-            pending_event = meshlink_queue_pop(&outpacketqueue);
-            MESHLINK_MUTEX_UNLOCK(&queue_mutex);
-        }
+        // allow producers to trigger us again, then look at the queue
+        __atomic_store_n(&loop->signalled, false, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
     }
 
-    // when there's nothing to process return
-    if(!pending_event) {
+    // while a send is stalled on a full socket wait for it to become writable before retrying
+    if(loop->signal_blocked) {
         return false;
     }
 
-    // find signal event handler and call it
-    bool cbres = false;
-    signal_t *sig = splay_search(&loop->signals, &((signal_t){.signum = pending_event->signum}));
-    if(sig && sig->cb) {
-        // call the signal callback to process the event data
-        cbres = sig->cb(loop, sig->data, pending_event->data);
-
-        // on success clean the processed data, else keep it to retry later
-        if(cbres) {
-            free_event(pending_event);
-            pending_event = NULL;
+    // process queued events until the queue is empty, a callback asks to retry later or the budget is used up
+    // whatever is left over is handled after the sockets got serviced on the next iteration
+    bool progress = false;
+    signalio_queue_t *queue;
+    signalio_slot_t *slot;
+
+    for(unsigned int budget = loop->signal_budget; budget && (slot = signalio_peek(loop, &queue)); budget--) {
+        // find signal event handler and call it
+        signal_t *sig = splay_search(&loop->signals, &((signal_t){.signum = slot->signum}));
+        if(sig && sig->cb) {
+            // call the signal callback to process the packet
+            // on failure keep the slot to retry once the callback registered a socket turns writable
+            if(!sig->cb(loop, sig->data, &slot->packet)) {
+                loop->signal_blocked = true;
+                loop->signal_stalls++;
+                break;
+            }
+        }
+        else {
+            logger(NULL, MESHLINK_ERROR, "No matching signal handler found for signum=%u, dropping the event.", slot->signum);
         }
-    }
-    else {
-        logger(NULL, MESHLINK_ERROR, "No matching signal handler found for signum=%u, dropping the event.", pending_event->signum);
-        // drop the event and report progress
-        free_event(pending_event);
-        pending_event = NULL;
-        cbres = true;
-    }
 
-    // if processed or dropped, retrieve the next pending event so the event loop doesn't block
-    if(!pending_event) {
-        MESHLINK_MUTEX_LOCK(&queue_mutex);
-        pending_event = meshlink_queue_pop(&outpacketqueue);
-        MESHLINK_MUTEX_UNLOCK(&queue_mutex);
+        // hand the slot back to the producers and report progress
+        signalio_release(queue, slot);
+        progress = true;
     }
 
-    return cbres;
+    return progress;
 }
 
 static void pipe_init(event_loop_t *loop) {
@@ -235,11 +442,19 @@ static void pipe_init(event_loop_t *loop) {
 		loop->signalio.node.data = &loop->signalio;
 
 		io_set(loop, &loop->signalio, IO_READ);
+
+		// producers that queued before the pipe existed could not trigger us, the queue is checked anyway
+		__atomic_store_n(&loop->signalled, false, __ATOMIC_SEQ_CST);
 	}
 	else
 		logger(NULL, MESHLINK_ERROR, "Pipe init failed: %s", sockstrerror(sockerrno));
 }
 
+// set how many queued events are handled at most before the sockets get serviced again
+void signalio_set_budget(event_loop_t *loop, unsigned int budget) {
+    loop->signal_budget = budget ? budget : SIGNALIO_BUDGET;
+}
+
 // called from external to wake the event_loop_run loop
 bool signalio_trigger(event_loop_t *loop) {
     // Notify event loop
@@ -253,35 +468,69 @@ bool signalio_trigger(event_loop_t *loop) {
     return true;
 }
 
-// called from external to push data to the outpacketqueue
-bool signalio_queue(event_loop_t *loop, signal_t *sig, void *data) {
-    event_t *entry = malloc(sizeof(struct event_t));
-    if(!entry) {
-        logger(NULL, MESHLINK_ERROR, "Error: out of memory");
-        return false;
-    }
+// make sure the queued packets have room for maxsize bytes of data
+// a larger queue replaces the current one, which is kept since other threads may still be using it
+void signalio_set_packet_size(event_loop_t *loop, size_t maxsize) {
+    signalio_queue_t *old = loop->queue;
+    if(old && old->maxsize >= maxsize)
+        return;
+
+    size_t stride = offsetof(signalio_slot_t, packet) + VPN_PACKET_SIZE(maxsize);
+    signalio_queue_t *queue = xzalloc(sizeof *queue + SIGNALIO_QUEUE_SIZE * stride);
+    queue->prev = old;
+    queue->maxsize = maxsize;
+    queue->stride = stride;
+    for(unsigned int i = 0; i < SIGNALIO_QUEUE_SIZE; i++)
+        signalio_slot(queue, i)->seq = i;
+
+    __atomic_store_n(&loop->queue, queue, __ATOMIC_RELEASE);
+}
 
-    entry->signum = sig->signum;
-    entry->data = data;
+// called from external to claim a free packet slot in the signal queue, with room for len bytes of data
+// @return the packet to fill in, or NULL if the queue is full or the packet does not fit
+vpn_packet_t *signalio_reserve(event_loop_t *loop, signal_t *sig, size_t len) {
+    signalio_queue_t *queue = __atomic_load_n(&loop->queue, __ATOMIC_ACQUIRE);
+    if(!queue || len > queue->maxsize)
+        return NULL;
+
+    unsigned int pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    signalio_slot_t *slot;
+
+    while(true) {
+        slot = signalio_slot(queue, pos);
+        int diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if(diff == 0) {
+            // the slot is free, try to claim it, on failure pos is updated to the current tail
+            if(__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(diff < 0) {
+            // the event loop did not consume this slot yet, so the queue is full
+            return NULL;
+        } else {
+            // another producer claimed it first
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
 
-    MESHLINK_MUTEX_LOCK(&queue_mutex);
+    slot->signum = sig->signum;
+    return &slot->packet;
+}
 
-    // Queue it
-    if(!meshlink_queue_push(&outpacketqueue, entry)) {
-        free(entry);
-        meshlink_errno = MESHLINK_ENOMEM;
-        MESHLINK_MUTEX_UNLOCK(&queue_mutex);
-        logger(NULL, MESHLINK_ERROR, "Error: signalio_queue failed to queue packet");
-        return false;
-    }
+// called from external to publish a packet filled in after signalio_reserve
+// the event loop is only woken up if no wakeup is pending yet
+void signalio_commit(event_loop_t *loop, vpn_packet_t *packet) {
+    signalio_slot_t *slot = (signalio_slot_t *)((char *)packet - offsetof(signalio_slot_t, packet));
 
-    MESHLINK_MUTEX_UNLOCK(&queue_mutex);
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
     // discard whether the event triggering worked, the data should be processed anyhow
     // the event queue is just for notification to wake from the select
-    signalio_trigger(loop);
-
-    return true;
+    if(!__atomic_exchange_n(&loop->signalled, true, __ATOMIC_RELAXED)) {
+        if(!signalio_trigger(loop))
+            __atomic_store_n(&loop->signalled, false, __ATOMIC_RELAXED);
+    }
 }
 
 void signal_add(event_loop_t *loop, signal_t *sig, signal_cb_t cb, void *data, uint8_t signum) {
@@ -317,87 +566,142 @@ void idle_set(event_loop_t *loop, idle_cb_t cb, void *data) {
 	loop->idle_data = data;
 }
 
-static bool progress = true; // set to true to skip initial usleep
+#ifdef HAVE_SYS_EPOLL_H
+#define EPOLL_MAX_EVENTS 64
+
+// dispatch the ready fds reported by epoll_wait
+// @return whether the signalio pipe was found readable
+static bool event_loop_dispatch_epoll(event_loop_t *loop, struct epoll_event *events, int n) {
+	bool signalio_readable = false;
+
+	for(int i = 0; i < n; i++) {
+		io_t *io = events[i].data.ptr;
+		uint32_t ev = events[i].events;
+
+		// errors and hangups are reported regardless of the requested events,
+		// map them to what the callback is interested in, just like select() does
+		if(ev & (EPOLLERR | EPOLLHUP))
+			ev |= EPOLLIN | EPOLLOUT;
+
+		if(io == &loop->signalio) {
+			signalio_readable = ev & EPOLLIN;
+			continue;
+		}
+
+		if(io->cb && (io->flags & IO_WRITE) && (ev & EPOLLOUT)) {
+			io->cb(loop, io->data, IO_WRITE);
+			// a socket got writable, retry sending queued packets
+			loop->signal_blocked = false;
+		}
+		// a callback might have deleted any io, including the ones still in the events array
+		if(loop->deletion)
+			break;
+		if(io->cb && (io->flags & IO_READ) && (ev & EPOLLIN)) {
+			io->cb(loop, io->data, IO_READ);
+		}
+		if(loop->deletion)
+			break;
+	}
+
+	return signalio_readable;
+}
+#endif
+
 bool event_loop_run(event_loop_t *loop, pthread_mutex_t *mutex) {
 	fd_set readable;
 	fd_set writable;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+#endif
 
 	while(loop->running) {
 		gettimeofday(&loop->now, NULL);
 		struct timeval diff, it, *tv = NULL;
 
-		while(loop->timeouts.head) {
-			timeout_t *timeout = loop->timeouts.head->data;
-			timersub(&timeout->tv, &loop->now, &diff);
+		timeout_update(loop);
 
-			if(diff.tv_sec < 0) {
-				timeout->cb(loop, timeout->data);
-				if(timercmp(&timeout->tv, &loop->now, <))
-					timeout_del(loop, timeout);
-			} else {
-				tv = &diff;
-				break;
-			}
+		// fire the expired timeouts, the ones rearmed to expire right away are handled on the next iteration
+		timeout_t *expired = loop->timeout_expired;
+		loop->timeout_expired = NULL;
+		if(expired)
+			expired->pprev = &expired;
+
+		while(expired) {
+			timeout_t *timeout = expired;
+			timeout_unlink(loop, timeout);
+			timeout->cb(loop, timeout->data);
+			if(!timeout->pprev)
+				timeout_del(loop, timeout);
 		}
 
+		if(timeout_next(loop, &diff))
+			tv = &diff;
+
 		if(loop->idle_cb) {
 			it = loop->idle_cb(loop, loop->idle_data);
 			if(it.tv_sec >= 0 && (!tv || timercmp(&it, tv, <)))
 				tv = &it;
 		}
 
-		memcpy(&readable, &loop->readfds, sizeof readable);
-		memcpy(&writable, &loop->writefds, sizeof writable);
-
 		// release mesh mutex while waiting to select
 		MESHLINK_MUTEX_UNLOCK(mutex);
 
-		// when no progress could be made and there's no immediate timeout, wait a moment
-		// this case can occure when the signalio_handler is triggered by meshlink_send
-		// to call meshlink_send_from_queue but then fails to send with sockwouldblock
-		// that case the event is left pending and select only peeks the status
-		if(!progress && (!tv || tv->tv_sec || tv->tv_usec)) {
-			usleep(1000LL);
-		}
-
 		// wait for a readable or writable socket to become available
-		// when there's data pending from the outpacketqueue just peek the current socket status
+		// when there are packets left in the signal queue just peek the current socket status
 		// note that the writable sockets should only be listened for when actually waiting to send
-		// for now it is only used by the meta connections buffering some data to be sent and unsetting the writable state once processed
-		// data queued to the outpacketqueue instead is signaled by the IO_READ pipefd[0] to try send it out
-		int n = select(loop->highestfd + 1, &readable, &writable, NULL, pending_event? &(struct timeval){0, 0}: tv);
+		// the meta connections do so while buffering data, and the UDP sockets while a queued packet is blocked
+		// in the latter case the queue is not peeked but left alone until the socket becomes writable
+		bool pending = !loop->signal_blocked && signalio_peek(loop, NULL);
+		int n;
+#ifdef HAVE_SYS_EPOLL_H
+		if(loop->epollfd != -1) {
+			int ms = pending ? 0 : tv ? tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000 : -1;
+			n = epoll_wait(loop->epollfd, events, EPOLL_MAX_EVENTS, ms);
+		} else
+#endif
+		{
+			memcpy(&readable, &loop->readfds, sizeof readable);
+			memcpy(&writable, &loop->writefds, sizeof writable);
+			n = select(loop->highestfd + 1, &readable, &writable, NULL, pending ? &(struct timeval){0, 0} : tv);
+		}
 
 		MESHLINK_MUTEX_LOCK(mutex);
 
 		// when an error occures and it's not an interrupt, exit
 		if(n < 0 && !sockintr(errno)) {
-			logger(NULL, MESHLINK_ERROR, "Error: event_loop_run select failed with: [%u] %s", errno, sockstrerror(errno));
+			logger(NULL, MESHLINK_ERROR, "Error: event_loop_run waiting for events failed with: [%u] %s", errno, sockstrerror(errno));
 			return false;
 		}
 
 		loop->deletion = false;
-		progress = false;
+		bool signalio_readable = false;
 
 		// process sockets if any
 		// when there are no sockets to process a timeout or interrupt must have occured
 		// e.g. we might have some events queued to process
+#ifdef HAVE_SYS_EPOLL_H
+		if(loop->epollfd != -1) {
+			if(n > 0)
+				signalio_readable = event_loop_dispatch_epoll(loop, events, n);
+		} else
+#endif
 		if(n > 0) {
+			signalio_readable = FD_ISSET(loop->signalio.fd, &readable);
+
 			// loop all io_add registered sockets
 			// Normally, splay_each allows the current node to be deleted. However,
 			// it can be that one io callback triggers the deletion of another io,
 			// so we have to detect this and break the loop.
 			for splay_each(io_t, io, &loop->ios) {
 				if(io->cb && FD_ISSET(io->fd, &writable)) {
-					// assume progress when the callback got handled to write new data
-					progress |= io->cb(loop, io->data, IO_WRITE);
+					io->cb(loop, io->data, IO_WRITE);
+					// a socket got writable, retry sending queued packets
+					loop->signal_blocked = false;
 				}
 				if(loop->deletion)
 					break;
 				if(io->cb && FD_ISSET(io->fd, &readable)) {
 					io->cb(loop, io->data, IO_READ);
-					// always assume progress when incoming packets are received
-					// as there might be more in the queue
-					progress = true;
 				}
 				if(loop->deletion)
 					break;
@@ -406,9 +710,9 @@ bool event_loop_run(event_loop_t *loop, pthread_mutex_t *mutex) {
 
 		// trigger the signalio_handler last so incoming packets are processed first
 		if(!loop->deletion && loop->signalio.cb) {
-			// since it handles our internal meshlink_pipe, assume progress only if handled
-			// an internal send might fail with sockwouldblock to retry later
-			progress |= loop->signalio.cb(loop, loop->signalio.data, FD_ISSET(loop->signalio.fd, &readable)? IO_READ: 0);
+			// an internal send might fail with sockwouldblock, then the packet stays queued
+			// until a socket registered for IO_WRITE becomes writable
+			loop->signalio.cb(loop, loop->signalio.data, signalio_readable? IO_READ: 0);
 		}
 	}
 
@@ -417,12 +721,16 @@ bool event_loop_run(event_loop_t *loop, pthread_mutex_t *mutex) {
 
 void event_flush_output(event_loop_t *loop) {
 	for splay_each(io_t, io, &loop->ios)
-		if(FD_ISSET(io->fd, &loop->writefds))
+		if(io->flags & IO_WRITE)
 			io->cb(loop, io->data, IO_WRITE);
 }
 
 void event_loop_start(event_loop_t *loop) {
 	loop->running = true;
+
+	// a socket we were waiting on to become writable might be gone since the last stop,
+	// retry the queued packets, if they block again the new socket is waited on instead
+	loop->signal_blocked = false;
 }
 
 void event_loop_stop(event_loop_t *loop) {
@@ -431,18 +739,32 @@ void event_loop_stop(event_loop_t *loop) {
 
 void event_loop_init(event_loop_t *loop) {
 	loop->ios.compare = (splay_compare_t)io_compare;
-	loop->timeouts.compare = (splay_compare_t)timeout_compare;
 	loop->signals.compare = (splay_compare_t)signal_compare;
 	loop->pipefd[0] = -1;
 	loop->pipefd[1] = -1;
+
+	signalio_set_packet_size(loop, MAXSIZE_FOR(DEFAULT_LINK_MTU));
+	loop->signal_blocked = false;
+	loop->signal_budget = SIGNALIO_BUDGET;
+#ifdef HAVE_SYS_EPOLL_H
+	loop->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(loop->epollfd == -1)
+		logger(NULL, MESHLINK_WARNING, "Could not create epoll instance, falling back to select(): %s", strerror(errno));
+#endif
 	gettimeofday(&loop->now, NULL);
+	loop->timeout_tick = tv_to_tick(&loop->now);
 }
 
 void event_loop_exit(event_loop_t *loop) {
 	for splay_each(io_t, io, &loop->ios)
 		splay_unlink_node(&loop->ios, node);
-	for splay_each(timeout_t, timeout, &loop->timeouts)
-		splay_unlink_node(&loop->timeouts, node);
+	for(int wheel = 0; wheel < TIMEOUT_WHEELS; wheel++) {
+		for(int slot = 0; slot < TIMEOUT_WHEEL_SLOTS; slot++)
+			while(loop->timeout_wheel[wheel][slot])
+				timeout_unlink(loop, loop->timeout_wheel[wheel][slot]);
+	}
+	while(loop->timeout_expired)
+		timeout_unlink(loop, loop->timeout_expired);
 	for splay_each(signal_t, signal, &loop->signals)
 		splay_unlink_node(&loop->signals, node);
 
@@ -453,10 +775,15 @@ void event_loop_exit(event_loop_t *loop) {
     if(loop->pipefd[1] != -1)
         meshlink_closepipe(loop->pipefd[1]);
     loop->highestfd = 0;
-
-    exit_meshlink_queue(&outpacketqueue, (meshlink_queue_action_t)free_event);
-    if(pending_event) {
-        free_event(pending_event);
-        pending_event = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+    if(loop->epollfd != -1)
+        close(loop->epollfd);
+    loop->epollfd = -1;
+#endif
+
+    while(loop->queue) {
+        signalio_queue_t *prev = loop->queue->prev;
+        free(loop->queue);
+        loop->queue = prev;
     }
 }
@@ -20,6 +20,7 @@
 #ifndef __MESHLINK_EVENT_H__
 #define __MESHLINK_EVENT_H__
 
+#include "net_defines.h"
 #include "splay_tree.h"
 #include "system.h"
 #include <pthread.h>
@@ -42,11 +43,22 @@ typedef struct io_t {
 	struct splay_node_t node;
 } io_t;
 
+/* Timeouts are kept in a hierarchical timing wheel with millisecond ticks.
+   Each wheel has 64 slots, so 4 wheels cover timeouts of up to 2^24 ms (4.6 hours),
+   longer ones are parked in the last wheel and rescheduled when it comes around. */
+#define TIMEOUT_WHEEL_BITS 6
+#define TIMEOUT_WHEEL_SLOTS (1 << TIMEOUT_WHEEL_BITS)
+#define TIMEOUT_WHEELS 4
+
 typedef struct timeout_t {
 	struct timeval tv;
 	timeout_cb_t cb;
 	void *data;
-	struct splay_node_t node;
+	uint64_t expires;               /* tick at which the timeout is due */
+	int wheel;                      /* wheel the timeout is linked in, TIMEOUT_WHEELS for the expired list */
+	int slot;
+	struct timeout_t *next;
+	struct timeout_t **pprev;       /* NULL if the timeout is not linked anywhere */
 } timeout_t;
 
 typedef struct signal_t {
@@ -56,10 +68,30 @@ typedef struct signal_t {
 	struct splay_node_t node;
 } signal_t;
 
-typedef struct event_t {
-    int signum;
-    void *data;
-} event_t;
+/* Number of packets that can be queued for the event loop by other threads, must be a power of two */
+#define SIGNALIO_QUEUE_SIZE 256
+
+/* Default number of queued packets handled per event loop iteration before sockets are serviced again */
+#define SIGNALIO_BUDGET 64
+
+/* The packets in a queue only have room for maxsize bytes of data,
+   so the slots are stride bytes apart instead of sizeof(signalio_slot_t). */
+typedef struct signalio_slot_t {
+	unsigned int seq;               /* sequence number, accessed atomically */
+	uint8_t signum;
+	vpn_packet_t packet;
+} signalio_slot_t;
+
+/* Other threads may be about to use a queue at any time, so it is never freed while the loop exists.
+   If a larger packet size is needed, a new queue replaces it, and the event loop keeps emptying the old one. */
+typedef struct signalio_queue_t {
+	struct signalio_queue_t *prev;  /* the queue this one replaced */
+	size_t maxsize;                 /* room for data in each packet */
+	size_t stride;
+	unsigned int head;              /* next slot to consume, only used by the event loop */
+	unsigned int tail;              /* next slot to claim by producers, accessed atomically */
+	uint8_t slots[];                /* SIGNALIO_QUEUE_SIZE slots of stride bytes */
+} signalio_queue_t;
 
 struct event_loop_t {
 	fd_set readfds;
@@ -70,9 +102,13 @@ struct event_loop_t {
 	bool deletion;
 	
 	splay_tree_t ios;
-	splay_tree_t timeouts;
 	splay_tree_t signals;
 
+	uint64_t timeout_tick;
+	uint64_t timeout_pending[TIMEOUT_WHEELS];       /* bitmap of non-empty slots per wheel */
+	timeout_t *timeout_wheel[TIMEOUT_WHEELS][TIMEOUT_WHEEL_SLOTS];
+	timeout_t *timeout_expired;
+
 	idle_cb_t idle_cb;
 	void *idle_data;
 
@@ -80,6 +116,16 @@ struct event_loop_t {
 	int pipefd[2];
     int highestfd;
 
+	signalio_queue_t *queue;        /* packets queued by other threads, accessed atomically */
+	bool signalled;                 /* a wakeup is pending in the pipe, accessed atomically */
+	unsigned int signal_budget;     /* maximum number of queued packets to handle per iteration */
+	bool signal_blocked;            /* a queued packet could not be sent, wait for a writable socket */
+	unsigned int signal_stalls;     /* number of times sending a queued packet would have blocked */
+
+#ifdef HAVE_SYS_EPOLL_H
+	int epollfd;            /* epoll instance, or -1 to fall back to select() */
+#endif
+
 	void *data;
 };
 
@@ -93,7 +139,10 @@ extern void timeout_set(event_loop_t *loop, timeout_t *timeout, struct timeval *
 
 extern void signal_add(event_loop_t *loop, signal_t *sig, signal_cb_t cb, void *data, uint8_t signum);
 extern bool signalio_trigger(event_loop_t *loop);
-extern bool signalio_queue(event_loop_t *loop, signal_t *sig, void *data);
+extern vpn_packet_t *signalio_reserve(event_loop_t *loop, signal_t *sig, size_t len);
+extern void signalio_set_budget(event_loop_t *loop, unsigned int budget);
+extern void signalio_set_packet_size(event_loop_t *loop, size_t maxsize);
+extern void signalio_commit(event_loop_t *loop, vpn_packet_t *packet);
 extern void signal_del(event_loop_t *loop, signal_t *sig);
 
 extern void idle_set(event_loop_t *loop, idle_cb_t cb, void *data);
@@ -222,9 +222,10 @@ static void check_reachability(meshlink_handle_t *mesh) {
 			n->last_req_key = 0;
 
 			n->status.udp_confirmed = false;
-			n->maxmtu = sptps_maxmtu(&n->sptps);
+			n->maxmtu = node_max_mtu(mesh, n);
 			n->minmtu = 0;
 			n->mtuprobes = 0;
+			n->pmtu_state = PMTU_IDLE;
 
 			timeout_del(&mesh->loop, &n->mtutimeout);
 
@@ -20,74 +20,207 @@
 #include "system.h"
 
 #include "hash.h"
+#include "sockaddr.h"
 #include "xalloc.h"
 
+/* This is an open addressing hash table using Robin Hood hashing: when inserting,
+   an element that is farther away from its preferred slot takes the place of one
+   that is closer to its own. This keeps probe sequences short even at high load,
+   lets searches stop early, and allows deletion by shifting elements back. */
+
+#define MIN_SLOTS 8
+
 /* Generic hash function */
 
-static uint32_t hash_function(const void *p, size_t len) {
+static uint32_t hash_bytes(const void *p, size_t len) {
 	const uint8_t *q = p;
-	uint32_t hash = 0;
-	while(true) {
-		for(int i = len > 4 ? 4 : len; --i;)
-			hash += q[len - i] << (8 * i);
-		hash *= 0x9e370001UL; // Golden ratio prime.
-		if(len <= 4)
-			break;
-		len -= 4;
+	uint32_t hash = 0x9e3779b9UL ^ len;
+
+	for(; len >= 4; q += 4, len -= 4) {
+		uint32_t k;
+		memcpy(&k, q, 4);
+		k *= 0xcc9e2d51UL;
+		hash ^= (k << 15) | (k >> 17);
+		hash = ((hash << 13) | (hash >> 19)) * 5 + 0xe6546b64UL;
+	}
+
+	if(len) {
+		uint32_t k = 0;
+		memcpy(&k, q, len);
+		hash ^= k * 0xcc9e2d51UL;
 	}
+
+	// Mix all bits, we only use the lowest ones to select a slot
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bUL;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35UL;
+	hash ^= hash >> 16;
+
 	return hash;
 }
 
-/* Map 32 bits int onto 0..n-1, without throwing away too many bits if n is 2^8 or 2^16 */
+static uint32_t get_hash(const hash_t *hash, const void *key) {
+	uint32_t h = hash->hash ? hash->hash(key) : hash_bytes(key, hash->size);
+
+	// 0 marks an empty slot
+	return h ? h : 1;
+}
+
+static int compare(const hash_t *hash, const void *a, const void *b) {
+	return hash->compare ? hash->compare(a, b) : memcmp(a, b, hash->size);
+}
+
+/* Distance of slot i from the preferred slot of the element in it */
+
+static size_t distance(const hash_t *hash, size_t i) {
+	return (i - hash->hashes[i]) & (hash->n - 1);
+}
 
-static uint32_t modulo(uint32_t hash, size_t n) {
-	if(n == 0x100)
-		return (hash >> 24) ^ ((hash >> 16) & 0xff) ^ ((hash >> 8) & 0xff) ^ (hash & 0xff);
-	else if(n == 0x10000)
-		return (hash >> 16) ^ (hash & 0xffff);
-	else
-		return hash % n;
+static size_t round_up(size_t n) {
+	size_t result = MIN_SLOTS;
+	while(result < n)
+		result <<= 1;
+	return result;
 }
 
 /* (De)allocation */
 
-hash_t *hash_alloc(size_t n, size_t size) {
+hash_t *hash_alloc_custom(size_t n, size_t size, hash_function_t hashfunc, hash_compare_t comparefunc) {
 	hash_t *hash = xzalloc(sizeof *hash);
-	hash->n = n;
+	hash->n = round_up(n);
 	hash->size = size;
 	hash->keys = xzalloc(hash->n * hash->size);
 	hash->values = xzalloc(hash->n * sizeof *hash->values);
+	hash->hashes = xzalloc(hash->n * sizeof *hash->hashes);
+	hash->hash = hashfunc;
+	hash->compare = comparefunc;
 	return hash;
 }
 
+hash_t *hash_alloc(size_t n, size_t size) {
+	return hash_alloc_custom(n, size, NULL, NULL);
+}
+
 void hash_free(hash_t *hash) {
 	free(hash->keys);
 	free(hash->values);
+	free(hash->hashes);
 	free(hash);
 }
 
 /* Searching and inserting */
 
+static bool find_slot(const hash_t *hash, const void *key, uint32_t h, size_t *slot) {
+	size_t mask = hash->n - 1;
+
+	for(size_t i = h & mask, dist = 0;; i = (i + 1) & mask, dist++) {
+		// Stop at an empty slot, or at an element that would have been displaced by ours
+		if(!hash->hashes[i] || distance(hash, i) < dist)
+			return false;
+
+		if(hash->hashes[i] == h && !compare(hash, key, hash->keys + i * hash->size)) {
+			*slot = i;
+			return true;
+		}
+	}
+}
+
+// Insert a key that is not in the table yet, there must be at least one free slot.
+static void insert_slot(hash_t *hash, const void *key, const void *value, uint32_t h) {
+	size_t mask = hash->n - 1;
+	char carry[hash->size];
+	char tmp[hash->size];
+
+	memcpy(carry, key, hash->size);
+
+	for(size_t i = h & mask, dist = 0;; i = (i + 1) & mask, dist++) {
+		char *slotkey = hash->keys + i * hash->size;
+
+		if(!hash->hashes[i]) {
+			memcpy(slotkey, carry, hash->size);
+			hash->values[i] = value;
+			hash->hashes[i] = h;
+			hash->count++;
+			return;
+		}
+
+		size_t d = distance(hash, i);
+
+		if(d < dist) {
+			// Take the place of an element that is closer to home, and continue with that one
+			memcpy(tmp, slotkey, hash->size);
+			memcpy(slotkey, carry, hash->size);
+			memcpy(carry, tmp, hash->size);
+
+			const void *v = hash->values[i];
+			hash->values[i] = value;
+			value = v;
+
+			uint32_t t = hash->hashes[i];
+			hash->hashes[i] = h;
+			h = t;
+
+			dist = d;
+		}
+	}
+}
+
 void hash_insert(hash_t *hash, const void *key, const void *value) {
-	uint32_t i = modulo(hash_function(key, hash->size), hash->n);
-	memcpy(hash->keys + i * hash->size, key, hash->size);
-	hash->values[i] = value;
+	uint32_t h = get_hash(hash, key);
+	size_t i;
+
+	if(find_slot(hash, key, h, &i)) {
+		hash->values[i] = value;
+		return;
+	}
+
+	// Keep the load factor below 3/4
+	if((hash->count + 1) * 4 > hash->n * 3)
+		hash_resize(hash, hash->n * 2);
+
+	insert_slot(hash, key, value, h);
+}
+
+void hash_delete(hash_t *hash, const void *key) {
+	size_t mask = hash->n - 1;
+	size_t i;
+
+	if(!find_slot(hash, key, get_hash(hash, key), &i))
+		return;
+
+	// Shift the following elements back until one is in its preferred slot
+	for(size_t j = (i + 1) & mask; hash->hashes[j] && distance(hash, j); i = j, j = (j + 1) & mask) {
+		memcpy(hash->keys + i * hash->size, hash->keys + j * hash->size, hash->size);
+		hash->values[i] = hash->values[j];
+		hash->hashes[i] = hash->hashes[j];
+	}
+
+	hash->values[i] = NULL;
+	hash->hashes[i] = 0;
+	hash->count--;
 }
 
 void *hash_search(const hash_t *hash, const void *key) {
-	uint32_t i = modulo(hash_function(key, hash->size), hash->n);
-	if(hash->values[i] && !memcmp(key, hash->keys + i * hash->size, hash->size)) {
+	size_t i;
+
+	if(find_slot(hash, key, get_hash(hash, key), &i))
 		return (void *)hash->values[i];
-	}
+
 	return NULL;
 }
 
 void *hash_search_or_insert(hash_t *hash, const void *key, const void *value) {
-	uint32_t i = modulo(hash_function(key, hash->size), hash->n);
-	if(hash->values[i] && !memcmp(key, hash->keys + i * hash->size, hash->size))
+	uint32_t h = get_hash(hash, key);
+	size_t i;
+
+	if(find_slot(hash, key, h, &i))
 		return (void *)hash->values[i];
-	memcpy(hash->keys + i * hash->size, key, hash->size);
-	hash->values[i] = value;
+
+	if((hash->count + 1) * 4 > hash->n * 3)
+		hash_resize(hash, hash->n * 2);
+
+	insert_slot(hash, key, value, h);
 	return NULL;
 }
 
@@ -95,13 +228,81 @@ void *hash_search_or_insert(hash_t *hash, const void *key, const void *value) {
 
 void hash_clear(hash_t *hash) {
 	memset(hash->values, 0, hash->n * sizeof *hash->values);
+	memset(hash->hashes, 0, hash->n * sizeof *hash->hashes);
+	hash->count = 0;
 }
 
+// Change the number of slots, it will be rounded up to a power of two that can hold all elements.
 void hash_resize(hash_t *hash, size_t n) {
-	hash->keys = xrealloc(hash->keys, n * hash->size);
-	hash->values = xrealloc(hash->values, n * sizeof *hash->values);
-	if(n > hash->n) {
-		memset(hash->keys + hash->n * hash->size, 0, (n - hash->n) * hash->size);
-		memset(hash->values + hash->n, 0, (n - hash->n) * sizeof *hash->values);
+	hash_t old = *hash;
+
+	n = round_up(n);
+	while(hash->count * 4 > n * 3)
+		n <<= 1;
+
+	if(n == hash->n)
+		return;
+
+	hash->n = n;
+	hash->count = 0;
+	hash->keys = xzalloc(n * hash->size);
+	hash->values = xzalloc(n * sizeof *hash->values);
+	hash->hashes = xzalloc(n * sizeof *hash->hashes);
+
+	for(size_t i = 0; i < old.n; i++)
+		if(old.hashes[i])
+			insert_slot(hash, old.keys + i * old.size, old.values[i], old.hashes[i]);
+
+	free(old.keys);
+	free(old.values);
+	free(old.hashes);
+}
+
+/* Hash and compare functions for sockaddr_t keys.
+   Only the address family, address and port are used, the rest of the structure might contain garbage. */
+
+uint32_t hash_sockaddr(const void *key) {
+	const sockaddr_t *sa = key;
+	uint8_t buf[18];
+
+	switch(sa->sa.sa_family) {
+		case AF_INET:
+			memcpy(buf, &sa->in.sin_addr, 4);
+			memcpy(buf + 4, &sa->in.sin_port, 2);
+			return hash_bytes(buf, 6);
+
+		case AF_INET6:
+			memcpy(buf, &sa->in6.sin6_addr, 16);
+			memcpy(buf + 16, &sa->in6.sin6_port, 2);
+			return hash_bytes(buf, 18);
+
+		default:
+			return hash_bytes(&sa->sa.sa_family, sizeof sa->sa.sa_family);
+	}
+}
+
+int hash_compare_sockaddr(const void *va, const void *vb) {
+	const sockaddr_t *a = va;
+	const sockaddr_t *b = vb;
+	int result = a->sa.sa_family - b->sa.sa_family;
+
+	if(result)
+		return result;
+
+	switch(a->sa.sa_family) {
+		case AF_INET:
+			result = memcmp(&a->in.sin_addr, &b->in.sin_addr, sizeof a->in.sin_addr);
+			return result ? result : memcmp(&a->in.sin_port, &b->in.sin_port, sizeof a->in.sin_port);
+
+		case AF_INET6:
+			result = memcmp(&a->in6.sin6_addr, &b->in6.sin6_addr, sizeof a->in6.sin6_addr);
+			return result ? result : memcmp(&a->in6.sin6_port, &b->in6.sin6_port, sizeof a->in6.sin6_port);
+
+		case AF_UNKNOWN:
+			result = strcmp(a->unknown.address, b->unknown.address);
+			return result ? result : strcmp(a->unknown.port, b->unknown.port);
+
+		default:
+			return 0;
 	}
 }
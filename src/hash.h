@@ -20,17 +20,26 @@
 #ifndef __MESHLINK_HASH_H__
 #define __MESHLINK_HASH_H__
 
+typedef uint32_t (*hash_function_t)(const void *key);
+typedef int (*hash_compare_t)(const void *a, const void *b);
+
 typedef struct hash_t {
-	size_t n;
-	size_t size;
+	size_t n;                       /* number of slots, always a power of two */
+	size_t size;                    /* size of a key */
+	size_t count;                   /* number of occupied slots */
 	char *keys;
 	const void **values;
+	uint32_t *hashes;               /* hash of the key in each slot, 0 if the slot is empty */
+	hash_function_t hash;
+	hash_compare_t compare;
 } hash_t;
 
 extern hash_t *hash_alloc(size_t n, size_t size) __attribute__ ((__malloc__));
+extern hash_t *hash_alloc_custom(size_t n, size_t size, hash_function_t hash, hash_compare_t compare) __attribute__ ((__malloc__));
 extern void hash_free(hash_t *);
 
 extern void hash_insert(hash_t *, const void *key, const void *value);
+extern void hash_delete(hash_t *, const void *key);
 
 extern void *hash_search(const hash_t *, const void *key);
 extern void *hash_search_or_insert(hash_t *, const void *key, const void *value);
@@ -38,4 +47,7 @@ extern void *hash_search_or_insert(hash_t *, const void *key, const void *value)
 extern void hash_clear(hash_t *);
 extern void hash_resize(hash_t *, size_t n);
 
+extern uint32_t hash_sockaddr(const void *key);
+extern int hash_compare_sockaddr(const void *a, const void *b);
+
 #endif /* __MESHLINK_HASH_H__ */
@@ -0,0 +1,152 @@
+/*
+    hash_speed.c -- node_udp_cache benchmark
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "hash.h"
+#include "sockaddr.h"
+#include "xalloc.h"
+
+// Fill a UDP address cache with the addresses of a number of peers, then look up
+// randomly chosen peers, like handle_incoming_vpn_packet() does for each packet.
+// Reports the fraction of lookups that found the peer, and the time per lookup.
+
+#define BATCH 1024              /* lookups between reading the clock */
+
+struct timespec start;
+struct timespec end;
+double elapsed;
+double rate;
+unsigned int count;
+
+static void clock_start() {
+	count = 0;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+}
+
+static bool clock_countto(double seconds) {
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	elapsed = end.tv_sec + end.tv_nsec * 1e-9 - start.tv_sec - start.tv_nsec * 1e-9;
+	if(elapsed < seconds)
+		return ++count;
+
+	rate = count / elapsed;
+	return false;
+}
+
+// The direct-mapped cache, as it was before hash.c used open addressing.
+
+typedef struct direct_t {
+	sockaddr_t keys[0x100];
+	const void *values[0x100];
+} direct_t;
+
+static uint32_t direct_hash(const void *p, size_t len) {
+	const uint8_t *q = p;
+	uint32_t hash = 0;
+	while(true) {
+		for(int i = len > 4 ? 4 : len; --i;)
+			hash += q[len - i] << (8 * i);
+		hash *= 0x9e370001UL;
+		if(len <= 4)
+			break;
+		len -= 4;
+	}
+	return ((hash >> 24) ^ ((hash >> 16) & 0xff) ^ ((hash >> 8) & 0xff) ^ (hash & 0xff)) & 0xff;
+}
+
+static void direct_insert(direct_t *d, const sockaddr_t *key, const void *value) {
+	uint32_t i = direct_hash(key, sizeof *key);
+	d->keys[i] = *key;
+	d->values[i] = value;
+}
+
+static void *direct_search(const direct_t *d, const sockaddr_t *key) {
+	uint32_t i = direct_hash(key, sizeof *key);
+	if(d->values[i] && !memcmp(key, &d->keys[i], sizeof *key))
+		return (void *)d->values[i];
+	return NULL;
+}
+
+static void random_address(sockaddr_t *sa) {
+	memset(sa, 0, sizeof *sa);
+
+	if(rand() % 4) {
+		sa->in.sin_family = AF_INET;
+		sa->in.sin_addr.s_addr = htonl(0x0a000000 | (rand() & 0xffffff));
+		sa->in.sin_port = htons(655 + rand() % 1000);
+	} else {
+		sa->in6.sin6_family = AF_INET6;
+		sa->in6.sin6_addr.s6_addr[0] = 0xfd;
+		for(int i = 8; i < 16; i++)
+			sa->in6.sin6_addr.s6_addr[i] = rand();
+		sa->in6.sin6_port = htons(655 + rand() % 1000);
+	}
+}
+
+static void run(int peers, double duration) {
+	sockaddr_t *addresses = xzalloc(peers * sizeof *addresses);
+	direct_t *direct = xzalloc(sizeof *direct);
+	hash_t *hash = hash_alloc_custom(0x100, sizeof(sockaddr_t), hash_sockaddr, hash_compare_sockaddr);
+
+	for(int i = 0; i < peers; i++) {
+		random_address(&addresses[i]);
+		direct_insert(direct, &addresses[i], &addresses[i]);
+		hash_insert(hash, &addresses[i], &addresses[i]);
+	}
+
+	unsigned long hits = 0;
+	int j = 0;
+
+	fprintf(stderr, "%6d peers, direct-mapped:   ", peers);
+	for(clock_start(); clock_countto(duration);)
+		for(int i = 0; i < BATCH; i++, j = (j + 7919) % peers)
+			hits += direct_search(direct, &addresses[j]) == &addresses[j];
+	fprintf(stderr, "%6.2lf%% hits, %8.2lf ns/lookup\n", 100.0 * hits / (count * BATCH), 1e9 / (rate * BATCH));
+
+	hits = 0;
+	j = 0;
+
+	fprintf(stderr, "%6d peers, open addressing: ", peers);
+	for(clock_start(); clock_countto(duration);)
+		for(int i = 0; i < BATCH; i++, j = (j + 7919) % peers)
+			hits += hash_search(hash, &addresses[j]) == &addresses[j];
+	fprintf(stderr, "%6.2lf%% hits, %8.2lf ns/lookup\n", 100.0 * hits / (count * BATCH), 1e9 / (rate * BATCH));
+
+	hash_free(hash);
+	free(direct);
+	free(addresses);
+}
+
+int main(int argc, char *argv[]) {
+	double duration = argc > 1 ? atof(argv[1]) : 1;
+
+	if(duration <= 0) {
+		fprintf(stderr, "Usage: %s [seconds per run]\n", argv[0]);
+		return 1;
+	}
+
+	srand(time(NULL));
+
+	run(10, duration);
+	run(1000, duration);
+	run(100000, duration);
+
+	return 0;
+}
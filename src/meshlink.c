@@ -31,6 +31,7 @@ typedef struct {
 #include "system.h"
 #include <pthread.h>
 
+#include "compression.h"
 #include "crypto.h"
 #include "ecdsagen.h"
 #include "logger.h"
@@ -759,6 +760,10 @@ static struct timeval idle(event_loop_t *loop, void *data) {
         if(timercmp(&t, &tmin, <))
             tmin = t;
     }
+
+    // send out the UDP packets batched during this iteration before waiting for new events
+    flush_udp_batches(mesh);
+
     return tmin;
 }
 
@@ -913,6 +918,7 @@ meshlink_handle_t *meshlink_open(const char *confbase, const char *name, const c
     mesh->confbase = xstrdup(confbase);
     mesh->appname = xstrdup(appname);
     mesh->devclass = devclass;
+    mesh->compression = compression_init();
     if(name)
         mesh->name = xstrdup(name);
 
@@ -932,6 +938,9 @@ meshlink_handle_t *meshlink_open(const char *confbase, const char *name, const c
     MESHLINK_MUTEX_LOCK(&mesh->mesh_mutex);
 
     mesh->threadstarted = false;
+    mesh->tarpit = -1;
+    mesh->link_mtu = DEFAULT_LINK_MTU;
+    mesh->maxsize = MAXSIZE_FOR(DEFAULT_LINK_MTU);
     event_loop_init(&mesh->loop);
     mesh->loop.data = mesh;
 
@@ -1072,6 +1081,8 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 
     mesh->threadstarted=true;
 
+    start_udp_workers(mesh);
+
     MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
 
     discovery_start(mesh);
@@ -1091,6 +1102,9 @@ void meshlink_stop(meshlink_handle_t *mesh) {
     // Stop discovery
     discovery_stop(mesh);
 
+    // Stop the UDP receive threads, they need the mesh mutex to finish their work
+    stop_udp_workers(mesh);
+
     MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
     logger(mesh, MESHLINK_DEBUG, "meshlink_stop called\n");
 
@@ -1151,6 +1165,7 @@ void meshlink_close(meshlink_handle_t *mesh) {
 #endif
 
     ecdsa_free(mesh->invitation_key);
+    compression_exit(mesh->compression);
 
     free(mesh->name);
     free(mesh->appname);
@@ -1250,26 +1265,40 @@ void meshlink_set_node_pmtu_cb(meshlink_handle_t *mesh, meshlink_node_pmtu_cb_t
     MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
 }
 
-static vpn_packet_t* prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len) {
-    meshlink_packethdr_t *hdr;
+void meshlink_set_send_budget(meshlink_handle_t *mesh, unsigned int budget) {
+    if(!mesh) {
+        meshlink_errno = MESHLINK_EINVAL;
+        return;
+    }
+
+    MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+    signalio_set_budget(&mesh->loop, budget);
+    MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+}
+
+// size of the packet header as it is sent on the wire to the given node
+static size_t packethdr_size(const node_t *n) {
+    return (n->options & OPTION_COMPACT_HEADER) ? sizeof(meshlink_compacthdr_t) : sizeof(meshlink_packethdr_t);
+}
 
+static bool validate_packet(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len) {
     // Validate arguments
-    if(!mesh || !destination || len >= MAXSIZE - sizeof *hdr) {
+    if(!mesh || !destination || len >= mesh->maxsize - sizeof(meshlink_packethdr_t)) {
         meshlink_errno = MESHLINK_EINVAL;
         logger(mesh, MESHLINK_ERROR, "Error: prepare_packet invalid arguments");
-        return NULL;
+        return false;
     }
 
     if(!len)
     {
         logger(mesh, MESHLINK_WARNING, "Warning: prepare_packet empty packet dropped");
-        return NULL;
+        return false;
     }
 
     if(!data) {
         meshlink_errno = MESHLINK_EINVAL;
         logger(mesh, MESHLINK_ERROR, "Error: prepare_packet missing data");
-        return NULL;
+        return false;
     }
 
     // check log level before calling bin2hex since that's an expensive call
@@ -1281,16 +1310,16 @@ static vpn_packet_t* prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *de
         free(hex);
     }
 
-    // Prepare the packet
-    vpn_packet_t *packet = malloc(sizeof *packet);
-    if(!packet) {
-        meshlink_errno = MESHLINK_ENOMEM;
-        logger(mesh, MESHLINK_ERROR, "Error: prepare_packet packet memory allocation failed");
-        return NULL;
-    }
+    return true;
+}
+
+// fill in a packet that has been checked by validate_packet
+static void prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len, vpn_packet_t *packet) {
+    meshlink_packethdr_t *hdr;
 
     packet->probe = false;
     packet->tcp = false;
+    packet->disposable = false;
     packet->len = len + sizeof *hdr;
 
     hdr = (meshlink_packethdr_t *)packet->data;
@@ -1302,8 +1331,6 @@ static vpn_packet_t* prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *de
     strncpy(hdr->source, mesh->self->name, (sizeof hdr->source) -1 );
 
     memcpy(packet->data + sizeof *hdr, data, len);
-
-    return packet;
 }
 
 bool meshlink_send(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len) {
@@ -1313,32 +1340,41 @@ bool meshlink_send(meshlink_handle_t *mesh, meshlink_node_t *destination, const
         return true;
     }
 
-    // Prepare packet
-    vpn_packet_t *packet = prepare_packet(mesh, destination, data, len);
-    if(!packet) {
+    if(!validate_packet(mesh, destination, data, len)) {
         return false;
     }
 
-    // Queue it
-    if(!signalio_queue(&(mesh->loop), &(mesh->datafromapp), packet)) {
-        free(packet);
+    // Claim a slot in the event loop's queue and prepare the packet in place
+    // validate_packet checked the length without the lock, the queue checks it again against the room it actually has
+    vpn_packet_t *packet = signalio_reserve(&(mesh->loop), &(mesh->datafromapp), len + sizeof(meshlink_packethdr_t));
+    if(!packet) {
         meshlink_errno = MESHLINK_ENOMEM;
-        logger(mesh, MESHLINK_ERROR, "Error: meshlink_send failed to queue packet");
+        logger(mesh, MESHLINK_ERROR, "Error: meshlink_send failed to queue packet, queue is full or packet too large");
         return false;
     }
 
+    prepare_packet(mesh, destination, data, len, packet);
+    signalio_commit(&(mesh->loop), packet);
+
     return true;
 }
 
 bool meshlink_send_from_queue(event_loop_t *loop, meshlink_handle_t *mesh, vpn_packet_t *packet) {
     MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
 
+    // the maximum MTU may have been lowered after the packet was queued
+    if(packet->len > mesh->maxsize) {
+        logger(mesh, MESHLINK_WARNING, "Warning: dropping queued packet of %d bytes, it is larger than the maximum MTU", packet->len);
+        MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+        return true;
+    }
+
     mesh->self->in_packets++;
     mesh->self->in_bytes += packet->len;
     int err = route(mesh, mesh->self, packet);
     if(err) {
         if(sockwouldblock(err)) {
-            logger(mesh, MESHLINK_WARNING, "Warning: socket would block, retrying to send packet from queue later");
+            logger(mesh, MESHLINK_WARNING, "Warning: socket would block, retrying to send packet from queue once it is writable");
             MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
             return false;
         }
@@ -1371,8 +1407,94 @@ ssize_t meshlink_get_pmtu(meshlink_handle_t *mesh, meshlink_node_t *destination)
     }
     else {
         // return the usable payload size for API users
-        return sptps_maxmtu(&n->sptps) - sizeof(meshlink_packethdr_t);
+        return node_max_mtu(mesh, n) - packethdr_size(n);
+    }
+}
+
+bool meshlink_set_compression(meshlink_handle_t *mesh, meshlink_compression_t codec, const void *dictionary, size_t len) {
+    if(!mesh || codec < MESHLINK_COMPRESSION_NONE || codec > MESHLINK_COMPRESSION_ZSTD || (len && !dictionary)) {
+        meshlink_errno = MESHLINK_EINVAL;
+        return false;
+    }
+
+    int level;
+
+    switch(codec) {
+    case MESHLINK_COMPRESSION_ZLIB:
+        level = COMPRESS_ZLIB_MIN;
+        break;
+    case MESHLINK_COMPRESSION_LZ4:
+        level = len ? COMPRESS_LZ4_DICT : COMPRESS_LZ4;
+        break;
+    case MESHLINK_COMPRESSION_ZSTD:
+        level = len ? COMPRESS_ZSTD_DICT : COMPRESS_ZSTD;
+        break;
+    default:
+        level = COMPRESS_NONE;
+        break;
+    }
+
+    MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+
+    // check the codec before touching the dictionary, so a failed call leaves everything as it was
+    if(!compression_supported(mesh->compression, compression_without_dictionary(level))) {
+        MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+        logger(mesh, MESHLINK_ERROR, "Compression with %s is not supported\n", compression_name(level));
+        meshlink_errno = MESHLINK_EINVAL;
+        return false;
+    }
+
+    int olddictid = compression_dictionary_id(mesh->compression);
+
+    // the dictionary is also used to compress packets for other nodes that ask for it
+    if(!compression_set_dictionary(mesh->compression, dictionary, len)) {
+        MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+        meshlink_errno = MESHLINK_ENOMEM;
+        return false;
+    }
+
+    mesh->incompression = level;
+    if(mesh->self)
+        mesh->self->incompression = level;
+
+    // Nodes that agreed on the old dictionary stop compressing with it, renegotiate with them right away.
+    if(mesh->threadstarted && compression_dictionary_id(mesh->compression) != olddictid) {
+        for splay_each(node_t, n, mesh->nodes) {
+            if(n == mesh->self || !n->status.validkey)
+                continue;
+
+            if(compression_usable_level(mesh->compression, n->incompression, n->dictid) != n->incompression
+                    || compression_usable_level(mesh->compression, n->outcompression, n->dictid) != n->outcompression)
+                send_req_key(mesh, n);
+        }
+
+        signalio_trigger(&(mesh->loop));
     }
+
+    MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+    return true;
+}
+
+bool meshlink_set_node_replay_window(meshlink_handle_t *mesh, meshlink_node_t *node, unsigned int packets) {
+    if(!mesh || !node || packets > MESHLINK_MAX_REPLAY_WINDOW) {
+        meshlink_errno = MESHLINK_EINVAL;
+        return false;
+    }
+
+    MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+
+    node_t *n = (node_t *)node;
+    n->replaywin = packets / 8 + (packets % 8 != 0);
+
+    // resize the window of the current session, later sessions pick it up when they start
+    bool result = !n->sptps.state || sptps_set_replaywin(&n->sptps, n->replaywin ? n->replaywin : sptps_replaywin);
+
+    MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+    if(!result)
+        meshlink_errno = MESHLINK_ENOMEM;
+
+    return result;
 }
 
 char *meshlink_get_fingerprint(meshlink_handle_t *mesh, meshlink_node_t *node) {
@@ -1680,6 +1802,55 @@ int meshlink_get_port(meshlink_handle_t *mesh) {
     return atoi(mesh->myport);
 }
 
+bool meshlink_set_receive_threads(meshlink_handle_t *mesh, int threads) {
+    if(!mesh || threads < 0 || mesh->threadstarted) {
+        meshlink_errno = MESHLINK_EINVAL;
+        logger(mesh, MESHLINK_DEBUG, "Failed to set receive threads: invalid number, or thread already started.\n");
+        return false;
+    }
+
+    MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+    mesh->receive_threads = threads;
+    MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+    return true;
+}
+
+bool meshlink_set_max_mtu(meshlink_handle_t *mesh, uint16_t mtu) {
+    if(!mesh || mtu < MIN_LINK_MTU || mtu > MAX_LINK_MTU || mesh->threadstarted) {
+        meshlink_errno = MESHLINK_EINVAL;
+        logger(mesh, MESHLINK_DEBUG, "Failed to set maximum MTU: invalid size, or thread already started.\n");
+        return false;
+    }
+
+    MESHLINK_MUTEX_LOCK(&(mesh->mesh_mutex));
+
+    // meshlink_start() might have been called in the meantime
+    if(mesh->threadstarted) {
+        MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+        meshlink_errno = MESHLINK_EINVAL;
+        logger(mesh, MESHLINK_DEBUG, "Failed to set maximum MTU: thread already started.\n");
+        return false;
+    }
+
+    // meshlink_send() does not take the lock, so the queue is only ever grown, never freed while it is in use
+    signalio_set_packet_size(&mesh->loop, MAXSIZE_FOR(mtu));
+
+    mesh->link_mtu = mtu;
+    mesh->maxsize = MAXSIZE_FOR(mtu);
+
+    // the receive buffers are allocated again with the new size when they are needed
+#ifdef HAVE_RECVMMSG
+    free(mesh->udp_batch);
+    mesh->udp_batch = NULL;
+#endif
+    free_scratch_packets(mesh);
+
+    MESHLINK_MUTEX_UNLOCK(&(mesh->mesh_mutex));
+
+    return true;
+}
+
 bool meshlink_set_port(meshlink_handle_t *mesh, int port) {
     if(!mesh || port < 0 || port >= 65536 || mesh->threadstarted) {
         meshlink_errno = MESHLINK_EINVAL;
@@ -2385,13 +2556,18 @@ static ssize_t channel_send(struct utcp *utcp, const void *data, size_t len) {
     }
 
     // Prepare packet
-    vpn_packet_t *packet = prepare_packet(mesh, (meshlink_node_t*)destination, data, len);
-    if(!packet) {
+    if(!validate_packet(mesh, (meshlink_node_t*)destination, data, len)) {
         return UTCP_ERROR;
     }
 
     MESHLINK_MUTEX_LOCK(&mesh->mesh_mutex);
 
+    vpn_packet_t *packet = scratch_packet(mesh, SCRATCH_CHANNEL);
+    prepare_packet(mesh, (meshlink_node_t*)destination, data, len, packet);
+
+    // UTCP keeps its own copy for retransmissions, so the packet can be encrypted in place
+    packet->disposable = true;
+
     mesh->self->in_packets++;
     mesh->self->in_bytes += packet->len;
     int err = route(mesh, mesh->self, packet);
@@ -2407,8 +2583,6 @@ static ssize_t channel_send(struct utcp *utcp, const void *data, size_t len) {
         }
     }
 
-    free(packet);
-
     return err ? sockwouldblock(err) ? UTCP_WOULDBLOCK : UTCP_ERROR : len;
 }
 
@@ -2803,14 +2977,14 @@ void update_node_mtu(meshlink_handle_t *mesh, node_t *n) {
     if(!mesh||!n)
         return;
 
-    uint16_t mtu = n->mtu > sizeof(meshlink_packethdr_t)? n->mtu - sizeof(meshlink_packethdr_t): 0;
+    uint16_t mtu = n->mtu > packethdr_size(n)? n->mtu - packethdr_size(n): 0;
 
     // set utcp maximum transmission unit size, determined by net_packet.c probing packets via send_sptps_packet
     // 1500 bytes usable space for the ethernet frame
     // - 20 bytes IPv4-Header
     // -  8 bytes UDP-Header
     // - 19 to 21 bytes encryption (sptps.c send_record_priv / send_record_priv_datagram)
-    // - 66 bytes Meshlink packet header ( source & destination node names )
+    // - 66 bytes Meshlink packet header ( source & destination node names ), or 4 bytes if compact headers are supported
     // - 20 bytes UTCP-Header size subtracted internally by utcp
     // = about 1365 bytes payload left
     if(n->utcp)
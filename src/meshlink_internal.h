@@ -92,6 +92,13 @@ struct meshlink_handle {
 	struct splay_tree_t *past_request_tree;
 	timeout_t past_request_timeout;
 
+	sockaddr_t prev_sa;             /* address of the last accepted meta connection */
+	int tarpit;                     /* socket held open to slow down a connection burst, or -1 */
+	int samehost_burst;
+	time_t samehost_burst_time;
+	int connection_burst;
+	time_t connection_burst_time;
+
 	int contradicting_add_edge;
 	int contradicting_del_edge;
 	int sleeptime;
@@ -111,6 +118,28 @@ struct meshlink_handle {
 	sockaddr_t localdiscovery_address;
 
 	hash_t *node_udp_cache;
+	hash_t *node_sessionid_cache;
+#ifdef HAVE_RECVMMSG
+	struct udp_batch *udp_batch;    /* receive buffers for recvmmsg(), allocated on first use */
+#endif
+	uint8_t *scratch;               /* scratch packets, see scratch_packet() */
+	int receive_threads;            /* number of extra threads per listen socket receiving UDP packets */
+	struct udp_worker_t *udp_workers;
+	int udp_workers_count;
+	int udp_workers_pipe[2];        /* written to when the workers have to stop */
+#ifdef HAVE_SENDMMSG
+	bool udp_gso_disabled;          /* the kernel rejected UDP_SEGMENT, only use sendmmsg() */
+	struct list_t *udp_pending;     /* nodes with packets in their txbatch */
+#endif
+	time_t last_hard_try;
+	struct compression_t *compression;  /* codec state and dictionary for compressing packets */
+	int incompression;              /* compression level other nodes are asked to use for packets to us */
+	uint64_t receive_bytes_copied;  /* bytes of received packets copied before delivery or forwarding */
+	uint64_t receive_bytes_delivered; /* bytes of payload passed to the receive callback */
+	uint16_t link_mtu;              /* largest link MTU path MTU discovery tries, see meshlink_set_max_mtu() */
+	uint16_t maxsize;               /* room for data in the packets of allocated buffers, MAXSIZE_FOR(link_mtu) */
+	uint16_t udp_drop_size;         /* outgoing UDP packets larger than this are dropped to simulate a small path MTU, 0 to disable */
+	sockaddr_t broadcast_address;   /* scratch address returned by choose_broadcast_address() */
 	struct connection_t *everyone;
 	struct ecdsa *invitation_key;
 
@@ -172,6 +201,17 @@ typedef struct meshlink_packethdr {
 	uint8_t source[33];
 } __attribute__ ((__packed__)) meshlink_packethdr_t;
 
+/// Compact header for data packets sent to nodes that have OPTION_COMPACT_HEADER set.
+/// The first byte is always zero, which distinguishes it from a header with node names.
+typedef struct meshlink_compacthdr {
+	uint8_t zero;
+	uint8_t reserved;
+	uint16_t destination;   /* index of the destination in the receiver's node table, network byte order */
+} __attribute__ ((__packed__)) meshlink_compacthdr_t;
+
+/// A node always has index 0 in its own node table.
+#define NODE_INDEX_SELF 0
+
 extern bool meshlink_send_from_queue(event_loop_t* el,meshlink_handle_t *mesh, vpn_packet_t *packet);
 extern void update_node_status(meshlink_handle_t *mesh, struct node_t *n);
 extern void update_node_mtu(meshlink_handle_t *mesh, struct node_t *n);
@@ -590,6 +590,8 @@ int main_loop(meshlink_handle_t *mesh) {
 		return 1;
 	}
 
+	flush_udp_batches(mesh);
+
 	timeout_del(&mesh->loop, &mesh->periodictimer);
 	timeout_del(&mesh->loop, &mesh->pingtimer);
 
@@ -38,7 +38,24 @@ typedef struct outgoing_t {
 	struct meshlink_handle *mesh;
 } outgoing_t;
 
-extern int maxoutbufsize;
+/* Maximum number of UDP packets received with a single recvmmsg() call */
+#define UDP_RECV_BATCH 32
+
+/* Maximum number of UDP packets per node collected during one event loop iteration before they are sent with sendmmsg() */
+#define UDP_SEND_BATCH 32
+
+/* Packets with room for mesh->maxsize bytes, used instead of packets on the stack that would need room for MAXSIZE bytes.
+   Each place that needs one has its own, since they can be in use at the same time. */
+typedef enum scratch_packet_t {
+	SCRATCH_RECEIVE,                /* a UDP packet received without recvmmsg(), see handle_incoming_vpn_data() */
+	SCRATCH_RECORD,                 /* an uncompressed or probe record, see receive_sptps_record() */
+	SCRATCH_ROUTE,                  /* a copy of a received packet that has to be forwarded, see route_packet_data() */
+	SCRATCH_CHANNEL,                /* a packet from UTCP, see channel_send() */
+	SCRATCH_PROBE,                  /* an MTU probe, see send_mtu_probe_len() */
+	SCRATCH_COMPRESS,               /* a compressed packet, see send_sptps_packet() */
+	SCRATCH_PACKETS,
+} scratch_packet_t;
+
 extern int addressfamily;
 
 extern int keylifetime;
@@ -51,6 +68,12 @@ extern bool do_prune;
 
 extern void retry_outgoing(struct meshlink_handle *mesh, outgoing_t *);
 extern bool handle_incoming_vpn_data(struct event_loop_t *loop, void *, int);
+extern void flush_udp_batches(struct meshlink_handle *mesh);
+extern vpn_packet_t *scratch_packet(struct meshlink_handle *mesh, scratch_packet_t which);
+extern void free_scratch_packets(struct meshlink_handle *mesh);
+extern void handle_incoming_vpn_packet(struct meshlink_handle *mesh, listen_socket_t *ls, vpn_packet_t *pkt, sockaddr_t *from);
+extern bool start_udp_workers(struct meshlink_handle *mesh);
+extern void stop_udp_workers(struct meshlink_handle *mesh);
 extern void finish_connecting(struct meshlink_handle *mesh, struct connection_t *);
 extern bool do_outgoing_connection(struct meshlink_handle *mesh, struct outgoing_t *);
 extern bool handle_new_meta_connection(struct event_loop_t *loop, void *, int);
@@ -62,6 +85,7 @@ extern int send_sptps_data(void *handle, uint8_t type, const void *data, size_t
 extern bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t len);
 // @return the sockerrno, 0 on success, -1 on other errors
 extern int send_packet(struct meshlink_handle *mesh, struct node_t *, struct vpn_packet_t *);
+extern void reset_compression(struct node_t *);
 extern void receive_tcppacket(struct meshlink_handle *mesh, struct connection_t *, const char *, int);
 extern void broadcast_packet(struct meshlink_handle *mesh, const struct node_t *, struct vpn_packet_t *);
 extern char *get_name(struct meshlink_handle *mesh);
@@ -77,6 +101,7 @@ extern bool node_read_ecdsa_public_key(struct meshlink_handle *mesh, struct node
 extern bool read_ecdsa_public_key(struct meshlink_handle *mesh, struct connection_t *);
 extern bool read_ecdsa_private_key(struct meshlink_handle *mesh);
 extern void send_mtu_probe(struct meshlink_handle *mesh, struct node_t *);
+extern uint16_t node_max_mtu(struct meshlink_handle *mesh, struct node_t *);
 extern void handle_meta_connection_data(struct meshlink_handle *mesh, struct connection_t *);
 extern void retry(struct meshlink_handle *mesh);
 
@@ -20,11 +20,12 @@
 #ifndef __MESHLINK_NET_DEFINES_H__
 #define __MESHLINK_NET_DEFINES_H__
 
-#ifdef ENABLE_JUMBOGRAMS
-#define MTU 9018        /* 9000 bytes payload + 14 bytes ethernet header + 4 bytes VLAN tag */
-#else
-#define MTU 1518        /* 1500 bytes payload + 14 bytes ethernet header + 4 bytes VLAN tag */
-#endif
+/* Link MTUs a mesh can be configured for with meshlink_set_max_mtu(), the largest one allows for jumbo frames */
+#define MIN_LINK_MTU 576
+#define DEFAULT_LINK_MTU 1500
+#define MAX_LINK_MTU 9000
+
+#define MTU (MAX_LINK_MTU + 18) /* payload + 14 bytes ethernet header + 4 bytes VLAN tag */
 
 // max payload size
 // MTU - (14 bytes ethernet header + 4 bytes VLAN tag)
@@ -32,21 +33,33 @@
 // -  8 bytes UDP-Header
 #define PAYLOAD_MTU (MTU - 18 - 20 - 8)
 
-/* MAXSIZE is the maximum size of an encapsulated packet: MTU + seqno + HMAC + compressor overhead */
-#define MAXSIZE (MTU + 4 + 32 + MTU/64 + 20)
+/* MAXSIZE_FOR() is the maximum size of an encapsulated packet on a link with the given MTU: MTU + seqno + HMAC + compressor overhead */
+#define MAXSIZE_FOR(linkmtu) ((linkmtu) + 18 + 4 + 32 + ((linkmtu) + 18)/64 + 20)
+#define MAXSIZE MAXSIZE_FOR(MAX_LINK_MTU)
 
 /* MAXBUFSIZE is the maximum size of a request: enough for a MAXSIZEd packet or a 8192 bits RSA key */
 #define MAXBUFSIZE ((MAXSIZE > 2048 ? MAXSIZE : 2048) + 128)
 
+/* PACKET_HEADROOM is the room in front of a packet's data for headers added when it is encrypted in place */
+#define PACKET_HEADROOM 12
+
 typedef struct vpn_packet_t {
     struct {
         unsigned int probe:1;
         unsigned int tcp:1;
+        unsigned int disposable:1;  /* the packet is not needed after sending, so it can be encrypted in place */
     };
     uint16_t len;           /* the actual number of bytes in the `data' field */
+    uint8_t headroom[PACKET_HEADROOM];
     uint8_t data[MAXSIZE];
 } vpn_packet_t;
 
+/* Packets are not declared on the stack, since room for MAXSIZE bytes of data is much more than usually needed.
+   Packets in buffers that are allocated for a mesh, like the receive batches, the signal queue and the scratch packets,
+   only have room for mesh->maxsize bytes, and take up VPN_PACKET_SIZE(mesh->maxsize) bytes each,
+   rounded up to keep the next packet aligned. */
+#define VPN_PACKET_SIZE(maxsize) ((offsetof(vpn_packet_t, data) + (maxsize) + 7) & ~(size_t)7)
+
 /* Packet types when using SPTPS */
 
 #define PKT_COMPRESSED 1
@@ -19,10 +19,7 @@
 
 #include "system.h"
 
-#ifdef HAVE_ZLIB
-#include <zlib.h>
-#endif
-
+#include "compression.h"
 #include "conf.h"
 #include "connection.h"
 #include "crypto.h"
@@ -43,115 +40,317 @@ static int send_udppacket(meshlink_handle_t *mesh, node_t *, vpn_packet_t *);
 
 #define MAX_SEQNO 1073741824
 
-/* mtuprobes == 1..30: initial discovery, send bursts with 1 second interval
-   mtuprobes ==    31: sleep pinginterval seconds
-   mtuprobes ==    32: send 1 burst, sleep pingtimeout second
-   mtuprobes ==    33: no response from other side, restart PMTU discovery process
+static int find_udp_socket(meshlink_handle_t *mesh, const sockaddr_t *sa) {
+	for(int i = 0; i < mesh->listen_sockets; i++)
+		if(mesh->listen_socket[i].sa.sa.sa_family == sa->sa.sa_family)
+			return i;
 
-   Probes are sent in batches of at least three, with random sizes between the
-   lower and upper boundaries for the MTU thus far discovered.
+	return -1;
+}
 
-   After the initial discovery, a fourth packet is added to each batch with a
-   size larger than the currently known PMTU, to test if the PMTU has increased.
+static void add_udp_candidate(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa, const udp_candidate_t *old, int oldcount) {
+	if(sa->sa.sa_family != AF_INET && sa->sa.sa_family != AF_INET6)
+		return;
 
-   In case local discovery is enabled, another packet is added to each batch,
-   which will be broadcast to the local network.
+	for(int i = 0; i < n->udp_candidates; i++)
+		if(!sockaddrcmp(&n->udp_candidate[i].address, sa))
+			return;
+
+	int sock = find_udp_socket(mesh, sa);
+
+	if(sock < 0) {
+		/// fails when during setup no matching socket could be created or bound
+		logger(mesh, MESHLINK_DEBUG, "No matching socket for UDP candidate address of %s with sa_family=%d", n->name, sa->sa.sa_family);
+		return;
+	}
+
+	udp_candidate_t *c = &n->udp_candidate[n->udp_candidates++];
+	memset(c, 0, sizeof *c);
+	c->address = *sa;
+	c->sock = sock;
+	c->rtt = -1;
+
+	// keep what we learned about this address before
+	for(int i = 0; i < oldcount; i++) {
+		if(!sockaddrcmp(&old[i].address, sa)) {
+			c->last_sent = old[i].last_sent;
+			c->replies = old[i].replies;
+			c->rtt = old[i].rtt;
+			break;
+		}
+	}
+
+	if(c->replies && c->rtt >= 0 && (n->udp_candidate_best < 0 || c->rtt < n->udp_candidate[n->udp_candidate_best].rtt))
+		n->udp_candidate_best = c - n->udp_candidate;
+}
+
+/* Collect the addresses the node might be reachable on: the one we currently use,
+   which could be the reflexive UDP address discovered during key exchange,
+   and the ones its peers see it on, which are found in the edges towards it.
+   This is only done when the edges have changed. */
+
+static void update_udp_candidates(meshlink_handle_t *mesh, node_t *n) {
+	udp_candidate_t *old = n->udp_candidate;
+	int oldcount = n->udp_candidates;
+
+	n->udp_candidate = xzalloc((n->edge_tree->count + 1) * sizeof *n->udp_candidate);
+	n->udp_candidates = 0;
+	n->udp_candidate_best = -1;
+
+	add_udp_candidate(mesh, n, &n->address, old, oldcount);
+
+	for splay_each(edge_t, e, n->edge_tree)
+		if(e->reverse)
+			add_udp_candidate(mesh, n, &e->reverse->address, old, oldcount);
+
+	if(n->udp_candidate_next >= n->udp_candidates)
+		n->udp_candidate_next = 0;
+
+	free(old);
+	n->status.udp_candidates = true;
+}
 
+// An MTU probe reply arrived from n->address, update the statistics of the candidate it belongs to.
+static void udp_candidate_replied(meshlink_handle_t *mesh, node_t *n) {
+	for(int i = 0; i < n->udp_candidates; i++) {
+		udp_candidate_t *c = &n->udp_candidate[i];
+
+		if(sockaddrcmp(&c->address, &n->address))
+			continue;
+
+		struct timeval diff;
+		timersub(&mesh->loop.now, &c->last_sent, &diff);
+		int rtt = diff.tv_sec * 1000000 + diff.tv_usec;
+
+		c->replies++;
+		c->rtt = c->rtt < 0 ? rtt : (c->rtt * 7 + rtt) / 8;
+
+		if(n->udp_candidate_best < 0 || c->rtt < n->udp_candidate[n->udp_candidate_best].rtt)
+			n->udp_candidate_best = i;
+
+		break;
+	}
+}
+
+/* Path MTU discovery
+
+   Probes are SPTPS records of type PKT_PROBE, which the other side sends back with the first byte set to 1.
+   The state of the discovery is kept in n->pmtu_state:
+
+   PMTU_BASE:      a burst with a small probe and a search round is sent every second, to each UDP candidate address in turn,
+                   until one is answered. After PMTU_BASE_ROUNDS bursts, it is only tried every pinginterval.
+   PMTU_SEARCHING: rounds of PMTU_BURST probes are sent, dividing the range between minmtu and maxmtu in equal parts.
+                   Answers raise minmtu, and as soon as all probes above it are answered the next round is sent.
+                   If a round times out, the smallest probe that was not answered is taken as too big, and maxmtu is lowered.
+                   If none of its probes were answered though, the round is repeated up to PMTU_MAX_PROBES times first,
+                   since that is more likely packet loss. The search is done when minmtu reaches maxmtu.
+   PMTU_COMPLETE:  every pinginterval a probe of the current MTU is sent, and one of the largest possible size to detect an increase.
+                   If the first is not answered within pingtimeout, discovery is restarted.
+                   When a packet is sent less than PMTU_PIGGYBACK seconds before a check is due, the check is done right away,
+                   so its probes go out in the same batch as the packet.
+
+   Rounds time out after twice the round trip time of earlier probes, which is measured using a timestamp in the probes,
+   so the search takes a few round trips instead of many seconds.
+
+   In case local discovery is enabled, an extra probe is added to the bursts in PMTU_BASE,
+   which will be broadcast to the local network.
 */
 
+#define PMTU_BASE_SIZE 64               /* size of the probe that should always get through */
+#define PMTU_BASE_ROUNDS 10             /* bursts sent at one second intervals before backing off to pinginterval */
+#define PMTU_MAX_PROBES 2               /* times a round without any answers is sent before its probes are taken as too big */
+#define PMTU_MIN_TIMEOUT 20000          /* lower limit on the round timeout in microseconds */
+#define PMTU_PIGGYBACK 5                /* seconds before a check is due that it is sent along with outgoing packets */
+
+// Largest payload we try to send to a node over UDP, so the datagrams fit in a link with the mesh's maximum MTU.
+uint16_t node_max_mtu(meshlink_handle_t *mesh, node_t *n) {
+	return sptps_maxmtu(&n->sptps) - (MAX_LINK_MTU - mesh->link_mtu);
+}
+
+static struct timeval mtu_probe_timeout(const node_t *n) {
+	if(n->mturtt < 0)
+		return (struct timeval){1, 0};
+
+	int timeout = 2 * n->mturtt;
+
+	if(timeout < PMTU_MIN_TIMEOUT)
+		timeout = PMTU_MIN_TIMEOUT;
+	else if(timeout > 1000000)
+		timeout = 1000000;
+
+	return (struct timeval){timeout / 1000000, timeout % 1000000};
+}
+
+static void send_mtu_probe_len(meshlink_handle_t *mesh, node_t *n, int len) {
+	if(len < PMTU_BASE_SIZE)
+		len = PMTU_BASE_SIZE;
+
+	// The 14 byte header is all zeroes, except for the time the probe is sent, used to measure the round trip time.
+	vpn_packet_t *packet = scratch_packet(mesh, SCRATCH_PROBE);
+	packet->probe = true;
+	packet->tcp = false;
+	packet->disposable = false;
+	memset(packet->data, 0, 14);
+	uint32_t sent[2] = {htonl(mesh->loop.now.tv_sec), htonl(mesh->loop.now.tv_usec)};
+	memcpy(packet->data + 2, sent, sizeof sent);
+	randomize(packet->data + 14, len - 14);
+	packet->len = len;
+
+	logger(mesh, MESHLINK_DEBUG, "Sending MTU probe length %d to %s (%s)", len, n->name, n->hostname);
+
+	if(0 != send_udppacket(mesh, n, packet)) {
+		logger(mesh, MESHLINK_WARNING, "Sending MTU probe with length %d to %s (%s) failed", len, n->name, n->hostname);
+	}
+}
+
+// Send probes dividing the range between minmtu and maxmtu in equal parts, the largest one being maxmtu itself.
+static void send_mtu_probe_round(meshlink_handle_t *mesh, node_t *n) {
+	int range = n->maxmtu - n->minmtu;
+
+	for(int i = 0; i < PMTU_BURST; i++) {
+		int len = n->minmtu + (range * (i + 1) + PMTU_BURST - 1) / PMTU_BURST;
+
+		if(len <= n->minmtu || (i && len == n->mtuprobe_len[i - 1])) {
+			n->mtuprobe_len[i] = 0;
+			continue;
+		}
+
+		n->mtuprobe_len[i] = len;
+		send_mtu_probe_len(mesh, n, len);
+	}
+
+	struct timeval timeout = mtu_probe_timeout(n);
+	n->mtuprobe_replies = 0;
+	timeout_set(&mesh->loop, &n->mtutimeout, &timeout);
+}
+
+// @return the smallest probe of the current round that is larger than minmtu and has not been answered yet, 0 if there is none
+// Probes larger than maxmtu are not waited for, they were rejected by our own kernel as too long, see reduce_mtu().
+static uint16_t mtu_probe_outstanding(const node_t *n) {
+	uint16_t len = 0;
+
+	for(int i = 0; i < PMTU_BURST; i++)
+		if(n->mtuprobe_len[i] > n->minmtu && n->mtuprobe_len[i] <= n->maxmtu && (!len || n->mtuprobe_len[i] < len))
+			len = n->mtuprobe_len[i];
+
+	return len;
+}
+
+static void start_mtu_search(meshlink_handle_t *mesh, node_t *n) {
+	n->pmtu_state = PMTU_BASE;
+	n->mtuprobes = 0;
+	n->minmtu = 0;
+	n->maxmtu = node_max_mtu(mesh, n);
+	memset(n->mtuprobe_len, 0, sizeof n->mtuprobe_len);
+	n->mtu_search_start = mesh->loop.now;
+}
+
+// Continue the search with the next round, or finish it if minmtu has reached maxmtu.
+static void next_mtu_probe_round(meshlink_handle_t *mesh, node_t *n) {
+	n->mtuprobes = 0;
+
+	if(n->minmtu < n->maxmtu) {
+		send_mtu_probe_round(mesh, n);
+		return;
+	}
+
+	struct timeval diff;
+	timersub(&mesh->loop.now, &n->mtu_search_start, &diff);
+
+	n->pmtu_state = PMTU_COMPLETE;
+	n->maxmtu = n->minmtu;
+	n->mtu = n->minmtu;
+	logger(mesh, MESHLINK_INFO, "Fixing MTU of %s (%s) to %d after %ld ms", n->name, n->hostname, n->mtu, (long)(diff.tv_sec * 1000 + diff.tv_usec / 1000));
+
+	// update meshlink and utcp for the mtu change
+	update_node_mtu(mesh, n);
+
+	timeout_set(&mesh->loop, &n->mtutimeout, &(struct timeval){mesh->pinginterval, rand() % 100000});
+}
+
 static void send_mtu_probe_handler(event_loop_t *loop, void *data) {
 	meshlink_handle_t *mesh = loop->data;
 	node_t *n = data;
-	int timeout = 1;
-
-	n->mtuprobes++;
 
 	if(!n->status.reachable || !n->status.validkey) {
 		logger(mesh, MESHLINK_INFO, "Trying to send MTU probe to unreachable or rekeying node %s (%s)", n->name, n->hostname);
+		n->pmtu_state = PMTU_IDLE;
 		n->mtuprobes = 0;
 		return;
 	}
 
-	if(n->mtuprobes > 32) {
-		if(!n->minmtu) {
-			n->mtuprobes = 31;
+	switch(n->pmtu_state) {
+	case PMTU_IDLE:
+		start_mtu_search(mesh, n);
+		/* fall through */
+
+	case PMTU_BASE: {
+		int timeout = 1;
+
+		if(++n->mtuprobes >= PMTU_BASE_ROUNDS) {
+			if(n->mtuprobes == PMTU_BASE_ROUNDS)
+				logger(mesh, MESHLINK_INFO, "No response to MTU probes from %s (%s)", n->name, n->hostname);
 			timeout = mesh->pinginterval;
-			goto end;
 		}
 
-		logger(mesh, MESHLINK_INFO, "%s (%s) did not respond to UDP ping, restarting PMTU discovery", n->name, n->hostname);
-		n->status.udp_confirmed = false;
-		n->mtuprobes = 1;
-		n->minmtu = 0;
-		n->maxmtu = sptps_maxmtu(&n->sptps);
+		send_mtu_probe_len(mesh, n, PMTU_BASE_SIZE);
+		send_mtu_probe_round(mesh, n);
 
-		// reduce mtu a bit as well
-		if(n->mtu > 1000)
-			n->mtu -= 100;
-	}
+		if(mesh->localdiscovery && n->prevedge && n->mtuprobes <= PMTU_BASE_ROUNDS) {
+			n->status.broadcast = true;
+			send_mtu_probe_len(mesh, n, PMTU_BASE_SIZE);
+			n->status.broadcast = false;
+		}
 
-	if(n->mtuprobes >= 10 && n->mtuprobes < 32 && !n->minmtu) {
-		logger(mesh, MESHLINK_INFO, "No response to MTU probes from %s (%s)", n->name, n->hostname);
-		n->mtuprobes = 31;
+		timeout_set(&mesh->loop, &n->mtutimeout, &(struct timeval){timeout, rand() % 100000});
+		break;
 	}
 
-	if(n->mtuprobes == 30 || (n->mtuprobes < 30 && n->minmtu >= n->maxmtu)) {
-		if(n->minmtu > n->maxmtu)
-			n->minmtu = n->maxmtu;
-		else
-			n->maxmtu = n->minmtu;
-		n->mtu = n->minmtu;
-		logger(mesh, MESHLINK_INFO, "Fixing MTU of %s (%s) to %d after %d probes", n->name, n->hostname, n->mtu, n->mtuprobes);
-		n->mtuprobes = 31;
+	case PMTU_SEARCHING: {
+		uint16_t len = mtu_probe_outstanding(n);
 
-		// update meshlink and utcp for the mtu change
-		update_node_mtu(mesh, n);
-	}
+		if(len && (n->mtuprobe_replies || ++n->mtuprobes >= PMTU_MAX_PROBES)) {
+			logger(mesh, MESHLINK_DEBUG, "No answer to MTU probe length %d from %s (%s)", len, n->name, n->hostname);
+			n->maxmtu = len - 1;
+		} else if(len) {
+			send_mtu_probe_round(mesh, n);
+			break;
+		}
 
-	if(n->mtuprobes == 31) {
-		timeout = mesh->pinginterval;
-		goto end;
-	} else if(n->mtuprobes == 32) {
-		timeout = mesh->pingtimeout;
+		next_mtu_probe_round(mesh, n);
+		break;
 	}
 
-	for(int i = 0; i < 4 + mesh->localdiscovery; i++) {
-		int len;
+	case PMTU_COMPLETE:
+		if(n->mtuprobes) {
+			logger(mesh, MESHLINK_INFO, "%s (%s) did not respond to UDP ping, restarting PMTU discovery", n->name, n->hostname);
+			n->status.udp_confirmed = false;
 
-		if(i == 0) {
-			if(n->mtuprobes < 30 || n->maxmtu + 8 >= sptps_maxmtu(&n->sptps))
-				continue;
-			len = n->maxmtu + 8;
-		} else if(n->maxmtu <= n->minmtu) {
-			len = n->maxmtu;
-		} else {
-			len = n->minmtu + 1 + rand() % (n->maxmtu - n->minmtu);
-		}
+			// reduce mtu a bit as well
+			if(n->mtu > 1000)
+				n->mtu -= 100;
 
-		if(len < 64)
-			len = 64;
+			start_mtu_search(mesh, n);
+			send_mtu_probe_handler(loop, n);
+			break;
+		}
 
-		vpn_packet_t packet;
-		packet.probe = true;
-		memset(packet.data, 0, 14);
-		randomize(packet.data + 14, len - 14);
-		packet.len = len;
-		n->status.broadcast = i >= 4 && n->mtuprobes <= 10 && n->prevedge;
+		n->mtuprobes = 1;
+		send_mtu_probe_len(mesh, n, n->mtu);
 
-		logger(mesh, MESHLINK_DEBUG, "Sending MTU probe length %d to %s (%s)", len, n->name, n->hostname);
+		if(n->maxmtu < node_max_mtu(mesh, n))
+			send_mtu_probe_len(mesh, n, node_max_mtu(mesh, n));
 
-		if(0 != send_udppacket(mesh, n, &packet)) {
-			logger(mesh, MESHLINK_WARNING, "Sending MTU probe with length %d to %s (%s) failed", len, n->name, n->hostname);
-		}
+		timeout_set(&mesh->loop, &n->mtutimeout, &(struct timeval){mesh->pingtimeout, rand() % 100000});
+		break;
 	}
-
-	n->status.broadcast = false;
-
-end:
-	timeout_set(&mesh->loop, &n->mtutimeout, &(struct timeval){timeout, rand() % 100000});
 }
 
 void send_mtu_probe(meshlink_handle_t *mesh, node_t *n) {
+	// keep going with a discovery that is already in progress, for example after renewing the keys
+	if(n->pmtu_state != PMTU_IDLE)
+		return;
+
 	timeout_add(&mesh->loop, &n->mtutimeout, send_mtu_probe_handler, n, &(struct timeval){1, 0});
 	send_mtu_probe_handler(&mesh->loop, n);
 }
@@ -173,100 +372,102 @@ static void mtu_probe_h(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet
 			logger(mesh, MESHLINK_WARNING, "Sending MTU probe reply with length %d to %s (%s) failed", packet->len, n->name, n->hostname);
 		}
 		n->status.udp_confirmed = udp_confirmed;
-	} else {
-		/* It's a valid reply: now we know bidirectional communication
-		   is possible using the address and socket that the reply
-		   packet used. */
+		return;
+	}
 
-		n->status.udp_confirmed = true;
+	/* It's a valid reply: now we know bidirectional communication
+	   is possible using the address and socket that the reply
+	   packet used. */
 
-		/* If we haven't established the PMTU yet, restart the discovery process. */
+	if(!n->status.udp_confirmed)
+		udp_candidate_replied(mesh, n);
 
-		if(n->mtuprobes > 30) {
-			if (len == n->maxmtu + 8) {
-				logger(mesh, MESHLINK_INFO, "Increase in PMTU to %s (%s) detected, restarting PMTU discovery", n->name, n->hostname);
-				n->maxmtu = sptps_maxmtu(&n->sptps);
-				n->mtuprobes = 10;
-				return;
-			}
+	n->status.udp_confirmed = true;
 
-			if(n->minmtu)
-				n->mtuprobes = 30;
-			else
-				n->mtuprobes = 1;
-		}
+	/* Update the round trip time, if the reply is to one of our timestamped probes. */
+
+	uint32_t sent[2];
+	memcpy(sent, packet->data + 2, sizeof sent);
 
-		/* If applicable, raise the minimum supported MTU */
+	if(sent[0]) {
+		struct timeval tv = {ntohl(sent[0]), ntohl(sent[1])}, diff;
+		timersub(&mesh->loop.now, &tv, &diff);
+		int rtt = diff.tv_sec * 1000000 + diff.tv_usec;
 
-		if(len > n->maxmtu)
-			len = n->maxmtu;
-		if(n->minmtu < len)
-			n->minmtu = len;
+		if(rtt >= 0 && diff.tv_sec < 60)
+			n->mturtt = n->mturtt < 0 ? rtt : (n->mturtt * 7 + rtt) / 8;
+	}
+
+	if(n->pmtu_state == PMTU_IDLE)
+		return;
 
-		// raise mtu along with the minmtu
-		if(n->mtu < n->minmtu) {
-			n->mtu = n->minmtu;
+	/* Raise the minimum supported MTU. A reply larger than what we thought was possible means the PMTU increased. */
 
-			// update meshlink and utcp for the mtu change
-			update_node_mtu(mesh, n);
+	if(len > n->maxmtu) {
+		if(n->pmtu_state == PMTU_COMPLETE)
+			logger(mesh, MESHLINK_INFO, "Increase in PMTU to %s (%s) detected, restarting PMTU discovery", n->name, n->hostname);
+		n->maxmtu = node_max_mtu(mesh, n);
+		if(n->pmtu_state == PMTU_COMPLETE) {
+			n->pmtu_state = PMTU_SEARCHING;
+			n->mtu_search_start = mesh->loop.now;
 		}
 	}
-}
 
-static uint16_t compress_packet(uint8_t *dest, const uint8_t *source, uint16_t len, int level) {
-	if(level == 0) {
-		memcpy(dest, source, len);
-		return len;
-	} else if(level == 10) {
-		return -1;
-	} else if(level < 10) {
-#ifdef HAVE_ZLIB
-		unsigned long destlen = MAXSIZE;
-		if(compress2(dest, &destlen, source, len, level) == Z_OK)
-			return destlen;
-		else
-#endif
-			return -1;
-	} else {
-		return -1;
-	}
+	if(n->minmtu < len)
+		n->minmtu = len;
 
-	return -1;
-}
+	// raise mtu along with the minmtu
+	if(n->mtu < n->minmtu) {
+		n->mtu = n->minmtu;
 
-static uint16_t uncompress_packet(uint8_t *dest, const uint8_t *source, uint16_t len, int level) {
-	if(level == 0) {
-		memcpy(dest, source, len);
-		return len;
-	} else if(level > 9) {
-			return -1;
-	}
-#ifdef HAVE_ZLIB
-	else {
-		unsigned long destlen = MAXSIZE;
-		if(uncompress(dest, &destlen, source, len) == Z_OK)
-			return destlen;
-		else
-			return -1;
+		// update meshlink and utcp for the mtu change
+		update_node_mtu(mesh, n);
 	}
-#endif
 
-	return -1;
+	switch(n->pmtu_state) {
+	case PMTU_BASE:
+		// UDP works, start searching right away
+		n->pmtu_state = PMTU_SEARCHING;
+		next_mtu_probe_round(mesh, n);
+		break;
+
+	case PMTU_SEARCHING:
+		for(int i = 0; i < PMTU_BURST; i++) {
+			if(n->mtuprobe_len[i] == len) {
+				n->mtuprobe_len[i] = 0;
+				n->mtuprobe_replies++;
+			}
+		}
+
+		// Don't wait for the round to time out if there are no probes left that could still be answered
+		if(!mtu_probe_outstanding(n))
+			next_mtu_probe_round(mesh, n);
+		break;
+
+	case PMTU_COMPLETE:
+		// The path still works, check again after pinginterval
+		n->mtuprobes = 0;
+		timeout_set(&mesh->loop, &n->mtutimeout, &(struct timeval){mesh->pinginterval, rand() % 100000});
+		break;
+
+	default:
+		break;
+	}
 }
 
 /* VPN packet I/O */
 
-static void receive_packet(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet) {
+static void receive_packet(meshlink_handle_t *mesh, node_t *n, const uint8_t *data, uint16_t len) {
 	logger(mesh, MESHLINK_DEBUG, "Received packet of %d bytes from %s (%s)",
-			   packet->len, n->name, n->hostname);
+			   len, n->name, n->hostname);
 
     if (n->status.blacklisted) {
         logger(mesh, MESHLINK_WARNING, "Dropping packet from blacklisted node %s", n->name);
     } else {
 		n->in_packets++;
-		n->in_bytes += packet->len;
+		n->in_bytes += len;
 
-		int err = route(mesh, n, packet);
+		int err = route_data(mesh, n, data, len);
 	    if(err) {
 	        logger(mesh, MESHLINK_ERROR, "receive_packet() route failed with err=%d.\n", err);
 	    }
@@ -287,20 +488,95 @@ static void receive_udppacket(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *
 		}
 		return;
 	}
-	sptps_receive_data(&n->sptps, inpkt->data, inpkt->len);
+	// decrypt in place, so the payload can be passed on without copying it
+	sptps_receive_datagram(&n->sptps, inpkt->data, inpkt->len);
 }
 
-void receive_tcppacket(meshlink_handle_t *mesh, connection_t *c, const char *buffer, int len) {
-	vpn_packet_t outpkt;
+#ifdef HAVE_RECVMMSG
+// Receive a number of packets from the same node, decrypting them together
+static void receive_udppackets(meshlink_handle_t *mesh, node_t *n, vpn_packet_t **inpkts, int count) {
+	if(count == 1 || !n->sptps.state) {
+		for(int i = 0; i < count; i++)
+			receive_udppacket(mesh, n, inpkts[i]);
+		return;
+	}
+
+	void *data[count];
+	size_t len[count];
+
+	for(int i = 0; i < count; i++) {
+		data[i] = inpkts[i]->data;
+		len[i] = inpkts[i]->len;
+	}
+
+	sptps_receive_datagrams(&n->sptps, data, len, count);
+}
+#endif
 
-	if(len > sizeof outpkt.data)
+void receive_tcppacket(meshlink_handle_t *mesh, connection_t *c, const char *buffer, int len) {
+	if(len > MAXSIZE)
 		return;
 
-	outpkt.len = len;
-	outpkt.tcp = true;
-	memcpy(outpkt.data, buffer, len);
+	receive_packet(mesh, c->node, (const uint8_t *)buffer, len);
+}
+
+// Time in nanoseconds, only used to measure how long something takes.
+static uint64_t nsec_now(void) {
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+/* Compressing packets that do not get smaller, like media or data that is already encrypted, only wastes CPU time.
+   Once the average compressed size goes above COMPRESS_RATIO_THRESHOLD, only one in so many packets is tried.
+   The interval doubles every time the sample still does not compress, up to COMPRESS_BACKOFF_MAX packets,
+   and is reset as soon as one does. */
+
+#define COMPRESS_RATIO_THRESHOLD 240    /* in 1/256ths, saving less than 1/16th is not worth it */
+#define COMPRESS_BACKOFF_MAX 256
+
+void reset_compression(node_t *n) {
+	n->compress_ratio = COMPRESS_RATIO_THRESHOLD;
+	n->compress_backoff = 0;
+	n->compress_skip = 0;
+}
+
+static bool want_compression(node_t *n) {
+	if(!n->compress_skip)
+		return true;
+
+	n->compress_skip--;
+	n->compress_skipped++;
+	return false;
+}
+
+static void update_compression(node_t *n, uint16_t len, int clen) {
+	unsigned int ratio = clen < len ? clen * 256 / len : 256;
+
+	n->compress_tried++;
+	n->compress_bytes_in += len;
+	n->compress_bytes_out += clen < len ? clen : len;
+
+	// While backing off, the sample replaces the average, so we notice right away when the data compresses again.
+	if(n->compress_backoff)
+		n->compress_ratio = ratio;
+	else
+		n->compress_ratio = (n->compress_ratio * 7 + ratio) / 8;
 
-	receive_packet(mesh, c->node, &outpkt);
+	if(n->compress_ratio > COMPRESS_RATIO_THRESHOLD) {
+		n->compress_backoff = n->compress_backoff ? n->compress_backoff * 2 : 1;
+		if(n->compress_backoff > COMPRESS_BACKOFF_MAX)
+			n->compress_backoff = COMPRESS_BACKOFF_MAX;
+		n->compress_skip = n->compress_backoff;
+	} else {
+		n->compress_backoff = 0;
+	}
 }
 
 // @return the sockerrno, 0 on success, -1 on other errors
@@ -325,23 +601,67 @@ static int send_sptps_packet(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *o
 		return sptps_send_record(&n->sptps, PKT_PROBE, origpkt->data, origpkt->len);
 	}
 
-	vpn_packet_t outpkt;
+	uint8_t *data = origpkt->data;
+	uint16_t len = origpkt->len;
+
+	// If the destination understands it, replace the node names with a compact header.
+	// It is written over the end of the original header, which is restored afterwards
+	// since the same packet might be sent again.
+	const size_t skip = sizeof(meshlink_packethdr_t) - sizeof(meshlink_compacthdr_t);
+	uint8_t saved[sizeof(meshlink_compacthdr_t)];
+	bool compact = (n->options & OPTION_COMPACT_HEADER) && len >= sizeof(meshlink_packethdr_t) && data[0];
+
+	if(compact) {
+		data += skip;
+		len -= skip;
+		memcpy(saved, data, sizeof saved);
+
+		meshlink_compacthdr_t hdr = {.destination = htons(NODE_INDEX_SELF)};
+		memcpy(data, &hdr, sizeof hdr);
+	}
 
-	if(n->outcompression) {
-		int len = compress_packet(outpkt.data, origpkt->data, origpkt->len, n->outcompression);
-		if(len < 0) {
+	// If we are allowed to overwrite the buffer, encrypt in place to avoid another copy.
+	uint8_t *end = origpkt->data + mesh->maxsize;
+	bool inplace = origpkt->disposable;
+
+	int level = compression_usable_level(mesh->compression, n->outcompression, n->dictid);
+
+	if(level && want_compression(n)) {
+		vpn_packet_t *outpkt = scratch_packet(mesh, SCRATCH_COMPRESS);
+		uint64_t begin = nsec_now();
+		int clen = compress_packet(mesh->compression, outpkt->data, mesh->maxsize, data, len, level);
+		n->compress_nsec += nsec_now() - begin;
+
+		if(clen < 0) {
 			logger(mesh, MESHLINK_ERROR, "Error while compressing packet to %s (%s)", n->name, n->hostname);
-		} else if(len < origpkt->len) {
-			outpkt.len = len;
-			origpkt = &outpkt;
+			clen = len;
+		}
+
+		update_compression(n, len, clen);
+
+		if(clen < len) {
+			data = outpkt->data;
+			len = clen;
 			type |= PKT_COMPRESSED;
+			end = outpkt->data + mesh->maxsize;
+			inplace = true;
 		}
 	}
 
-	return sptps_send_record(&n->sptps, type, origpkt->data, origpkt->len);
+	int result;
+
+	if(inplace && data + len + SPTPS_TAILROOM <= end)
+		result = sptps_send_record_inplace(&n->sptps, type, data, len);
+	else
+		result = sptps_send_record(&n->sptps, type, data, len);
+
+	if(compact && !origpkt->disposable)
+		memcpy(origpkt->data + skip, saved, sizeof saved);
+
+	return result;
 }
 
-static void choose_udp_address(meshlink_handle_t *mesh, const node_t *n, const sockaddr_t **sa, int *sock) {
+static void choose_udp_address(meshlink_handle_t *mesh, node_t *n, const sockaddr_t **sa, int *sock) {
 	/* Latest guess */
 	*sa = &n->address;
 	*sock = n->sock;
@@ -350,68 +670,31 @@ static void choose_udp_address(meshlink_handle_t *mesh, const node_t *n, const s
 	if(n->status.udp_confirmed)
 		return;
 
-	/* Send every third packet to n->address; that could be set
-	   to the node's reflexive UDP address discovered during key
-	   exchange. */
+	if(!n->status.udp_candidates)
+		update_udp_candidates(mesh, n);
 
-	static int x = 0;
-	if(++x >= 3) {
-		x = 0;
+	if(!n->udp_candidates)
 		return;
-	}
 
-	/* Otherwise, address are found in edges to this node.
-	   So we pick a random edge and a random socket. */
+	/* Send every other packet to the address that answered fastest before,
+	   and otherwise go through all candidates in turn. */
 
-	int i = 0;
-	int j = rand() % n->edge_tree->count;
-	edge_t *candidate = NULL;
+	udp_candidate_t *c;
 
-	for splay_each(edge_t, e, n->edge_tree) {
-		if(i++ == j) {
-			candidate = e->reverse;
-			break;
-		}
-	}
-
-	if(candidate) {
-		*sa = &candidate->address;
-		*sock = rand() % mesh->listen_sockets;
-	}
-
-	/* Make sure we have a suitable socket for the chosen address */
-	if(mesh->listen_socket[*sock].sa.sa.sa_family != (*sa)->sa.sa_family) {
-		for(int i = 0; i < mesh->listen_sockets; i++) {
-			if(mesh->listen_socket[i].sa.sa.sa_family == (*sa)->sa.sa_family) {
-				*sock = i;
-				break;
-			}
-		}
+	if(n->udp_candidate_best >= 0 && (n->udp_choice++ & 1)) {
+		c = &n->udp_candidate[n->udp_candidate_best];
+	} else {
+		c = &n->udp_candidate[n->udp_candidate_next++];
+		if(n->udp_candidate_next >= n->udp_candidates)
+			n->udp_candidate_next = 0;
 	}
 
-    if(mesh->listen_socket[*sock].sa.sa.sa_family != (*sa)->sa.sa_family) {
-        /// fails when during setup no matching socket could be created or bound
-        logger(mesh, MESHLINK_ERROR, "choose_udp_address: No matching socket for sa_family=%d available.", (*sa)->sa.sa_family);
-    }
+	c->last_sent = mesh->loop.now;
+	*sa = &c->address;
+	*sock = c->sock;
 }
 
 static void choose_broadcast_address(meshlink_handle_t *mesh, const node_t *n, const sockaddr_t **sa, int *sock) {
-	static sockaddr_t broadcast_ipv4 = {
-		.in = {
-			.sin_family = AF_INET,
-			.sin_addr.s_addr = -1,
-		}
-	};
-
-	static sockaddr_t broadcast_ipv6 = {
-		.in6 = {
-			.sin6_family = AF_INET6,
-			.sin6_addr.s6_addr[0x0] = 0xff,
-			.sin6_addr.s6_addr[0x1] = 0x02,
-			.sin6_addr.s6_addr[0xf] = 0x01,
-		}
-	};
-
 	*sock = rand() % mesh->listen_sockets;
 
 	if(mesh->listen_socket[*sock].sa.sa.sa_family == AF_INET6) {
@@ -419,17 +702,25 @@ static void choose_broadcast_address(meshlink_handle_t *mesh, const node_t *n, c
 			mesh->localdiscovery_address.in6.sin6_port = n->prevedge->address.in.sin_port;
 			*sa = &mesh->localdiscovery_address;
 		} else {
-			broadcast_ipv6.in6.sin6_port = n->prevedge->address.in.sin_port;
-			broadcast_ipv6.in6.sin6_scope_id = mesh->listen_socket[*sock].sa.in6.sin6_scope_id;
-			*sa = &broadcast_ipv6;
+			memset(&mesh->broadcast_address, 0, sizeof mesh->broadcast_address);
+			mesh->broadcast_address.in6.sin6_family = AF_INET6;
+			mesh->broadcast_address.in6.sin6_addr.s6_addr[0x0] = 0xff;
+			mesh->broadcast_address.in6.sin6_addr.s6_addr[0x1] = 0x02;
+			mesh->broadcast_address.in6.sin6_addr.s6_addr[0xf] = 0x01;
+			mesh->broadcast_address.in6.sin6_port = n->prevedge->address.in.sin_port;
+			mesh->broadcast_address.in6.sin6_scope_id = mesh->listen_socket[*sock].sa.in6.sin6_scope_id;
+			*sa = &mesh->broadcast_address;
 		}
 	} else {
 		if(mesh->localdiscovery_address.sa.sa_family == AF_INET) {
 			mesh->localdiscovery_address.in.sin_port = n->prevedge->address.in.sin_port;
 			*sa = &mesh->localdiscovery_address;
 		} else {
-			broadcast_ipv4.in.sin_port = n->prevedge->address.in.sin_port;
-			*sa = &broadcast_ipv4;
+			memset(&mesh->broadcast_address, 0, sizeof mesh->broadcast_address);
+			mesh->broadcast_address.in.sin_family = AF_INET;
+			mesh->broadcast_address.in.sin_addr.s_addr = -1;
+			mesh->broadcast_address.in.sin_port = n->prevedge->address.in.sin_port;
+			*sa = &mesh->broadcast_address;
 		}
 	}
 }
@@ -444,6 +735,242 @@ static int send_udppacket(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *orig
 	return send_sptps_packet(mesh, n, origpkt);
 }
 
+// lessen the mtu to at least one less than the length of a packet that was reported to be too long
+// this is how probes larger than the local link MTU are found out about, without waiting for them to time out
+static void reduce_mtu(meshlink_handle_t *mesh, node_t *to, size_t len) {
+	// len is the size of the datagram, the MTUs are about the payload
+	if(len <= sptps_overhead(&to->sptps))
+		return;
+	len -= sptps_overhead(&to->sptps);
+
+	if(to->minmtu >= len)
+		to->minmtu = len - 1;
+	if(to->maxmtu >= len)
+		to->maxmtu = len - 1;
+	if(to->mtu >= len) {
+		to->mtu = len - 1;
+		// update meshlink and utcp for the mtu change
+		update_node_mtu(mesh, to);
+	}
+}
+
+#ifdef HAVE_SENDMMSG
+/* UDP packets to a node, collected during one event loop iteration to be sent with as few system calls as possible */
+struct udp_tx_batch {
+	int count;
+	uint16_t maxsize;               /* room for each packet, the mesh's maxsize when the batch was allocated */
+	int sock[UDP_SEND_BATCH];
+	sockaddr_t sa[UDP_SEND_BATCH];
+	uint16_t len[UDP_SEND_BATCH];
+	uint8_t data[];                 /* UDP_SEND_BATCH packets of maxsize bytes */
+};
+
+static uint8_t *udp_batch_data(struct udp_tx_batch *batch, int i) {
+	return batch->data + (size_t)i * batch->maxsize;
+}
+
+// only batch packets sent from the event loop, which flushes them before waiting for new events
+// packets sent by the application's threads would otherwise be held up until the next wakeup
+static bool udp_batching(meshlink_handle_t *mesh) {
+	return mesh->threadstarted && pthread_equal(pthread_self(), mesh->thread);
+}
+
+// log a failed send of a batched packet, and lessen the mtu if it was too long
+static void udp_batch_error(meshlink_handle_t *mesh, node_t *to, size_t len, int err) {
+	logger(mesh, MESHLINK_WARNING, "Error sending UDP SPTPS packet to %s (%s): %s", to->name, to->hostname, sockstrerror(err));
+
+	if(sockmsgsize(err))
+		reduce_mtu(mesh, to, len);
+}
+
+#ifdef UDP_SEGMENT
+// send the whole batch as one UDP GSO super-packet, the kernel splits it up in segments of the first packet's size
+// only possible if all packets go to the same address over the same socket, none but the last is shorter,
+// and together they still fit in a single IPv6 datagram
+static bool udp_batch_gso_possible(const struct udp_tx_batch *batch) {
+	if(batch->count < 2)
+		return false;
+
+	size_t total = batch->len[0];
+
+	for(int i = 1; i < batch->count; i++) {
+		if(batch->sock[i] != batch->sock[0] || sockaddrcmp(&batch->sa[i], &batch->sa[0]))
+			return false;
+		if(batch->len[i] > batch->len[0] || (batch->len[i] < batch->len[0] && i != batch->count - 1))
+			return false;
+		total += batch->len[i];
+	}
+
+	return total <= 0xffff - 40 - 8;
+}
+
+// @return the sockerrno, 0 on success
+static int udp_batch_send_gso(meshlink_handle_t *mesh, struct udp_tx_batch *batch) {
+	struct iovec iov[UDP_SEND_BATCH];
+	char control[CMSG_SPACE(sizeof(uint16_t))] = "";
+	struct msghdr msg = {
+		.msg_name = &batch->sa[0].sa,
+		.msg_namelen = SALEN(batch->sa[0].sa),
+		.msg_iov = iov,
+		.msg_iovlen = batch->count,
+		.msg_control = control,
+		.msg_controllen = sizeof control,
+	};
+
+	for(int i = 0; i < batch->count; i++) {
+		iov[i].iov_base = udp_batch_data(batch, i);
+		iov[i].iov_len = batch->len[i];
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	uint16_t segment = batch->len[0];
+	memcpy(CMSG_DATA(cmsg), &segment, sizeof segment);
+
+	if(sendmsg(mesh->listen_socket[batch->sock[0]].udp.fd, &msg, 0) < 0)
+		return sockerrno;
+
+	batch->count = 0;
+	return 0;
+}
+#endif
+
+// send out all packets batched for a node
+// packets that could not be sent because the socket would block are kept to be retried once it is writable
+// @return the sockerrno of the first packet that would block, 0 otherwise
+static int flush_udp_batch(meshlink_handle_t *mesh, node_t *to) {
+	struct udp_tx_batch *batch = to->txbatch;
+
+	if(!batch || !batch->count)
+		return 0;
+
+#ifdef UDP_SEGMENT
+	if(!mesh->udp_gso_disabled && udp_batch_gso_possible(batch)) {
+		int err = udp_batch_send_gso(mesh, batch);
+		if(!err)
+			return 0;
+
+		if(sockwouldblock(err)) {
+			io_set(&mesh->loop, &mesh->listen_socket[batch->sock[0]].udp, IO_READ | IO_WRITE);
+			return err;
+		}
+
+		// the socket or the network device does not support GSO, don't try again
+		// EINVAL only means this batch did not suit the kernel, for example too many segments for the path
+		if(err == EIO || err == ENOPROTOOPT || err == EOPNOTSUPP) {
+			logger(mesh, MESHLINK_INFO, "UDP segmentation offload not available: %s", sockstrerror(err));
+			mesh->udp_gso_disabled = true;
+		}
+
+		// fall back to sending them one by one, which also finds out which ones are too long
+	}
+#endif
+
+	struct mmsghdr msg[UDP_SEND_BATCH];
+	struct iovec iov[UDP_SEND_BATCH];
+	int done = 0;
+
+	while(done < batch->count) {
+		// sendmmsg() can only send to one socket at a time, collect the run of packets for the next one
+		int sock = batch->sock[done];
+		int n = 0;
+
+		for(int i = done; i < batch->count && batch->sock[i] == sock; i++, n++) {
+			iov[n].iov_base = udp_batch_data(batch, i);
+			iov[n].iov_len = batch->len[i];
+			msg[n].msg_hdr = (struct msghdr) {
+				.msg_name = &batch->sa[i].sa,
+				.msg_namelen = SALEN(batch->sa[i].sa),
+				.msg_iov = &iov[n],
+				.msg_iovlen = 1,
+			};
+		}
+
+		int sent = sendmmsg(mesh->listen_socket[sock].udp.fd, msg, n, 0);
+
+		if(sent > 0) {
+			done += sent;
+			continue;
+		}
+
+		int err = sockerrno;
+
+		if(sockwouldblock(err)) {
+			logger(mesh, MESHLINK_DEBUG, "Warning sending UDP SPTPS packet to %s (%s): %s", to->name, to->hostname, sockstrerror(err));
+
+			// keep the rest and get notified when there is room in the send buffer again
+			batch->count -= done;
+			memmove(batch->sock, batch->sock + done, batch->count * sizeof *batch->sock);
+			memmove(batch->sa, batch->sa + done, batch->count * sizeof *batch->sa);
+			memmove(batch->len, batch->len + done, batch->count * sizeof *batch->len);
+			memmove(batch->data, udp_batch_data(batch, done), (size_t)batch->count * batch->maxsize);
+			io_set(&mesh->loop, &mesh->listen_socket[sock].udp, IO_READ | IO_WRITE);
+			return err;
+		}
+
+		// drop the packet that failed and continue with the next one
+		udp_batch_error(mesh, to, batch->len[done], err);
+		done++;
+	}
+
+	batch->count = 0;
+	return 0;
+}
+
+// add a packet to the node's batch, sending out the batch first if it is full
+// @return the sockerrno, 0 on success
+static int send_udp_batched(meshlink_handle_t *mesh, node_t *to, int sock, const sockaddr_t *sa, const void *data, size_t len) {
+	// the maximum packet size might have changed while the mesh was stopped
+	if(to->txbatch && to->txbatch->maxsize != mesh->maxsize) {
+		free(to->txbatch);
+		to->txbatch = NULL;
+	}
+
+	if(!to->txbatch) {
+		to->txbatch = xzalloc(sizeof *to->txbatch + (size_t)UDP_SEND_BATCH * mesh->maxsize);
+		to->txbatch->maxsize = mesh->maxsize;
+	}
+
+	struct udp_tx_batch *batch = to->txbatch;
+
+	if(batch->count == UDP_SEND_BATCH) {
+		int err = flush_udp_batch(mesh, to);
+		if(batch->count == UDP_SEND_BATCH)
+			return err;
+	}
+
+	batch->sock[batch->count] = sock;
+	memcpy(&batch->sa[batch->count], sa, sizeof *sa);
+	batch->len[batch->count] = len;
+	memcpy(udp_batch_data(batch, batch->count), data, len);
+	batch->count++;
+
+	if(!to->status.udp_pending) {
+		to->status.udp_pending = true;
+		list_insert_tail(mesh->udp_pending, to);
+	}
+
+	return 0;
+}
+#endif
+
+// send out the UDP packets batched during this event loop iteration
+void flush_udp_batches(meshlink_handle_t *mesh) {
+#ifdef HAVE_SENDMMSG
+	for list_each(node_t, n, mesh->udp_pending) {
+		flush_udp_batch(mesh, n);
+
+		// nodes whose packets would block stay until the socket is writable again
+		if(!n->txbatch || !n->txbatch->count) {
+			n->status.udp_pending = false;
+			list_delete_node(mesh->udp_pending, node);
+		}
+	}
+#endif
+}
+
 // @return the sockerrno, 0 on success, -1 on other errors
 int send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 	node_t *to = handle;
@@ -456,10 +983,10 @@ int send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 		char buf[len * 4 / 3 + 5];
 		b64encode(data, buf, len);
 		/* If no valid key is known yet, send the packets using ANS_KEY requests,
-		   to ensure we get to learn the reflexive UDP address. */
+		   to ensure we get to learn the reflexive UDP address.
+		   The unused digest field carries the ID of our compression dictionary. */
 		if(!to->status.validkey) {
-			to->incompression = mesh->self->incompression;
-			return send_request(mesh, to->nexthop->connection, "%d %s %s %s -1 -1 -1 %d", ANS_KEY, mesh->self->name, to->name, buf, to->incompression);
+			return send_request(mesh, to->nexthop->connection, "%d %s %s %s -1 %d -1 %d", ANS_KEY, mesh->self->name, to->name, buf, compression_dictionary_id(mesh->compression), to->incompression);
 		} else {
 			return send_request(mesh, to->nexthop->connection, "%d %s %s %d %s", REQ_KEY, mesh->self->name, to->name, REQ_SPTPS, buf);
 		}
@@ -467,6 +994,10 @@ int send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 
 	/* Otherwise, send the packet via UDP */
 
+	// Pretend it was sent if it would not fit through the simulated path MTU, see devtool_set_udp_drop_size()
+	if(mesh->udp_drop_size && len > mesh->udp_drop_size)
+		return 0;
+
 	const sockaddr_t *sa;
 	int sock;
 
@@ -475,6 +1006,12 @@ int send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 	else
 		choose_udp_address(mesh, to, &sa, &sock);
 
+#ifdef HAVE_SENDMMSG
+	// relayed packets that came in over TCP can be larger than the batch has room for
+	if(udp_batching(mesh) && len <= mesh->maxsize)
+		return send_udp_batched(mesh, to, sock, sa, data, len);
+#endif
+
 	int err = 0;
 	int sent = sendto(mesh->listen_socket[sock].udp.fd, data, len, 0, &sa->sa, SALEN(sa->sa));
 	if(sent != len) {
@@ -489,20 +1026,16 @@ int send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 		
 		if(sockwouldblock(err)) {
 			logger(mesh, MESHLINK_DEBUG, "Warning sending UDP SPTPS packet to %s (%s): %s", to->name, to->hostname, sockstrerror(err));
+
+			// get notified when there is room in the send buffer again
+			io_set(&mesh->loop, &mesh->listen_socket[sock].udp, IO_READ | IO_WRITE);
 		}
 		else {
 			logger(mesh, MESHLINK_WARNING, "Error sending UDP SPTPS packet to %s (%s): %s", to->name, to->hostname, sockstrerror(err));
 
 			// if message is reported to be too long, lessen mtu to at least one less than the failed length
-			if(sockmsgsize(err)) {
-				if(to->maxmtu >= len)
-					to->maxmtu = len - 1;
-				if(to->mtu >= len) {
-					to->mtu = len - 1;
-					// update meshlink and utcp for the mtu change
-					update_node_mtu(mesh, to);
-				}
-			}
+			if(sockmsgsize(err))
+				reduce_mtu(mesh, to, len);
 		}
 	}
 
@@ -514,6 +1047,9 @@ bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t
 	meshlink_handle_t *mesh = from->mesh;
 
 	if(type == SPTPS_HANDSHAKE) {
+		// we got new receive keys, and with that a new session ID
+		update_node_sessionid(mesh, from);
+
 		if(!from->status.validkey) {
 			from->status.validkey = true;
 			from->status.waitingforkey = false;
@@ -527,16 +1063,22 @@ bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t
 		return false;
 	}
 
-	vpn_packet_t inpkt;
+	vpn_packet_t *inpkt = scratch_packet(mesh, SCRATCH_RECORD);
 
 	if(type == PKT_PROBE) {
-		inpkt.len = len;
-		inpkt.probe = true;
-		memcpy(inpkt.data, data, len);
-		mtu_probe_h(mesh, from, &inpkt, len);
+		// probes larger than the packets we receive over UDP can only have come over TCP
+		if(len > mesh->maxsize) {
+			logger(mesh, MESHLINK_WARNING, "Dropping MTU probe of %d bytes from %s (%s)", len, from->name, from->hostname);
+			return true;
+		}
+
+		inpkt->len = len;
+		inpkt->probe = true;
+		memcpy(inpkt->data, data, len);
+		mtu_probe_h(mesh, from, inpkt, len);
 		return true;
 	} else {
-		inpkt.probe = false;
+		inpkt->probe = false;
 	}
 
 	if(type & ~(PKT_COMPRESSED)) {
@@ -545,23 +1087,23 @@ bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t
 	}
 
 	if(type & PKT_COMPRESSED) {
-		uint16_t ulen = uncompress_packet(inpkt.data, (const uint8_t *)data, len, from->incompression);
-		if(ulen < 0) {
-			logger(mesh, MESHLINK_ERROR, "receive_sptps_record() uncompress_packet len < 0! ulen=%u", (unsigned int)ulen);
+		// It was compressed with the dictionary we had before it was changed, we cannot uncompress it anymore.
+		if(!compression_usable_level(mesh->compression, from->incompression, from->dictid)) {
+			logger(mesh, MESHLINK_DEBUG, "Dropping %s packet from %s (%s) until the compression dictionary is renegotiated", compression_name(from->incompression), from->name, from->hostname);
 			return false;
-		} else {
-			inpkt.len = ulen;
 		}
-		if(inpkt.len > MAXSIZE) {
-			logger(mesh, MESHLINK_ERROR, "Error: SPTPS uncompressed packet len %d > MAXSIZE %d", inpkt.len, MAXSIZE);
+
+		int ulen = uncompress_packet(mesh->compression, inpkt->data, mesh->maxsize, (const uint8_t *)data, len, from->incompression);
+		if(ulen < 0) {
+			logger(mesh, MESHLINK_ERROR, "Error while uncompressing %s packet from %s (%s)", compression_name(from->incompression), from->name, from->hostname);
 			return false;
 		}
+		inpkt->len = ulen;
+		receive_packet(mesh, from, inpkt->data, inpkt->len);
 	} else {
-		memcpy(inpkt.data, data, len);
-		inpkt.len = len;
+		receive_packet(mesh, from, data, len);
 	}
 
-	receive_packet(mesh, from, &inpkt);
 	return true;
 }
 
@@ -589,6 +1131,14 @@ int send_packet(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet) {
 	n->out_packets++;
 	n->out_bytes += packet->len;
 
+	// If the path MTU is due to be checked soon, do it now, so the probes share the sendmmsg() batch with this packet.
+	if(n->pmtu_state == PMTU_COMPLETE && !n->mtuprobes && n->mtutimeout.cb) {
+		struct timeval diff;
+		timersub(&n->mtutimeout.tv, &mesh->loop.now, &diff);
+		if(diff.tv_sec < PMTU_PIGGYBACK)
+			send_mtu_probe_handler(&mesh->loop, n);
+	}
+
 	return send_sptps_packet(mesh, n, packet);
 }
 
@@ -619,14 +1169,28 @@ void broadcast_packet(meshlink_handle_t *mesh, const node_t *from, vpn_packet_t
 static node_t *try_harder(meshlink_handle_t *mesh, const sockaddr_t *from, const vpn_packet_t *pkt) {
 	node_t *n = NULL;
 	bool hard = false;
-	static time_t last_hard_try = 0;
+	uint32_t sessionid;
+
+	// Peers that support it tell us which session the packet belongs to
+	if(sptps_datagram_sessionid(pkt->data, pkt->len, &sessionid)) {
+		n = lookup_node_sessionid(mesh, sessionid);
+
+		if(n && n->status.reachable && n->sptps.sessionids && n->sptps.insessionid == sessionid && try_mac(mesh, n, pkt))
+			return n;
+
+		n = NULL;
+	}
 
 	for splay_each(edge_t, e, mesh->edges) {
 		if(!e->to->status.reachable || e->to == mesh->self)
 			continue;
 
+		// we would have found it above, unless another node with the same session ID took its place in the cache
+		if(e->to->sptps.sessionids && e->to->sessionid == e->to->sptps.insessionid && lookup_node_sessionid(mesh, e->to->sessionid) == e->to)
+			continue;
+
 		if(sockaddrcmp_noport(from, &e->address)) {
-			if(last_hard_try == mesh->loop.now.tv_sec)
+			if(mesh->last_hard_try == mesh->loop.now.tv_sec)
 				continue;
 			hard = true;
 		}
@@ -639,58 +1203,175 @@ static node_t *try_harder(meshlink_handle_t *mesh, const sockaddr_t *from, const
 	}
 
 	if(hard)
-		last_hard_try = mesh->loop.now.tv_sec;
+		mesh->last_hard_try = mesh->loop.now.tv_sec;
 
-	last_hard_try = mesh->loop.now.tv_sec;
+	mesh->last_hard_try = mesh->loop.now.tv_sec;
 	return n;
 }
 
-bool handle_incoming_vpn_data(event_loop_t *loop, void *data, int flags) {
-	meshlink_handle_t *mesh = loop->data;
-	listen_socket_t *ls = data;
-	vpn_packet_t pkt;
+// Find out which node sent a UDP packet, NULL if it should be dropped
+static node_t *udp_packet_source(meshlink_handle_t *mesh, listen_socket_t *ls, vpn_packet_t *pkt, sockaddr_t *from) {
 	char *hostname;
-	sockaddr_t from = {{0}};
-	socklen_t fromlen = sizeof from;
 	node_t *n;
-	int len;
-
-	len = recvfrom(ls->udp.fd, pkt.data, MAXSIZE, 0, &from.sa, &fromlen);
-
-	if(len <= 0 || len > MAXSIZE) {
-		if(!sockwouldblock(sockerrno))
-			logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
-		return false;
-	}
 
-	pkt.len = len;
-	logger(mesh, MESHLINK_DEBUG, "Received %d bytes of vpn data.", pkt.len);
+	logger(mesh, MESHLINK_DEBUG, "Received %d bytes of vpn data.", pkt->len);
 
-	sockaddrunmap(&from); /* Some braindead IPv6 implementations do stupid things. */
+	sockaddrunmap(from); /* Some braindead IPv6 implementations do stupid things. */
 
-	n = lookup_node_udp(mesh, &from);
+	n = lookup_node_udp(mesh, from);
 
 	if(!n) {
-		n = try_harder(mesh, &from, &pkt);
+		n = try_harder(mesh, from, pkt);
 		if(n)
-			update_node_udp(mesh, n, &from);
+			update_node_udp(mesh, n, from);
 		else if(mesh->log_level >= MESHLINK_WARNING) {
-			hostname = sockaddr2hostname(&from);
+			hostname = sockaddr2hostname(from);
 			logger(mesh, MESHLINK_WARNING, "Received UDP packet from unknown source %s", hostname);
 			free(hostname);
-			return false;
+			return NULL;
 		}
 		else
-			return false;
+			return NULL;
 	}
 
     if (n->status.blacklisted) {
 			logger(mesh, MESHLINK_WARNING, "Dropping packet from blacklisted node %s", n->name);
-            return true;
+            return NULL;
     }
 	n->sock = ls - mesh->listen_socket;
 
-	receive_udppacket(mesh, n, &pkt);
+	return n;
+}
+
+void handle_incoming_vpn_packet(meshlink_handle_t *mesh, listen_socket_t *ls, vpn_packet_t *pkt, sockaddr_t *from) {
+	node_t *n = udp_packet_source(mesh, ls, pkt, from);
+
+	if(n)
+		receive_udppacket(mesh, n, pkt);
+}
+
+#ifdef HAVE_RECVMMSG
+/* Buffers to receive a whole batch of UDP packets with a single recvmmsg() call */
+struct udp_batch {
+	struct mmsghdr msg[UDP_RECV_BATCH];
+	struct iovec iov[UDP_RECV_BATCH];
+	sockaddr_t from[UDP_RECV_BATCH];
+	vpn_packet_t *pkt[UDP_RECV_BATCH];
+	uint8_t buf[];                  /* the packets, with room for mesh->maxsize bytes each */
+};
+
+static struct udp_batch *get_udp_batch(meshlink_handle_t *mesh) {
+	if(!mesh->udp_batch) {
+		size_t size = VPN_PACKET_SIZE(mesh->maxsize);
+		struct udp_batch *batch = xzalloc(sizeof *batch + UDP_RECV_BATCH * size);
+
+		for(int i = 0; i < UDP_RECV_BATCH; i++) {
+			batch->pkt[i] = (vpn_packet_t *)(batch->buf + i * size);
+			batch->iov[i].iov_base = batch->pkt[i]->data;
+			batch->iov[i].iov_len = mesh->maxsize;
+			batch->msg[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msg[i].msg_hdr.msg_iovlen = 1;
+			batch->msg[i].msg_hdr.msg_name = &batch->from[i];
+		}
+
+		mesh->udp_batch = batch;
+	}
+
+	return mesh->udp_batch;
+}
+#endif
+
+// Get one of the mesh's scratch packets, the caller must hold the mesh mutex.
+vpn_packet_t *scratch_packet(meshlink_handle_t *mesh, scratch_packet_t which) {
+	size_t size = VPN_PACKET_SIZE(mesh->maxsize);
+
+	if(!mesh->scratch)
+		mesh->scratch = xzalloc(SCRATCH_PACKETS * size);
+
+	return (vpn_packet_t *)(mesh->scratch + which * size);
+}
+
+// Free the scratch packets, they are allocated again with the current maxsize when they are needed.
+void free_scratch_packets(meshlink_handle_t *mesh) {
+	free(mesh->scratch);
+	mesh->scratch = NULL;
+}
+
+bool handle_incoming_vpn_data(event_loop_t *loop, void *data, int flags) {
+	meshlink_handle_t *mesh = loop->data;
+	listen_socket_t *ls = data;
+
+	if(flags & IO_WRITE) {
+		// a send to this socket blocked before, now it has room again
+		// the event loop takes care of retrying the queued packets
+		io_set(loop, &ls->udp, IO_READ);
+		return true;
+	}
+
+#ifdef HAVE_RECVMMSG
+	struct udp_batch *batch = get_udp_batch(mesh);
+
+	// the kernel overwrites the address lengths, reset them for every call
+	for(int i = 0; i < UDP_RECV_BATCH; i++)
+		batch->msg[i].msg_hdr.msg_namelen = sizeof batch->from[i];
+
+	int count = recvmmsg(ls->udp.fd, batch->msg, UDP_RECV_BATCH, 0, NULL);
+
+	if(count <= 0) {
+		if(!sockwouldblock(sockerrno))
+			logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+		return false;
+	}
+
+	// consecutive packets from the same node are decrypted together
+	vpn_packet_t *run[UDP_RECV_BATCH];
+	node_t *runnode = NULL;
+	int runlen = 0;
+
+	for(int i = 0; i < count; i++) {
+		unsigned int len = batch->msg[i].msg_len;
+
+		// truncated packets do not fit in our buffers, drop them
+		if(!len || len > mesh->maxsize || (batch->msg[i].msg_hdr.msg_flags & MSG_TRUNC))
+			continue;
+
+		batch->pkt[i]->len = len;
+		batch->pkt[i]->probe = false;
+		batch->pkt[i]->tcp = false;
+
+		node_t *n = udp_packet_source(mesh, ls, batch->pkt[i], &batch->from[i]);
+
+		if(!n)
+			continue;
+
+		if(n != runnode && runlen) {
+			receive_udppackets(mesh, runnode, run, runlen);
+			runlen = 0;
+		}
+
+		runnode = n;
+		run[runlen++] = batch->pkt[i];
+	}
+
+	if(runlen)
+		receive_udppackets(mesh, runnode, run, runlen);
+#else
+	vpn_packet_t *pkt = scratch_packet(mesh, SCRATCH_RECEIVE);
+	sockaddr_t from = {{0}};
+	socklen_t fromlen = sizeof from;
+	int len;
+
+	len = recvfrom(ls->udp.fd, pkt->data, mesh->maxsize, 0, &from.sa, &fromlen);
+
+	if(len <= 0 || len > mesh->maxsize) {
+		if(!sockwouldblock(sockerrno))
+			logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+		return false;
+	}
+
+	pkt->len = len;
+	handle_incoming_vpn_packet(mesh, ls, pkt, &from);
+#endif
 
 	return true;
 }
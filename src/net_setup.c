@@ -231,6 +231,7 @@ bool setup_myself_reloadable(meshlink_handle_t *mesh) {
 	keylifetime = 3600; // TODO: check if this can be removed as well
 	mesh->maxtimeout = 900;
 	mesh->self->options |= OPTION_PMTU_DISCOVERY;
+	mesh->self->options |= OPTION_COMPACT_HEADER;
 
 	read_invitation_key(mesh);
 
@@ -368,8 +369,7 @@ bool setup_myself(meshlink_handle_t *mesh) {
 
 	/* Compression */
 
-	// TODO: drop compression in the packet layer?
-	mesh->self->incompression = 0;
+	mesh->self->incompression = mesh->incompression;
 	mesh->self->connection->outcompression = 0;
 
 	/* Done */
@@ -419,7 +419,6 @@ bool setup_network(meshlink_handle_t *mesh) {
 
 	mesh->pinginterval = 60;
 	mesh->pingtimeout = 5;
-	maxoutbufsize = 10 * MTU;
 
 	if(!setup_myself(mesh))
 		return false;
@@ -455,6 +454,17 @@ void close_network_connections(meshlink_handle_t *mesh) {
 		close(mesh->listen_socket[i].udp.fd);
 	}
 
+	if(mesh->tarpit >= 0) {
+		closesocket(mesh->tarpit);
+		mesh->tarpit = -1;
+	}
+
+#ifdef HAVE_RECVMMSG
+	free(mesh->udp_batch);
+	mesh->udp_batch = NULL;
+#endif
+	free_scratch_packets(mesh);
+
 	exit_requests(mesh);
 	exit_edges(mesh);
 	exit_nodes(mesh);
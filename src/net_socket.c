@@ -187,6 +187,12 @@ int setup_vpn_in_socket(meshlink_handle_t *mesh, const sockaddr_t *sa) {
 	if(sa->sa.sa_family == AF_INET6)
 		setsockopt(nfd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&option, sizeof option);
 
+#ifdef SO_REUSEPORT
+	// share the port with the UDP receive threads
+	if(mesh->receive_threads > 0)
+		setsockopt(nfd, SOL_SOCKET, SO_REUSEPORT, (void *)&option, sizeof option);
+#endif
+
 #if defined(IP_DONTFRAG) && !defined(IP_DONTFRAGMENT)
 #define IP_DONTFRAGMENT IP_DONTFRAG
 #endif
@@ -585,50 +591,41 @@ bool handle_new_meta_connection(event_loop_t *loop, void *data, int flags) {
 
 	// Check if we get many connections from the same host
 
-	static sockaddr_t prev_sa;
-	static int tarpit = -1;
-
-	if(tarpit >= 0) {
-		closesocket(tarpit);
-		tarpit = -1;
+	if(mesh->tarpit >= 0) {
+		closesocket(mesh->tarpit);
+		mesh->tarpit = -1;
 	}
 
-	if(!sockaddrcmp_noport(&sa, &prev_sa)) {
-		static int samehost_burst;
-		static int samehost_burst_time;
-
-		if(mesh->loop.now.tv_sec - samehost_burst_time > samehost_burst)
-			samehost_burst = 0;
+	if(!sockaddrcmp_noport(&sa, &mesh->prev_sa)) {
+		if(mesh->loop.now.tv_sec - mesh->samehost_burst_time > mesh->samehost_burst)
+			mesh->samehost_burst = 0;
 		else
-			samehost_burst -= mesh->loop.now.tv_sec - samehost_burst_time;
+			mesh->samehost_burst -= mesh->loop.now.tv_sec - mesh->samehost_burst_time;
 
-		samehost_burst_time = mesh->loop.now.tv_sec;
-		samehost_burst++;
+		mesh->samehost_burst_time = mesh->loop.now.tv_sec;
+		mesh->samehost_burst++;
 
-		if(samehost_burst > max_connection_burst) {
-			tarpit = fd;
+		if(mesh->samehost_burst > max_connection_burst) {
+			mesh->tarpit = fd;
 			return false;
 		}
 	}
 
-	memcpy(&prev_sa, &sa, sizeof sa);
+	memcpy(&mesh->prev_sa, &sa, sizeof sa);
 
 	// Check if we get many connections from different hosts
 
-	static int connection_burst;
-	static int connection_burst_time;
-
-	if(mesh->loop.now.tv_sec - connection_burst_time > connection_burst)
-		connection_burst = 0;
+	if(mesh->loop.now.tv_sec - mesh->connection_burst_time > mesh->connection_burst)
+		mesh->connection_burst = 0;
 	else
-		connection_burst -= mesh->loop.now.tv_sec - connection_burst_time;
+		mesh->connection_burst -= mesh->loop.now.tv_sec - mesh->connection_burst_time;
 
-	connection_burst_time = mesh->loop.now.tv_sec;
-	connection_burst++;
+	mesh->connection_burst_time = mesh->loop.now.tv_sec;
+	mesh->connection_burst++;
 
-	if(connection_burst >= max_connection_burst) {
-		connection_burst = max_connection_burst;
-		tarpit = fd;
+	if(mesh->connection_burst >= max_connection_burst) {
+		mesh->connection_burst = max_connection_burst;
+		mesh->tarpit = fd;
 		return false;
 	}
 
@@ -0,0 +1,273 @@
+/*
+    net_workers.c -- Receive UDP packets with multiple threads
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "net.h"
+#include "netutl.h"
+#include "node.h"
+#include "sptps.h"
+#include "utils.h"
+#include "xalloc.h"
+
+/* Each worker has its own UDP socket, bound to the same address as one of the
+   listen sockets using SO_REUSEPORT. The kernel hashes incoming packets by their
+   source address, so all packets from one peer end up at the same socket, and
+   therefore the same thread.
+
+   A worker handles a whole batch of packets in three steps:
+   - look up the senders and take a copy of their receive keys, holding the mesh mutex,
+   - decrypt and verify the packets, without holding any lock,
+   - do replay protection and pass the records on, holding the mesh mutex again,
+     if the session still uses the key the packets were decrypted with.
+   Everything that is not a data packet from a known peer with an established
+   session, like key exchanges and packets that need try_harder(), is handled
+   by the same code as in the event loop, holding the mesh mutex. */
+
+#if defined(HAVE_RECVMMSG) && defined(SO_REUSEPORT)
+
+#include <poll.h>
+
+typedef struct udp_worker_t {
+	meshlink_handle_t *mesh;
+	listen_socket_t *ls;            /* the listen socket whose address we share */
+	int fd;
+	pthread_t thread;
+
+	struct mmsghdr msg[UDP_RECV_BATCH];
+	struct iovec iov[UDP_RECV_BATCH];
+	sockaddr_t from[UDP_RECV_BATCH];
+	vpn_packet_t *pkt[UDP_RECV_BATCH];
+	uint8_t *buf;                   /* the packets, with room for mesh->maxsize bytes each */
+
+	node_t *node[UDP_RECV_BATCH];   /* sender of each packet if it can be decrypted outside the lock */
+	chacha_poly1305_ctx_t *cipher[UDP_RECV_BATCH];
+	uint32_t keygen[UDP_RECV_BATCH];  /* generation of the copied key, to check that the session did not change in between */
+	uint32_t seqno[UDP_RECV_BATCH];
+	size_t skip[UDP_RECV_BATCH];    /* size of the session ID in front of the datagram */
+	bool decrypted[UDP_RECV_BATCH];
+} udp_worker_t;
+
+static void udp_worker_batch(udp_worker_t *w, int count) {
+	meshlink_handle_t *mesh = w->mesh;
+
+	// Look up the senders and take a copy of their keys
+
+	MESHLINK_MUTEX_LOCK(&mesh->mesh_mutex);
+
+	for(int i = 0; i < count; i++) {
+		unsigned int len = w->msg[i].msg_len;
+
+		w->node[i] = NULL;
+
+		if(!len || len > mesh->maxsize || (w->msg[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+			w->pkt[i]->len = 0;
+			continue;
+		}
+
+		w->pkt[i]->len = len;
+		w->pkt[i]->probe = false;
+		w->pkt[i]->tcp = false;
+
+		sockaddrunmap(&w->from[i]);
+
+		node_t *n = lookup_node_udp(mesh, &w->from[i]);
+
+		if(n && !n->status.blacklisted && sptps_copy_incipher(&n->sptps, w->cipher[i], &w->keygen[i])) {
+			w->node[i] = n;
+			w->skip[i] = n->sptps.sessionids ? SPTPS_SESSIONID_SIZE : 0;
+		}
+	}
+
+	MESHLINK_MUTEX_UNLOCK(&mesh->mesh_mutex);
+
+	// Decrypt in place without holding the lock, the record starts after the sequence number
+
+	for(int i = 0; i < count; i++)
+		if(w->node[i])
+			w->decrypted[i] = w->pkt[i]->len >= w->skip[i] + 4 && sptps_decrypt_datagram(w->cipher[i], w->pkt[i]->data + w->skip[i], w->pkt[i]->len - w->skip[i], w->pkt[i]->data + w->skip[i] + 4, &w->seqno[i]);
+
+	// Pass the records on
+
+	MESHLINK_MUTEX_LOCK(&mesh->mesh_mutex);
+
+	for(int i = 0; i < count; i++) {
+		if(!w->pkt[i]->len)
+			continue;
+
+		node_t *n = w->node[i];
+
+		// the session might have been rekeyed or restarted while we did not hold the lock,
+		// then the packet must not touch the new session's replay window
+		if(n && w->decrypted[i] && n->sptps.instate && n->sptps.inkeygen == w->keygen[i]) {
+			n->sock = w->ls - mesh->listen_socket;
+			sptps_receive_decrypted_datagram(&n->sptps, w->seqno[i], w->pkt[i]->data + w->skip[i] + 4, w->pkt[i]->len - w->skip[i]);
+		} else {
+			// the key might have changed in the mean time, let the regular code sort it out,
+			// packets decrypted with an old key do not pass the new one's check, but might trigger a key request
+			handle_incoming_vpn_packet(mesh, w->ls, w->pkt[i], &w->from[i]);
+		}
+	}
+
+	MESHLINK_MUTEX_UNLOCK(&mesh->mesh_mutex);
+}
+
+static void *udp_worker_loop(void *arg) {
+	udp_worker_t *w = arg;
+	meshlink_handle_t *mesh = w->mesh;
+	struct pollfd pfd[2] = {
+		{.fd = w->fd, .events = POLLIN},
+		{.fd = mesh->udp_workers_pipe[0], .events = POLLIN},
+	};
+
+	while(true) {
+		if(poll(pfd, 2, -1) < 0) {
+			if(sockintr(sockerrno))
+				continue;
+			logger(mesh, MESHLINK_ERROR, "Error while waiting for UDP packets: %s", sockstrerror(sockerrno));
+			break;
+		}
+
+		// the pipe is never read from, so once stop_udp_workers() wrote to it all workers will see it
+		if(pfd[1].revents)
+			break;
+
+		if(!(pfd[0].revents & POLLIN))
+			continue;
+
+		for(int i = 0; i < UDP_RECV_BATCH; i++)
+			w->msg[i].msg_hdr.msg_namelen = sizeof w->from[i];
+
+		int count = recvmmsg(w->fd, w->msg, UDP_RECV_BATCH, 0, NULL);
+
+		if(count <= 0) {
+			if(!sockwouldblock(sockerrno))
+				logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+			continue;
+		}
+
+		udp_worker_batch(w, count);
+	}
+
+	return NULL;
+}
+
+static bool start_udp_worker(meshlink_handle_t *mesh, udp_worker_t *w, listen_socket_t *ls) {
+	w->mesh = mesh;
+	w->ls = ls;
+	w->fd = setup_vpn_in_socket(mesh, &ls->sa);
+
+	if(w->fd < 0)
+		return false;
+
+	size_t size = VPN_PACKET_SIZE(mesh->maxsize);
+	w->buf = xmalloc(UDP_RECV_BATCH * size);
+
+	for(int i = 0; i < UDP_RECV_BATCH; i++) {
+		w->pkt[i] = (vpn_packet_t *)(w->buf + i * size);
+		w->iov[i].iov_base = w->pkt[i]->data;
+		w->iov[i].iov_len = mesh->maxsize;
+		w->msg[i].msg_hdr.msg_iov = &w->iov[i];
+		w->msg[i].msg_hdr.msg_iovlen = 1;
+		w->msg[i].msg_hdr.msg_name = &w->from[i];
+		w->cipher[i] = chacha_poly1305_init();
+	}
+
+	if(pthread_create(&w->thread, NULL, udp_worker_loop, w)) {
+		logger(mesh, MESHLINK_ERROR, "Could not start UDP receive thread: %s", strerror(errno));
+		for(int i = 0; i < UDP_RECV_BATCH; i++)
+			chacha_poly1305_exit(w->cipher[i]);
+		free(w->buf);
+		closesocket(w->fd);
+		return false;
+	}
+
+	return true;
+}
+
+bool start_udp_workers(meshlink_handle_t *mesh) {
+	if(mesh->receive_threads <= 0 || mesh->udp_workers)
+		return true;
+
+	if(pipe(mesh->udp_workers_pipe)) {
+		logger(mesh, MESHLINK_ERROR, "Could not create pipe for UDP receive threads: %s", strerror(errno));
+		return false;
+	}
+
+	mesh->udp_workers = xzalloc(mesh->receive_threads * mesh->listen_sockets * sizeof *mesh->udp_workers);
+	mesh->udp_workers_count = 0;
+
+	for(int i = 0; i < mesh->listen_sockets; i++) {
+		listen_socket_t *ls = &mesh->listen_socket[i];
+
+		// the socket was bound before we knew it had to be shared, allow that now
+		int option = 1;
+		if(setsockopt(ls->udp.fd, SOL_SOCKET, SO_REUSEPORT, (void *)&option, sizeof option)) {
+			logger(mesh, MESHLINK_WARNING, "Could not share UDP socket with receive threads: %s", sockstrerror(sockerrno));
+			continue;
+		}
+
+		for(int j = 0; j < mesh->receive_threads; j++) {
+			if(!start_udp_worker(mesh, &mesh->udp_workers[mesh->udp_workers_count], ls))
+				break;
+			mesh->udp_workers_count++;
+		}
+	}
+
+	logger(mesh, MESHLINK_INFO, "Started %d UDP receive threads", mesh->udp_workers_count);
+	return true;
+}
+
+void stop_udp_workers(meshlink_handle_t *mesh) {
+	if(!mesh->udp_workers)
+		return;
+
+	if(write(mesh->udp_workers_pipe[1], "", 1) != 1)
+		logger(mesh, MESHLINK_ERROR, "Could not signal UDP receive threads to stop: %s", strerror(errno));
+
+	for(int i = 0; i < mesh->udp_workers_count; i++) {
+		udp_worker_t *w = &mesh->udp_workers[i];
+		pthread_join(w->thread, NULL);
+		closesocket(w->fd);
+		for(int j = 0; j < UDP_RECV_BATCH; j++)
+			chacha_poly1305_exit(w->cipher[j]);
+		free(w->buf);
+	}
+
+	close(mesh->udp_workers_pipe[0]);
+	close(mesh->udp_workers_pipe[1]);
+	free(mesh->udp_workers);
+	mesh->udp_workers = NULL;
+	mesh->udp_workers_count = 0;
+}
+
+#else
+
+bool start_udp_workers(meshlink_handle_t *mesh) {
+	if(mesh->receive_threads > 0)
+		logger(mesh, MESHLINK_WARNING, "UDP receive threads are not supported on this platform");
+	return true;
+}
+
+void stop_udp_workers(meshlink_handle_t *mesh) {
+}
+
+#endif
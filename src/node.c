@@ -20,6 +20,7 @@
 #include "system.h"
 
 #include "hash.h"
+#include "list.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "net.h"
@@ -30,7 +31,8 @@
 #include "xalloc.h"
 
 // lower the default mtu a bit, just in case
-#define DEFAULT_MTU (SPTPS_DATAGRAM_MTU - 100)
+// the default link MTU is assumed, the path MTU discovery finds out if jumbo frames are possible
+#define DEFAULT_MTU (SPTPS_DATAGRAM_MTU - (MAX_LINK_MTU - DEFAULT_LINK_MTU) - 100)
 
 static int node_compare(const node_t *a, const node_t *b) {
 	return strcmp(a->name, b->name);
@@ -38,15 +40,27 @@ static int node_compare(const node_t *a, const node_t *b) {
 
 void init_nodes(meshlink_handle_t *mesh) {
 	mesh->nodes = splay_alloc_tree((splay_compare_t) node_compare, (splay_action_t) free_node);
-	mesh->node_udp_cache = hash_alloc(0x100, sizeof(sockaddr_t));
+	mesh->node_udp_cache = hash_alloc_custom(0x100, sizeof(sockaddr_t), hash_sockaddr, hash_compare_sockaddr);
+	mesh->node_sessionid_cache = hash_alloc(0x100, sizeof(uint32_t));
+#ifdef HAVE_SENDMMSG
+	mesh->udp_pending = list_alloc(NULL);
+#endif
 }
 
 void exit_nodes(meshlink_handle_t *mesh) {
 	if(mesh->node_udp_cache)
 		hash_free(mesh->node_udp_cache);
+	if(mesh->node_sessionid_cache)
+		hash_free(mesh->node_sessionid_cache);
+#ifdef HAVE_SENDMMSG
+	if(mesh->udp_pending)
+		list_free(mesh->udp_pending);
+	mesh->udp_pending = NULL;
+#endif
 	if(mesh->nodes)
 		splay_delete_tree(mesh->nodes);
 	mesh->node_udp_cache = NULL;
+	mesh->node_sessionid_cache = NULL;
 	mesh->nodes = NULL;
 }
 
@@ -57,6 +71,8 @@ node_t *new_node(void) {
 	n->mtu = DEFAULT_MTU;
 	n->maxmtu = DEFAULT_MTU;
 	n->devclass = _DEV_CLASS_MAX;
+	n->udp_candidate_best = -1;
+	n->mturtt = -1;
 
 	return n;
 }
@@ -75,6 +91,11 @@ void free_node(node_t *n) {
 		abort();
 	}
 
+#ifdef HAVE_SENDMMSG
+	free(n->txbatch);
+#endif
+
+	free(n->udp_candidate);
 	free(n->hostname);
 	free(n->name);
 
@@ -94,6 +115,17 @@ void node_del(meshlink_handle_t *mesh, node_t *n) {
 	for splay_each(edge_t, e, n->edge_tree)
 		edge_del(mesh, e);
 
+	if(hash_search(mesh->node_udp_cache, &n->address) == n)
+		hash_delete(mesh->node_udp_cache, &n->address);
+
+	if(hash_search(mesh->node_sessionid_cache, &n->sessionid) == n)
+		hash_delete(mesh->node_sessionid_cache, &n->sessionid);
+
+#ifdef HAVE_SENDMMSG
+	if(n->status.udp_pending)
+		list_delete(mesh->udp_pending, n);
+#endif
+
 	splay_delete(mesh->nodes, n);
 }
 
@@ -116,10 +148,12 @@ void update_node_udp(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa) {
 		return;
 	}
 
-	hash_insert(mesh->node_udp_cache, &n->address, NULL);
+	if(hash_search(mesh->node_udp_cache, &n->address) == n)
+		hash_delete(mesh->node_udp_cache, &n->address);
 
 	if(sa) {
 		n->address = *sa;
+		n->status.udp_candidates = false;
 		n->sock = 0;
 		for(int i = 0; i < mesh->listen_sockets; i++) {
 			if(mesh->listen_socket[i].sa.sa.sa_family == sa->sa.sa_family) {
@@ -133,3 +167,20 @@ void update_node_udp(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa) {
 		logger(mesh, MESHLINK_DEBUG, "UDP address of %s set to %s", n->name, n->hostname);
 	}
 }
+
+// The session ID is chosen by the peer, the caller has to verify the datagram with the node's key.
+node_t *lookup_node_sessionid(meshlink_handle_t *mesh, uint32_t sessionid) {
+	return hash_search(mesh->node_sessionid_cache, &sessionid);
+}
+
+// Call this whenever the node's SPTPS session gets new receive keys.
+void update_node_sessionid(meshlink_handle_t *mesh, node_t *n) {
+	if(hash_search(mesh->node_sessionid_cache, &n->sessionid) == n)
+		hash_delete(mesh->node_sessionid_cache, &n->sessionid);
+
+	if(!n->sptps.sessionids)
+		return;
+
+	n->sessionid = n->sptps.insessionid;
+	hash_insert(mesh->node_sessionid_cache, &n->sessionid, n);
+}
@@ -36,9 +36,29 @@ typedef struct node_status_t {
 	unsigned int udp_confirmed:1;           /* 1 if the address is one that we received UDP traffic on */
 	unsigned int broadcast:1;               /* 1 if the next UDP packet should be broadcast to the local network */
 	unsigned int blacklisted:1;             /* 1 if the node is blacklist so we never want to speak with him anymore*/
-	unsigned int unused:22;
+	unsigned int udp_candidates:1;          /* 1 if udp_candidate[] is up to date with the edges */
+	unsigned int udp_pending:1;             /* 1 if this node is in mesh->udp_pending */
+	unsigned int unused:20;
 } node_status_t;
 
+/* States of path MTU discovery, see send_mtu_probe_handler() */
+typedef enum pmtu_state_t {
+	PMTU_IDLE,                              /* not probing, the node is unreachable or we have no key for it */
+	PMTU_BASE,                              /* checking whether UDP works at all */
+	PMTU_SEARCHING,                         /* binary search between minmtu and maxmtu */
+	PMTU_COMPLETE,                          /* the MTU is known, checking every pinginterval that it still works */
+} pmtu_state_t;
+
+#define PMTU_BURST 3                    /* number of probes of different sizes sent at once while searching */
+
+typedef struct udp_candidate_t {
+	sockaddr_t address;                     /* address of the node as seen by one of its peers */
+	int sock;                               /* listen socket with the same address family */
+	struct timeval last_sent;               /* when we last sent a packet to this address */
+	unsigned int replies;                   /* number of MTU probe replies received from this address */
+	int rtt;                                /* smoothed round trip time in microseconds, -1 if unknown */
+} udp_candidate_t;
+
 typedef struct node_t {
 	char *name;                             /* name of this node */
 	void *priv;
@@ -58,29 +78,56 @@ typedef struct node_t {
 
 	struct ecdsa *ecdsa;                    /* His public ECDSA key */
 	sptps_t sptps;
+	unsigned int replaywin;                 /* Size of the SPTPS replay window in bytes, 0 for the default */
 
 	int incompression;                      /* Compressionlevel, 0 = no compression */
 	int outcompression;                     /* Compressionlevel, 0 = no compression */
+	int dictid;                             /* ID of our compression dictionary when the levels were agreed on */
+	uint16_t compress_ratio;                /* moving average of compressed packet sizes, in 1/256ths of the original size */
+	uint16_t compress_backoff;              /* packets skipped after the last sample that did not compress */
+	uint16_t compress_skip;                 /* packets left to send before trying to compress again */
+	uint64_t compress_tried;                /* packets we tried to compress */
+	uint64_t compress_skipped;              /* packets sent without trying to compress them */
+	uint64_t compress_bytes_in;             /* size of the packets we tried to compress */
+	uint64_t compress_bytes_out;            /* size of those packets as they were sent */
+	uint64_t compress_nsec;                 /* time spent compressing */
 
 	int distance;
 	struct node_t *nexthop;                 /* nearest node from us to him */
 	struct edge_t *prevedge;                /* nearest node from him to us */
 	struct node_t *via;                     /* next hop for UDP packets */
 
+	udp_candidate_t *udp_candidate;         /* addresses to try while the UDP address is not confirmed */
+	int udp_candidates;
+	int udp_candidate_next;                 /* next candidate to try */
+	int udp_candidate_best;                 /* candidate with the lowest round trip time, -1 if none replied yet */
+	unsigned int udp_choice;                /* counts packets sent to unconfirmed addresses */
+
 	struct splay_tree_t *edge_tree;                /* Edges with this node as one of the endpoints */
 
 	struct connection_t *connection;        /* Connection associated with this node (if a direct connection exists) */
 	time_t last_connect_try;
 	time_t last_successfull_connection;
 
+	uint32_t sessionid;                     /* Session ID under which this node is in the node_sessionid_cache */
+
 	uint16_t mtu;                           /* Maximum size of packets to send to this node */
 	uint16_t minmtu;                        /* Probed minimum MTU */
 	uint16_t maxmtu;                        /* Probed maximum MTU */
-	int mtuprobes;                          /* Number of probes */
+	pmtu_state_t pmtu_state;
+	int mtuprobes;                          /* Number of probe rounds without the answers we are waiting for */
+	uint16_t mtuprobe_len[PMTU_BURST];      /* Sizes probed in the current round, 0 if unused or answered */
+	int mtuprobe_replies;                   /* Number of probes of the current round that were answered */
+	struct timeval mtu_search_start;        /* When the current search started */
+	int mturtt;                             /* Smoothed round trip time of probes in microseconds, -1 if unknown */
 	timeout_t mtutimeout;                   /* Probe event */
 
 	struct utcp *utcp;
 
+#ifdef HAVE_SENDMMSG
+	struct udp_tx_batch *txbatch;           /* UDP packets waiting to be sent at the end of the event loop iteration */
+#endif
+
 	uint64_t in_packets;
 	uint64_t in_bytes;
 	uint64_t out_packets;
@@ -96,5 +143,7 @@ extern void node_del(struct meshlink_handle *mesh, node_t *);
 extern node_t *lookup_node(struct meshlink_handle *mesh, const char *);
 extern node_t *lookup_node_udp(struct meshlink_handle *mesh, const sockaddr_t *);
 extern void update_node_udp(struct meshlink_handle *mesh, node_t *, const sockaddr_t *);
+extern node_t *lookup_node_sessionid(struct meshlink_handle *mesh, uint32_t);
+extern void update_node_sessionid(struct meshlink_handle *mesh, node_t *);
 
 #endif /* __MESHLINK_NODE_H__ */
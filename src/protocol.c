@@ -98,6 +98,38 @@ int send_request(meshlink_handle_t *mesh, connection_t *c, const char *format, .
 		return send_meta(mesh, c, request, len);
 }
 
+/* Pass a request for another node on to the next hop unchanged. This is how packets are relayed,
+   as REQ_KEY requests with an SPTPS record for the destination that we cannot decrypt ourselves.
+   The request is copied once, into a buffer with room around it for the meta connection's record
+   header and tag, and encrypted there. send_request() would format it again first, and
+   sptps_send_record() would copy it into a record of its own. */
+// @return the sockerrno, 0 on success, -1 on other errors
+int relay_request(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	if(!c) {
+		logger(mesh, MESHLINK_ERROR, "Can't relay request to nullified connection.");
+		return -1;
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Relaying %s to %s (%s): %s", request_name[atoi(request)], c->name, c->hostname, request);
+
+	size_t len = strlen(request);
+
+	if(len >= UINT16_MAX) {
+		logger(mesh, MESHLINK_ERROR, "Output buffer overflow while relaying request to %s (%s)", c->name, c->hostname);
+		return -1;
+	}
+
+	char buf[SPTPS_HEADROOM + len + 1 + SPTPS_TAILROOM];
+	char *data = buf + SPTPS_HEADROOM;
+	memcpy(data, request, len);
+	data[len++] = '\n';
+
+	if(c->allow_request == ID)
+		return send_meta(mesh, c, data, len);
+
+	return sptps_send_record_inplace(&c->sptps, 0, data, len);
+}
+
 void forward_request(meshlink_handle_t *mesh, connection_t *from, const char *request) {
 	logger(mesh, MESHLINK_DEBUG, "Forwarding %s from %s (%s): %s", request_name[atoi(request)], from->name, from->hostname, request);
 
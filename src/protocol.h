@@ -73,6 +73,8 @@ typedef struct past_request_t {
 // @return the sockerrno, 0 on success, -1 on other errors
 extern int send_request(struct meshlink_handle *mesh, struct connection_t *, const char *, ...) __attribute__ ((__format__(printf, 3, 4)));
 extern void forward_request(struct meshlink_handle *mesh, struct connection_t *, const char *);
+// @return the sockerrno, 0 on success, -1 on other errors
+extern int relay_request(struct meshlink_handle *mesh, struct connection_t *, const char *);
 extern bool receive_request(struct meshlink_handle *mesh, struct connection_t *, const char *);
 extern bool check_id(const char *);
 
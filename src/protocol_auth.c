@@ -412,6 +412,9 @@ int send_ack(meshlink_handle_t *mesh, connection_t *c) {
 	if(mesh->self->options & OPTION_PMTU_DISCOVERY)
 		c->options |= OPTION_PMTU_DISCOVERY;
 
+	if(mesh->self->options & OPTION_COMPACT_HEADER)
+		c->options |= OPTION_COMPACT_HEADER;
+
 	return send_request(mesh, c, "%d %s %d %x", ACK, mesh->myport, mesh->devclass, (c->options & 0xffffff) | (PROT_MINOR << 24));
 }
 
@@ -482,6 +485,10 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		c->options &= ~OPTION_PMTU_DISCOVERY;
 		options &= ~OPTION_PMTU_DISCOVERY;
 	}
+	if(!(c->options & options & OPTION_COMPACT_HEADER)) {
+		c->options &= ~OPTION_COMPACT_HEADER;
+		options &= ~OPTION_COMPACT_HEADER;
+	}
 	c->options |= options;
 
 	/* Activate this connection */
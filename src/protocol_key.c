@@ -19,6 +19,7 @@
 
 #include "system.h"
 
+#include "compression.h"
 #include "connection.h"
 #include "logger.h"
 #include "meshlink_internal.h"
@@ -114,7 +115,10 @@ bool send_req_key(meshlink_handle_t *mesh, node_t *to) {
 	to->status.waitingforkey = true;
 	to->last_req_key = mesh->loop.now.tv_sec;
 	to->incompression = mesh->self->incompression;
-	return sptps_start(&to->sptps, to, true, true, mesh->self->connection->ecdsa, to->ecdsa, label, sizeof label - 1, send_initial_sptps_data, receive_sptps_record);
+	if(!sptps_start(&to->sptps, to, true, true, mesh->self->connection->ecdsa, to->ecdsa, label, sizeof label - 1, send_initial_sptps_data, receive_sptps_record))
+		return false;
+
+	return !to->replaywin || sptps_set_replaywin(&to->sptps, to->replaywin);
 }
 
 /* REQ_KEY is overloaded to allow arbitrary requests to be routed between two nodes. */
@@ -180,7 +184,10 @@ static bool req_key_ext_h(meshlink_handle_t *mesh, connection_t *c, const char *
 			from->status.validkey = false;
 			from->status.waitingforkey = true;
 			from->last_req_key = mesh->loop.now.tv_sec;
+			from->incompression = mesh->self->incompression;
 			sptps_start(&from->sptps, from, false, true, mesh->self->connection->ecdsa, from->ecdsa, label, sizeof label - 1, send_sptps_data, receive_sptps_record);
+			if(from->replaywin)
+				sptps_set_replaywin(&from->sptps, from->replaywin);
 			sptps_receive_data(&from->sptps, buf, len);
 			return true;
 		}
@@ -256,9 +263,9 @@ bool req_key_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 			return true;
 		}
 
-		int err = send_request(mesh, to->nexthop->connection, "%s", request);
+		int err = relay_request(mesh, to->nexthop->connection, request);
 	    if(err) {
-	        logger(mesh, MESHLINK_ERROR, "req_key_h() send_request for connection %p failed with err=%d.\n", to->nexthop->connection, err);
+	        logger(mesh, MESHLINK_ERROR, "req_key_h() relay_request for connection %p failed with err=%d.\n", to->nexthop->connection, err);
 	        return false;
 	    }
 	}
@@ -330,9 +337,9 @@ bool ans_key_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 			free(port);
 			return !err;
 		} else {
-			int err = send_request(mesh, to->nexthop->connection, "%s", request);
+			int err = relay_request(mesh, to->nexthop->connection, request);
 		    if(err) {
-		        logger(mesh, MESHLINK_ERROR, "ans_key_h() send_request for connection %p failed with err=%d.\n", to->nexthop->connection, err);
+		        logger(mesh, MESHLINK_ERROR, "ans_key_h() relay_request for connection %p failed with err=%d.\n", to->nexthop->connection, err);
 		    }
 			return !err;
 		}
@@ -341,12 +348,28 @@ bool ans_key_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	/* Don't use key material until every check has passed. */
 	from->status.validkey = false;
 
-	if(compression < 0 || compression > 11) {
+	if(compression < 0 || compression > COMPRESS_MAX) {
 		logger(mesh, MESHLINK_ERROR, "Node %s (%s) uses bogus compression level!", from->name, from->hostname);
 		return true;
 	}
 
+	// The dictionary levels need the same dictionary on both sides, otherwise both use the codec without it.
+	// Old nodes send -1 here.
+	if(compression_negotiate(mesh->compression, compression, digest) != compression)
+		logger(mesh, MESHLINK_WARNING, "Node %s (%s) has a different compression dictionary, not using it", from->name, from->hostname);
+
+	compression = compression_negotiate(mesh->compression, compression, digest);
+	from->incompression = compression_negotiate(mesh->compression, from->incompression, digest);
+
+	// Uncompressed packets are always accepted, so fall back to those if we cannot do what it asks for.
+	if(!compression_supported(mesh->compression, compression)) {
+		logger(mesh, MESHLINK_WARNING, "Node %s (%s) asks for %s compression, which we do not support", from->name, from->hostname, compression_name(compression));
+		compression = COMPRESS_NONE;
+	}
+
 	from->outcompression = compression;
+	from->dictid = compression_dictionary_id(mesh->compression);
+	reset_compression(from);
 
 	/* SPTPS or old-style key exchange? */
 
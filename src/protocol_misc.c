@@ -29,8 +29,6 @@
 #include "protocol.h"
 #include "utils.h"
 
-int maxoutbufsize = 0;
-
 /* Status and error notification routines */
 
 bool send_status(meshlink_handle_t *mesh, connection_t *c, int statusno, const char *statusstring) {
@@ -145,6 +143,8 @@ bool send_tcppacket(meshlink_handle_t *mesh, connection_t *c, const vpn_packet_t
 	/* If there already is a lot of data in the outbuf buffer, discard this packet.
 	   We use a very simple Random Early Drop algorithm. */
 
+	int maxoutbufsize = 10 * (mesh->link_mtu + 18);
+
 	if(2.0 * c->outbuf.len / (float)maxoutbufsize - 1 > (float)rand()/(float)RAND_MAX)
 		return true;
 
@@ -0,0 +1,317 @@
+/*
+    relay_speed.c -- relay forwarding benchmark
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include <poll.h>
+
+#include "crypto.h"
+#include "ecdsa.h"
+#include "ecdsagen.h"
+#include "net_defines.h"
+#include "sptps.h"
+#include "utils.h"
+
+// Relaying the way MeshLink does it: data packets are always encrypted end to end for their destination,
+// and when there is no UDP path between A and B, A sends them as REQ_KEY requests carrying a base64 encoded
+// SPTPS record over its meta connection to R, which passes the request on to B over its own meta connection
+// without decrypting the record, like req_key_h() does.
+// Only the time R spends receiving, parsing, re-encrypting and sending the requests is counted.
+// The forwarding is done in two ways, taking turns for every burst so they both see the same conditions:
+// - format: the request is formatted again into a new buffer and then encrypted, like send_request() does
+// - relay: the request is copied once into a buffer with room for the record header and encrypted in place, like relay_request() does
+
+#define BURST 32                /* small enough to fit in the default socket buffers */
+
+// From protocol.h, which cannot be included together with the symbols below
+#define REQ_KEY 15
+#define REQ_SPTPS 21
+#define MAX_STRING_SIZE 2049
+#define MAX_STRING "%2048s"
+
+// Symbols necessary to link with logger.o
+int send_request(void *c, const char *msg, ...) { return -1; }
+void *mesh;
+void *global_log_cb;
+int global_log_level;
+int send_meta(void *c, const char *msg , int len) { return -1; }
+char *logfilename = NULL;
+struct timeval now;
+
+static int packetsize = 1024;
+
+enum forward_mode {
+	FORWARD_FORMAT,
+	FORWARD_RELAY,
+	FORWARD_MODES,
+};
+
+static const char *mode_name[FORWARD_MODES] = {"format", "relay"};
+static enum forward_mode mode;
+
+static int fd_ab, fd_ba;                /* the end to end session between A and B, its records are sent via R */
+static int fd_ar, fd_ra, fd_rb, fd_br;  /* the meta connections A - R and R - B */
+static sptps_t ab, ba, ar, ra, rb, br;
+static unsigned int relayed[FORWARD_MODES], arrived;
+static double elapsed[FORWARD_MODES];
+
+static double timestamp(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int send_data(void *handle, uint8_t type, const void *data, size_t len) {
+	int fd = *(int *)handle;
+	send(fd, data, len, 0);
+	return 0;
+}
+
+// A's end to end records go to R as REQ_KEY requests, like send_sptps_data() does without a UDP path
+static int send_via_relay(void *handle, uint8_t type, const void *data, size_t len) {
+	if(type >= SPTPS_HANDSHAKE)
+		return send_data(handle, type, data, len);
+
+	char request[MAXBUFSIZE];
+	int rlen = snprintf(request, sizeof request, "%d %s %s %d ", REQ_KEY, "a", "b", REQ_SPTPS);
+	b64encode(data, request + rlen, len);
+	rlen += strlen(request + rlen);
+	request[rlen++] = '\n';
+	sptps_send_record(&ar, 0, request, rlen);
+	return 0;
+}
+
+static bool receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	if(handle == &fd_ba && type < SPTPS_HANDSHAKE)
+		arrived++;
+
+	return true;
+}
+
+// R passes requests on like req_key_h() does, the line is terminated in place like receive_meta_sptps() does
+static bool relay_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	if(type >= SPTPS_HANDSHAKE)
+		return true;
+
+	char *request = (char *)data;
+	request[len - 1] = 0;
+
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	int reqno = 0;
+
+	if(sscanf(request, "%*d " MAX_STRING " " MAX_STRING " %d", from_name, to_name, &reqno) < 3 || reqno != REQ_SPTPS) {
+		fprintf(stderr, "Error: R got a bad request\n");
+		abort();
+	}
+
+	switch(mode) {
+	case FORWARD_FORMAT: {
+		char buf[MAXBUFSIZE];
+		int blen = snprintf(buf, sizeof buf, "%s", request);
+		buf[blen++] = '\n';
+		sptps_send_record(&rb, 0, buf, blen);
+		break;
+	}
+
+	case FORWARD_RELAY: {
+		size_t rlen = strlen(request);
+		char buf[SPTPS_HEADROOM + rlen + 1 + SPTPS_TAILROOM];
+		char *line = buf + SPTPS_HEADROOM;
+		memcpy(line, request, rlen);
+		line[rlen++] = '\n';
+		sptps_send_record_inplace(&rb, 0, line, rlen);
+		break;
+	}
+
+	default:
+		abort();
+	}
+
+	relayed[mode]++;
+	return true;
+}
+
+// B decodes the record and hands it to its end of the end to end session, like the REQ_SPTPS case of req_key_ext_h() does
+static bool deliver_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	if(type >= SPTPS_HANDSHAKE)
+		return true;
+
+	char buf[MAX_STRING_SIZE];
+	int blen;
+
+	if(sscanf(data, "%*d %*s %*s %*d " MAX_STRING, buf) != 1 || !(blen = b64decode(buf, buf, strlen(buf)))) {
+		fprintf(stderr, "Error: B got a bad request\n");
+		abort();
+	}
+
+	sptps_receive_data(&ba, buf, blen);
+	return true;
+}
+
+static void receive_data(sptps_t *sptps, int fd) {
+	char buf[4096];
+	ssize_t len = recv(fd, buf, sizeof buf, 0);
+	if(len <= 0 || !sptps_receive_data(sptps, buf, len)) {
+		fprintf(stderr, "Error: sptps_receive_data failed\n");
+		abort();
+	}
+}
+
+static void handshake(sptps_t *s1, int *handle1, sptps_t *s2, int *handle2, bool datagram, ecdsa_t *key1, ecdsa_t *key2, send_data_t send1, receive_record_t receive2) {
+	int fd[2];
+	if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fd)) {
+		fprintf(stderr, "Could not create a UNIX socket pair: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	struct pollfd pfd[2] = {{.fd = fd[0], .events = POLLIN}, {.fd = fd[1], .events = POLLIN}};
+	*handle1 = fd[0];
+	*handle2 = fd[1];
+
+	sptps_start(s1, handle1, true, datagram, key1, key2, "relay_speed", 11, send1, receive_record);
+	sptps_start(s2, handle2, false, datagram, key2, key1, "relay_speed", 11, send_data, receive2);
+
+	while(poll(pfd, 2, 0)) {
+		if(pfd[0].revents)
+			receive_data(s1, fd[0]);
+		if(pfd[1].revents)
+			receive_data(s2, fd[1]);
+	}
+
+	close(fd[0]);
+	close(fd[1]);
+}
+
+// Replace the handshake sockets of a meta connection with a stream socket pair, like a real TCP connection
+static void connect_meta(int *handle1, int *handle2) {
+	int fd[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fd)) {
+		fprintf(stderr, "Could not create a UNIX socket pair: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	fcntl(fd[1], F_SETFL, O_NONBLOCK);
+	*handle1 = fd[0];
+	*handle2 = fd[1];
+}
+
+// receive and decrypt everything that is queued on the meta connection, like handle_meta_connection_data() does
+static void drain(int fd, sptps_t *s) {
+	char buf[MAXBUFSIZE];
+	ssize_t len;
+
+	while((len = recv(fd, buf, sizeof buf, 0)) > 0)
+		if(!sptps_receive_data(s, buf, len)) {
+			fprintf(stderr, "Error: sptps_receive_data failed\n");
+			abort();
+		}
+}
+
+static void run(double duration) {
+	static char buf[SPTPS_MTU];
+	unsigned int sent = 0;
+
+	randomize(buf, packetsize);
+
+	fprintf(stderr, "Relaying %d byte packets for %lg seconds per mode:\n", packetsize, duration);
+
+	while(elapsed[FORWARD_RELAY] < duration) {
+		for(mode = 0; mode < FORWARD_MODES; mode++) {
+			for(int i = 0; i < BURST; i++)
+				sptps_send_record(&ab, 0, buf, packetsize);
+
+			sent += BURST;
+
+			double begin = timestamp();
+			drain(fd_ra, &ra);
+			elapsed[mode] += timestamp() - begin;
+
+			drain(fd_br, &br);
+		}
+	}
+
+	unsigned int total = 0;
+
+	for(mode = 0; mode < FORWARD_MODES; mode++)
+		total += relayed[mode];
+
+	if(arrived != total || sent != total) {
+		fprintf(stderr, "Error: %u packets sent, %u relayed, %u arrived\n", sent, total, arrived);
+		exit(1);
+	}
+
+	double format_rate = relayed[FORWARD_FORMAT] / elapsed[FORWARD_FORMAT];
+
+	for(mode = 0; mode < FORWARD_MODES; mode++) {
+		double rate = relayed[mode] / elapsed[mode];
+		fprintf(stderr, "  %-8s %14.2lf packets/s, %+6.1lf%% compared to format\n", mode_name[mode], rate, (rate / format_rate - 1) * 100);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	double duration = argc > 1 ? atof(argv[1]) : 10;
+
+	if(argc > 2)
+		packetsize = atoi(argv[2]);
+
+	// The base64 encoded record has to fit in a MAX_STRING field of the request
+	if(packetsize <= 0 || (packetsize + 21 + 2) / 3 * 4 >= MAX_STRING_SIZE) {
+		fprintf(stderr, "Usage: %s [seconds] [packet size]\n", argv[0]);
+		return 1;
+	}
+
+	crypto_init();
+
+	ecdsa_t *key_a = ecdsa_generate();
+	ecdsa_t *key_r = ecdsa_generate();
+	ecdsa_t *key_b = ecdsa_generate();
+
+	if(!key_a || !key_r || !key_b)
+		return 1;
+
+	// Set up the meta connections A - R and R - B, and the end to end session between A and B
+
+	handshake(&ar, &fd_ar, &ra, &fd_ra, false, key_a, key_r, send_data, relay_record);
+	handshake(&rb, &fd_rb, &br, &fd_br, false, key_r, key_b, send_data, deliver_record);
+	connect_meta(&fd_ar, &fd_ra);
+	connect_meta(&fd_rb, &fd_br);
+	handshake(&ab, &fd_ab, &ba, &fd_ba, true, key_a, key_b, send_via_relay, receive_record);
+
+	run(duration);
+
+	// Clean up
+
+	sptps_stop(&ab);
+	sptps_stop(&ba);
+	sptps_stop(&ar);
+	sptps_stop(&ra);
+	sptps_stop(&rb);
+	sptps_stop(&br);
+	close(fd_ar);
+	close(fd_ra);
+	close(fd_rb);
+	close(fd_br);
+	ecdsa_free(key_a);
+	ecdsa_free(key_r);
+	ecdsa_free(key_b);
+	crypto_exit();
+
+	return 0;
+}
@@ -28,38 +28,64 @@
 
 bool decrement_ttl = false;
 
-static bool checklength(node_t *source, vpn_packet_t *packet, uint16_t length) {
-	if(packet->len < length) {
+static bool checklength(node_t *source, uint16_t len, uint16_t length) {
+	if(len < length) {
 		logger(source->mesh, MESHLINK_WARNING, "Got too short packet from %s (%s)", source->name, source->hostname);
 		return false;
 	} else
 		return true;
 }
 
-// @return the sockerrno, 0 on success, -1 on other errors
-int route(meshlink_handle_t *mesh, node_t *source, vpn_packet_t *packet) {
-	// TODO: route on name or key
+// Nodes that support it send a compact header instead of the node names.
+// Indices are local to the receiver, and the only one a sender can know is
+// NODE_INDEX_SELF, since packets are always encrypted for their destination.
+static node_t *lookup_node_index(meshlink_handle_t *mesh, uint16_t index) {
+	return index == NODE_INDEX_SELF ? mesh->self : NULL;
+}
 
+// Route a packet, if it has to be forwarded and packet is NULL, the data is copied first.
+// @return the sockerrno, 0 on success, -1 on other errors
+static int route_packet_data(meshlink_handle_t *mesh, node_t *source, const uint8_t *data, uint16_t packetlen, vpn_packet_t *packet) {
 	node_t *owner = NULL;
 	node_t *via = NULL;
-	meshlink_packethdr_t *hdr = (meshlink_packethdr_t *) packet->data;
-	owner = lookup_node(mesh, (char *)hdr->destination);
-	logger(mesh, MESHLINK_DEBUG, "Routing packet from \"%s\" to \"%s\"\n", hdr->source, hdr->destination);
+	size_t hdrlen;
 
-	//Check Lenght
-	if(!checklength(source, packet, sizeof *hdr))
-		return -1;
+	if(packetlen && !data[0]) {
+		meshlink_compacthdr_t hdr;
+		hdrlen = sizeof hdr;
 
-	if(owner == NULL) {
-		//Lookup failed
-		logger(mesh, MESHLINK_WARNING, "Cant lookup the owner of a packet in the route() function. This should never happen!\n");
-		logger(mesh, MESHLINK_WARNING, "Destination was: %s\n", hdr->destination);
-		return -1;
+		if(!checklength(source, packetlen, hdrlen))
+			return -1;
+
+		memcpy(&hdr, data, sizeof hdr);
+		owner = lookup_node_index(mesh, ntohs(hdr.destination));
+
+		if(owner == NULL) {
+			logger(mesh, MESHLINK_WARNING, "Got packet from %s for unknown node index %d", source->name, ntohs(hdr.destination));
+			return -1;
+		}
+	} else {
+		const meshlink_packethdr_t *hdr = (const meshlink_packethdr_t *) data;
+		hdrlen = sizeof *hdr;
+
+		//Check Lenght
+		if(!checklength(source, packetlen, hdrlen))
+			return -1;
+
+		owner = lookup_node(mesh, (char *)hdr->destination);
+		logger(mesh, MESHLINK_DEBUG, "Routing packet from \"%s\" to \"%s\"\n", hdr->source, hdr->destination);
+
+		if(owner == NULL) {
+			//Lookup failed
+			logger(mesh, MESHLINK_WARNING, "Cant lookup the owner of a packet in the route() function. This should never happen!\n");
+			logger(mesh, MESHLINK_WARNING, "Destination was: %s\n", hdr->destination);
+			return -1;
+		}
 	}
 
 	if(owner == mesh->self) {
-		const void *payload = packet->data + sizeof *hdr;
-		size_t len = packet->len - sizeof *hdr;
+		const void *payload = data + hdrlen;
+		size_t len = packetlen - hdrlen;
 
 		// check log level before calling bin2hex since that's an expensive call
 		if(mesh->log_level <= MESHLINK_DEBUG_PACKETDATA) {
@@ -69,6 +95,8 @@ int route(meshlink_handle_t *mesh, node_t *source, vpn_packet_t *packet) {
 			free(hex);
 		}
 
+		mesh->receive_bytes_delivered += len;
+
 		if(mesh->receive_cb)
 			mesh->receive_cb(mesh, (meshlink_node_t *)source, payload, len);
 		return 0;
@@ -86,5 +114,31 @@ int route(meshlink_handle_t *mesh, node_t *source, vpn_packet_t *packet) {
 		return -1;
 	}
 
+	if(!packet) {
+		if(packetlen > mesh->maxsize) {
+			logger(mesh, MESHLINK_WARNING, "Dropping packet of %d bytes from %s (%s) that is too large to forward", packetlen, source->name, source->hostname);
+			return -1;
+		}
+
+		packet = scratch_packet(mesh, SCRATCH_ROUTE);
+		packet->probe = false;
+		packet->tcp = false;
+		packet->disposable = true;
+		packet->len = packetlen;
+		memcpy(packet->data, data, packetlen);
+		mesh->receive_bytes_copied += packetlen;
+	}
+
 	return send_packet(mesh, owner, packet);
 }
+
+// @return the sockerrno, 0 on success, -1 on other errors
+int route(meshlink_handle_t *mesh, node_t *source, vpn_packet_t *packet) {
+	return route_packet_data(mesh, source, packet->data, packet->len, packet);
+}
+
+// Route data received from another node without copying it, unless it has to be forwarded.
+// @return the sockerrno, 0 on success, -1 on other errors
+int route_data(meshlink_handle_t *mesh, node_t *source, const uint8_t *data, uint16_t len) {
+	return route_packet_data(mesh, source, data, len, NULL);
+}
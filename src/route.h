@@ -27,5 +27,7 @@ extern bool decrement_ttl;
 
 // @return the sockerrno, 0 on success, -1 on other errors
 extern int route(struct meshlink_handle *mesh, struct node_t *, struct vpn_packet_t *);
+// @return the sockerrno, 0 on success, -1 on other errors
+extern int route_data(struct meshlink_handle *mesh, struct node_t *, const uint8_t *data, uint16_t len);
 
 #endif /* __MESHLINK_ROUTE_H__ */
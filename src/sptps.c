@@ -29,6 +29,8 @@
 
 unsigned int sptps_replaywin = 32;
 
+static uint32_t sptps_keygen;           // last receive key generation handed out, accessed atomically
+
 /*
    Nonce MUST be exchanged first (done)
    Signatures MUST be done over both nonces, to guarantee the signature is fresh
@@ -82,20 +84,28 @@ static void warning(sptps_t *s, const char *format, ...) {
 // Send a record (datagram version, accepts all record types, handles encryption and authentication).
 // @return the sockerrno, 0 on success, -1 on other errors
 static int send_record_priv_datagram(sptps_t *s, uint8_t type, const void *data, uint16_t len) {
-	char buffer[len + 21UL];
+	char buffer[SPTPS_SESSIONID_SIZE + len + 21UL];
+	char *record = buffer;
+
+	// Once encrypted, prefix the datagram with the session ID, so the receiver can find the session with it
+	if(s->outstate && s->sessionids) {
+		uint32_t netsessionid = htonl(s->outsessionid);
+		memcpy(buffer, &netsessionid, SPTPS_SESSIONID_SIZE);
+		record += SPTPS_SESSIONID_SIZE;
+	}
 
 	// Create header with sequence number, length and record type
 	uint32_t seqno = s->outseqno++;
 	uint32_t netseqno = ntohl(seqno);
 
-	memcpy(buffer, &netseqno, 4);
-	buffer[4] = type;
-	memcpy(buffer + 5, data, len);
+	memcpy(record, &netseqno, 4);
+	record[4] = type;
+	memcpy(record + 5, data, len);
 
 	if(s->outstate) {
 		// If first handshake has finished, encrypt and HMAC
-		chacha_poly1305_encrypt(s->outcipher, seqno, buffer + 4, len + 1, buffer + 4, NULL);
-		return s->send_data(s->handle, type, buffer, len + 21UL);
+		chacha_poly1305_encrypt(s->outcipher, seqno, record + 4, len + 1, record + 4, NULL);
+		return s->send_data(s->handle, type, buffer, (record - buffer) + len + 21UL);
 	} else {
 		// Otherwise send as plaintext
 		return s->send_data(s->handle, type, buffer, len + 5UL);
@@ -145,6 +155,107 @@ int sptps_send_record(sptps_t *s, uint8_t type, const void *data, uint16_t len)
 	return send_record_priv(s, type, data, len);
 }
 
+// Write the header of an application record in front of its data, which must be preceded by SPTPS_HEADROOM bytes.
+// Returns the start of the record, *encrypted is set to the start of the part that gets encrypted.
+static char *write_inplace_header(sptps_t *s, uint8_t type, char *data, uint16_t len, uint32_t seqno, char **encrypted) {
+	char *record;
+
+	if(s->datagram) {
+		// Create header with sequence number and record type, and the session ID in front of it if used
+		uint32_t netseqno = htonl(seqno);
+		record = data - 5;
+		memcpy(record, &netseqno, 4);
+		record[4] = type;
+		*encrypted = record + 4;
+
+		if(s->sessionids) {
+			uint32_t netsessionid = htonl(s->outsessionid);
+			record -= SPTPS_SESSIONID_SIZE;
+			memcpy(record, &netsessionid, SPTPS_SESSIONID_SIZE);
+		}
+	} else {
+		// Create header with length and record type
+		uint16_t netlen = htons(len);
+		record = data - 3;
+		memcpy(record, &netlen, 2);
+		record[2] = type;
+		*encrypted = record + 2;
+	}
+
+	return record;
+}
+
+// Send an application record, encrypting it in place.
+// The data must be preceded by SPTPS_HEADROOM and followed by SPTPS_TAILROOM bytes that may be overwritten,
+// and the data itself is overwritten as well.
+// @return the sockerrno, 0 on success, -1 on other errors
+int sptps_send_record_inplace(sptps_t *s, uint8_t type, void *vdata, uint16_t len) {
+	char *data = vdata;
+
+	if(!s->outstate) {
+		error(s, EINVAL, "Handshake phase not finished yet");
+		return -1;
+	}
+
+	if(type >= SPTPS_HANDSHAKE) {
+		error(s, EINVAL, "Invalid application record type");
+		return -1;
+	}
+
+	uint32_t seqno = s->outseqno++;
+	char *encrypted;
+	char *record = write_inplace_header(s, type, data, len, seqno, &encrypted);
+
+	chacha_poly1305_encrypt(s->outcipher, seqno, encrypted, len + 1, encrypted, NULL);
+
+	return s->send_data(s->handle, type, record, (data - record) + len + SPTPS_TAILROOM);
+}
+
+// Send a number of application records of the same type, encrypting them in place.
+// Each record must have room around it like for sptps_send_record_inplace().
+// The records get consecutive sequence numbers and are passed to send_data() in order, even if one of them fails.
+// @return the sockerrno of the first record that failed to be sent, 0 on success, -1 on other errors
+int sptps_send_records(sptps_t *s, uint8_t type, void *const *data, const uint16_t *len, size_t count) {
+	if(!s->outstate) {
+		error(s, EINVAL, "Handshake phase not finished yet");
+		return -1;
+	}
+
+	if(type >= SPTPS_HANDSHAKE) {
+		error(s, EINVAL, "Invalid application record type");
+		return -1;
+	}
+
+	int result = 0;
+
+	for(size_t i = 0; i < count; i += SPTPS_BATCH) {
+		size_t n = count - i < SPTPS_BATCH ? count - i : SPTPS_BATCH;
+		char *record[SPTPS_BATCH];
+		void *encrypted[SPTPS_BATCH];
+		size_t enclen[SPTPS_BATCH];
+		uint64_t seqno[SPTPS_BATCH];
+
+		for(size_t j = 0; j < n; j++) {
+			char *e;
+			seqno[j] = s->outseqno++;
+			record[j] = write_inplace_header(s, type, data[i + j], len[i + j], seqno[j], &e);
+			encrypted[j] = e;
+			enclen[j] = len[i + j] + 1;
+		}
+
+		chacha_poly1305_encrypt_batch(s->outcipher, n, seqno, encrypted, enclen);
+
+		for(size_t j = 0; j < n; j++) {
+			int err = s->send_data(s->handle, type, record[j], ((char *)data[i + j] - record[j]) + len[i + j] + SPTPS_TAILROOM);
+
+			if(err && !result)
+				result = err;
+		}
+	}
+
+	return result;
+}
+
 // Send a Key EXchange record, containing a random nonce and an ECDHE public key.
 static bool send_kex(sptps_t *s) {
 	size_t keylen = ECDH_SIZE;
@@ -156,8 +267,10 @@ static bool send_kex(sptps_t *s) {
 	if(!s->mykex)
 		return error(s, errno, strerror(errno));
 
-	// Set version byte to zero.
+	// Set version byte to zero, and announce the features we support in datagram mode.
 	s->mykex[0] = SPTPS_VERSION;
+	if(s->datagram)
+		s->mykex[0] |= SPTPS_KEX_SESSIONID;
 
 	// Create a random nonce.
 	randomize(s->mykex + 1, 32);
@@ -207,8 +320,10 @@ static bool generate_key_material(sptps_t *s, const char *shared, size_t len) {
 			return error(s, EINVAL, "Failed to open cipher");
 	}
 
-	// Allocate memory for key material
+	// Allocate memory for key material, plus the session IDs for both directions if needed
 	size_t keylen = 2 * CHACHA_POLY1305_KEYLEN;
+	if(s->sessionids)
+		keylen += 2 * SPTPS_SESSIONID_SIZE;
 
 	s->key = realloc(s->key, keylen);
 	if(!s->key)
@@ -238,6 +353,13 @@ static int send_ack(sptps_t *s) {
 	return send_record_priv(s, SPTPS_HANDSHAKE, "", 0);
 }
 
+// Get one of the session IDs from the key material, they follow the two keys.
+static uint32_t get_sessionid(const sptps_t *s, bool initiator) {
+	uint32_t sessionid;
+	memcpy(&sessionid, s->key + 2 * CHACHA_POLY1305_KEYLEN + (initiator ? SPTPS_SESSIONID_SIZE : 0), sizeof sessionid);
+	return ntohl(sessionid);
+}
+
 // Receive an ACKnowledgement record.
 static bool receive_ack(sptps_t *s, const char *data, uint16_t len) {
 	if(len)
@@ -251,10 +373,18 @@ static bool receive_ack(sptps_t *s, const char *data, uint16_t len) {
 			return error(s, EINVAL, "Failed to set counter");
 	}
 
+	if(s->sessionids)
+		s->insessionid = get_sessionid(s, !s->initiator);
+
 	free(s->key);
 	s->key = NULL;
 	s->instate = true;
 
+	// sptps_start() clears the whole state, so the generation has to be unique among all sessions
+	do
+		s->inkeygen = __atomic_add_fetch(&sptps_keygen, 1, __ATOMIC_RELAXED);
+	while(!s->inkeygen);
+
 	return true;
 }
 
@@ -299,6 +429,10 @@ static bool receive_sig(sptps_t *s, const char *data, uint16_t len) {
 	if(!ecdsa_verify(s->hiskey, msg, sizeof msg, data))
 		return error(s, EIO, "receive_sig: Failed to verify SIG record");
 
+	// Only use session IDs if both sides support them.
+	if(s->datagram && (s->hiskex[0] & s->mykex[0] & SPTPS_KEX_SESSIONID))
+		s->sessionids = true;
+
 	// Compute shared secret.
 	char shared[ECDH_SHARED_SIZE];
 	if(!ecdh_compute_shared(s->ecdh, s->hiskex + 1 + 32, shared))
@@ -332,6 +466,9 @@ static bool receive_sig(sptps_t *s, const char *data, uint16_t len) {
 			return error(s, EINVAL, "receive_sig: Failed to set key");
 	}
 
+	if(s->sessionids)
+		s->outsessionid = get_sessionid(s, s->initiator);
+
 	return true;
 }
 
@@ -391,23 +528,112 @@ bool sptps_verify_datagram(sptps_t *s, const void *data, size_t len) {
 	if (!s->instate)
 		return error(s, EIO, "SPTPS state not ready to verify this datagram");
 
-	if(len < 21)
+	size_t skip = s->sessionids ? SPTPS_SESSIONID_SIZE : 0;
+
+	if(len < skip + 21)
 		return error(s, EIO, "Received short packet in sptps_verify_datagram");
 
+	data += skip;
+	len -= skip;
+
 	uint32_t seqno;
 	memcpy(&seqno, data, 4);
 	seqno = ntohl(seqno);
 	// TODO: check whether seqno makes sense, to avoid CPU intensive decrypt
 
-	char buffer[len];
-	size_t outlen;
-	return chacha_poly1305_decrypt(s->incipher, seqno, data + 4, len - 4, buffer, &outlen);
+	return chacha_poly1305_verify(s->incipher, seqno, data + 4, len - 4);
+}
+
+// Mark the sequence numbers from..to (excluding to) as late in the replay window, in whole words at a time.
+// The bits they replace belong to sequence numbers that are now leaving the window, any that are still set were lost.
+static void mark_late(sptps_t *s, uint32_t from, uint32_t to) {
+	while(from != to) {
+		unsigned int bit = from % 64;
+		unsigned int bits = to - from < 64 - bit ? to - from : 64 - bit;
+		uint64_t mask = (bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1)) << bit;
+		uint64_t *word = &s->late[(from / 64) % s->latewords];
+
+		s->lost += __builtin_popcountll(*word & mask);
+		*word |= mask;
+		from += bits;
+	}
+}
+
+// Handle a datagram record that has already been decrypted and verified.
+// The buffer holds the decrypted record and must have room for len - 19 bytes, len is the size of the datagram on the wire, without the session ID.
+static bool receive_decrypted_datagram(sptps_t *s, uint32_t seqno, char *buffer, size_t len) {
+	// Replay protection using a sliding window of configurable size.
+	// s->inseqno is expected sequence number
+	// seqno is received sequence number
+	// s->late[] is a circular bitmap of 64 bit words, a 1 bit means a packet has not been received yet
+	// The bitmap contains bits for sequence numbers from s->inseqno - window to (but excluding) s->inseqno.
+	if(s->replaywin) {
+		uint64_t window = (uint64_t)s->latewords * 64;
+
+		if(seqno >= s->inseqno + window) {
+			// TODO: Prevent packets that jump far ahead of the queue from causing many others to be dropped.
+			warning(s, "Lost %d packets\n", seqno - s->inseqno);
+			// Mark all packets in the replay window as being late.
+			s->lost += seqno + 1 - window - s->inseqno;
+			for(unsigned int i = 0; i < s->latewords; i++) {
+				s->lost += __builtin_popcountll(s->late[i]);
+				s->late[i] = ~(uint64_t)0;
+			}
+		} else if (seqno < s->inseqno) {
+			// If the sequence number is farther in the past than the bitmap goes, or if the packet was already received, drop it.
+			if((s->inseqno >= window && seqno < s->inseqno - window) || !(s->late[(seqno / 64) % s->latewords] >> (seqno % 64) & 1))
+				return error(s, EIO, "Received late or replayed packet, seqno %d, last received %d\n", seqno, s->inseqno);
+		} else {
+			// Slide the window forward. If we missed some packets, they are marked in the bitmap as being late.
+			mark_late(s, s->inseqno, seqno + 1);
+		}
+
+		// Mark the current packet as not being late.
+		s->late[(seqno / 64) % s->latewords] &= ~((uint64_t)1 << (seqno % 64));
+	}
+
+	if(seqno >= s->inseqno)
+		s->inseqno = seqno + 1;
+
+	if(!s->inseqno)
+		s->received = 0;
+	else
+		s->received++;
+
+	// Append a NULL byte for safety.
+	buffer[len - 20] = 0;
+
+	uint8_t type = buffer[0];
+
+	if(type < SPTPS_HANDSHAKE) {
+		if(!s->instate)
+			return error(s, EIO, "Application record received before handshake finished");
+		if(!s->receive_record(s->handle, type, buffer + 1, len - 21)) {
+			return error(s, EIO, "Error: sptps_receive_data_datagram !s->receive_record()");
+		}
+	} else if(type == SPTPS_HANDSHAKE) {
+		if(!receive_handshake(s, buffer + 1, len - 21)) {
+			return error(s, EIO, "Error: sptps_receive_data_datagram !receive_handshake()");
+		}
+	} else {
+		return error(s, EIO, "Invalid record type %d", type);
+	}
+
+	return true;
 }
 
 // Receive incoming data, datagram version.
-static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t len) {
+// If inplace is true, the data is decrypted in place, otherwise it is left untouched.
+static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t len, bool inplace) {
 	const char *data = vdata;
 
+	if(s->instate && s->sessionids) {
+		if(len < SPTPS_SESSIONID_SIZE)
+			return error(s, EIO, "Received short packet in sptps_receive_data_datagram");
+		data += SPTPS_SESSIONID_SIZE;
+		len -= SPTPS_SESSIONID_SIZE;
+	}
+
 	if(len < (s->instate ? 21 : 5))
 		return error(s, EIO, "Received short packet in sptps_receive_data_datagram");
 
@@ -431,6 +657,15 @@ static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t le
 
 	// Decrypt
 
+	if(inplace) {
+		char *buffer = (char *)data + 4;
+
+		if(!chacha_poly1305_decrypt(s->incipher, seqno, buffer, len - 4, buffer, NULL))
+			return error(s, EIO, "Failed to decrypt and verify packet");
+
+		return receive_decrypted_datagram(s, seqno, buffer, len);
+	}
+
 	char buffer[len];
 
 	size_t outlen;
@@ -438,61 +673,129 @@ static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t le
 	if(!chacha_poly1305_decrypt(s->incipher, seqno, data + 4, len - 4, buffer, &outlen))
 		return error(s, EIO, "Failed to decrypt and verify packet");
 
-	// Replay protection using a sliding window of configurable size.
-	// s->inseqno is expected sequence number
-	// seqno is received sequence number
-	// s->late[] is a circular buffer, a 1 bit means a packet has not been received yet
-	// The circular buffer contains bits for sequence numbers from s->inseqno - s->replaywin * 8 to (but excluding) s->inseqno.
-	if(s->replaywin) {
-		if(seqno != s->inseqno) {
-			if(seqno >= s->inseqno + s->replaywin * 8) {
-				// TODO: Prevent packets that jump far ahead of the queue from causing many others to be dropped.
-				warning(s, "Lost %d packets\n", seqno - s->inseqno);
-				// Mark all packets in the replay window as being late.
-				memset(s->late, 255, s->replaywin);
-			} else if (seqno < s->inseqno) {
-				// If the sequence number is farther in the past than the bitmap goes, or if the packet was already received, drop it.
-				if((s->inseqno >= s->replaywin * 8 && seqno < s->inseqno - s->replaywin * 8) || !(s->late[(seqno / 8) % s->replaywin] & (1 << seqno % 8)))
-					return error(s, EIO, "Received late or replayed packet, seqno %d, last received %d\n", seqno, s->inseqno);
-			} else {
-				// We missed some packets. Mark them in the bitmap as being late.
-				for(int i = s->inseqno; i < seqno; i++)
-					s->late[(i / 8) % s->replaywin] |= 1 << i % 8;
-			}
-		}
+	return receive_decrypted_datagram(s, seqno, buffer, len);
+}
 
-		// Mark the current packet as not being late.
-		s->late[(seqno / 8) % s->replaywin] &= ~(1 << seqno % 8);
-	}
+// Take a copy of the current receive key, so datagrams can be decrypted by another thread with sptps_decrypt_datagram().
+// The key's generation is returned as well, to check that the session still uses it before calling sptps_receive_decrypted_datagram().
+bool sptps_copy_incipher(sptps_t *s, chacha_poly1305_ctx_t *ctx, uint32_t *keygen) {
+	if(!s->state || !s->datagram || !s->instate)
+		return false;
 
-	if(seqno >= s->inseqno)
-		s->inseqno = seqno + 1;
+	chacha_poly1305_copy(ctx, s->incipher);
+	*keygen = s->inkeygen;
+	return true;
+}
 
-	if(!s->inseqno)
-		s->received = 0;
-	else
-		s->received++;
+// Get the session ID from a datagram, if the session it belongs to uses them.
+bool sptps_datagram_sessionid(const void *data, size_t len, uint32_t *sessionid) {
+	if(len < SPTPS_SESSIONID_SIZE + 21)
+		return false;
 
-	// Append a NULL byte for safety.
-	buffer[len - 20] = 0;
+	memcpy(sessionid, data, sizeof *sessionid);
+	*sessionid = ntohl(*sessionid);
+	return true;
+}
 
-	uint8_t type = buffer[0];
+// Decrypt and verify a datagram without touching the session state.
+// The data must not include the session ID. The buffer must have room for len - 19 bytes,
+// it can be data + 4 to decrypt the datagram in place.
+bool sptps_decrypt_datagram(chacha_poly1305_ctx_t *ctx, const void *vdata, size_t len, void *buffer, uint32_t *seqno) {
+	const char *data = vdata;
 
-	if(type < SPTPS_HANDSHAKE) {
-		if(!s->instate)
-			return error(s, EIO, "Application record received before handshake finished");
-		if(!s->receive_record(s->handle, type, buffer + 1, len - 21)) {
-			return error(s, EIO, "Error: sptps_receive_data_datagram !s->receive_record()");
+	if(len < 21)
+		return false;
+
+	memcpy(seqno, data, 4);
+	*seqno = ntohl(*seqno);
+
+	size_t outlen;
+	return chacha_poly1305_decrypt(ctx, *seqno, data + 4, len - 4, buffer, &outlen);
+}
+
+// Continue handling a datagram decrypted by sptps_decrypt_datagram(), checks for replays and passes the record on.
+// The len is that of the datagram that was passed to sptps_decrypt_datagram().
+bool sptps_receive_decrypted_datagram(sptps_t *s, uint32_t seqno, void *buffer, size_t len) {
+	if(!s->state || !s->datagram || !s->instate)
+		return error(s, EIO, "SPTPS state not ready to receive this datagram");
+
+	return receive_decrypted_datagram(s, seqno, buffer, len);
+}
+
+// Receive a datagram, like sptps_receive_data(), but decrypt it in place to avoid a copy.
+// The record passed to the receive_record callback points into the data.
+bool sptps_receive_datagram(sptps_t *s, void *data, size_t len) {
+	if(!s->state)
+		return error(s, EIO, "Invalid session state zero");
+
+	if(!s->datagram)
+		return error(s, EINVAL, "Not a datagram session");
+
+	return sptps_receive_data_datagram(s, data, len, true);
+}
+
+// Receive a number of datagrams, decrypting them in place.
+// This has the same effect as calling sptps_receive_datagram() for each of them in order,
+// except that datagrams encrypted with the key that was current at the start of a batch
+// are still accepted if a rekey happens halfway through it.
+// @return the number of datagrams that were accepted
+size_t sptps_receive_datagrams(sptps_t *s, void *const *data, const size_t *len, size_t count) {
+	size_t accepted = 0;
+
+	for(size_t i = 0; i < count; i += SPTPS_BATCH) {
+		size_t n = count - i < SPTPS_BATCH ? count - i : SPTPS_BATCH;
+
+		// Before the handshake has finished, records are not encrypted
+		if(!s->state || !s->datagram || !s->instate) {
+			for(size_t j = 0; j < n; j++)
+				if(sptps_receive_datagram(s, data[i + j], len[i + j]))
+					accepted++;
+
+			continue;
 		}
-	} else if(type == SPTPS_HANDSHAKE) {
-		if(!receive_handshake(s, buffer + 1, len - 21)) {
-			return error(s, EIO, "Error: sptps_receive_data_datagram !receive_handshake()");
+
+		size_t skip = s->sessionids ? SPTPS_SESSIONID_SIZE : 0;
+		void *encrypted[SPTPS_BATCH];
+		size_t enclen[SPTPS_BATCH];
+		uint64_t seqno[SPTPS_BATCH];
+		bool valid[SPTPS_BATCH];
+
+		for(size_t j = 0; j < n; j++) {
+			char *datagram = (char *)data[i + j] + skip;
+			uint32_t netseqno;
+
+			// Let the regular code complain about short datagrams
+			if(len[i + j] < skip + 21) {
+				encrypted[j] = datagram;
+				enclen[j] = 0;
+				seqno[j] = 0;
+				continue;
+			}
+
+			memcpy(&netseqno, datagram, 4);
+			seqno[j] = ntohl(netseqno);
+			encrypted[j] = datagram + 4;
+			enclen[j] = len[i + j] - skip - 4;
+		}
+
+		chacha_poly1305_decrypt_batch(s->incipher, n, seqno, encrypted, enclen, valid);
+
+		// Records are passed on in order, ones that could not be decrypted are tried again the regular way,
+		// in case an earlier record in this batch changed the key.
+		for(size_t j = 0; j < n; j++) {
+			bool ok;
+
+			if(valid[j])
+				ok = receive_decrypted_datagram(s, seqno[j], encrypted[j], len[i + j] - skip);
+			else
+				ok = sptps_receive_data_datagram(s, data[i + j], len[i + j], true);
+
+			if(ok)
+				accepted++;
 		}
-	} else {
-		return error(s, EIO, "Invalid record type %d", type);
 	}
 
-	return true;
+	return accepted;
 }
 
 // Receive incoming data. Check if it contains a complete record, if so, handle it.
@@ -501,7 +804,7 @@ bool sptps_receive_data(sptps_t *s, const void *data, size_t len) {
 		return error(s, EIO, "Invalid session state zero");
 
 	if(s->datagram)
-		return sptps_receive_data_datagram(s, data, len);
+		return sptps_receive_data_datagram(s, data, len, false);
 
 	while(len) {
 		// First read the 2 length bytes.
@@ -595,13 +898,8 @@ bool sptps_start(sptps_t *s, void *handle, bool initiator, bool datagram, ecdsa_
 	s->datagram = datagram;
 	s->mykey = mykey;
 	s->hiskey = hiskey;
-	s->replaywin = sptps_replaywin;
-	if(s->replaywin) {
-		s->late = malloc(s->replaywin);
-		if(!s->late)
-			return error(s, errno, strerror(errno));
-		memset(s->late, 0, s->replaywin);
-	}
+	if(!sptps_set_replaywin(s, sptps_replaywin))
+		return false;
 
 	s->label = malloc(labellen);
 	if(!s->label)
@@ -641,13 +939,45 @@ bool sptps_stop(sptps_t *s) {
 	return true;
 }
 
+// Change the size of the replay window of a session, in bytes.
+// The window is rounded up to whole 64 bit words, so the cost of sliding it does not grow with its size.
+// Sequence numbers that are in both the old and the new window keep their state,
+// older ones that only fit in the new window are treated as already received.
+bool sptps_set_replaywin(sptps_t *s, unsigned int replaywin) {
+	unsigned int latewords = replaywin / 8 + (replaywin % 8 != 0);
+	uint64_t *late = NULL;
+
+	if(latewords) {
+		late = calloc(latewords, sizeof *late);
+		if(!late)
+			return error(s, errno, strerror(errno));
+	}
+
+	if(late && s->late) {
+		uint64_t window = (uint64_t)(latewords < s->latewords ? latewords : s->latewords) * 64;
+
+		for(uint32_t seqno = s->inseqno - 1; window && seqno < s->inseqno; seqno--, window--)
+			if(s->late[(seqno / 64) % s->latewords] >> (seqno % 64) & 1)
+				late[(seqno / 64) % latewords] |= (uint64_t)1 << (seqno % 64);
+	}
+
+	free(s->late);
+	s->late = late;
+	s->latewords = latewords;
+	s->replaywin = replaywin;
+	return true;
+}
+
 uint16_t sptps_maxmtu(sptps_t *s) {
 	if(!s) {
 		// return smaller of the two
 		return SPTPS_DATAGRAM_MTU;
 	}
 
-	return s->datagram ? SPTPS_DATAGRAM_MTU: SPTPS_MTU;
+	if(s->datagram)
+		return s->sessionids ? SPTPS_DATAGRAM_MTU - SPTPS_SESSIONID_SIZE : SPTPS_DATAGRAM_MTU;
+
+	return SPTPS_MTU;
 }
 
 uint16_t sptps_overhead(sptps_t *s) {
@@ -656,5 +986,8 @@ uint16_t sptps_overhead(sptps_t *s) {
 		return SPTPS_DATAGRAM_OVERHEAD;
 	}
 
-	return s->datagram ? SPTPS_DATAGRAM_OVERHEAD : SPTPS_OVERHEAD;
+	if(s->datagram)
+		return s->sessionids ? SPTPS_DATAGRAM_OVERHEAD + SPTPS_SESSIONID_SIZE : SPTPS_DATAGRAM_OVERHEAD;
+
+	return SPTPS_OVERHEAD;
 }
@@ -29,6 +29,23 @@
 
 #define SPTPS_VERSION 0
 
+// Flags in the version byte of KEX records
+#define SPTPS_KEX_SESSIONID 0x80  // Datagrams can start with a session ID
+
+// Size of the session ID in front of datagrams
+#define SPTPS_SESSIONID_SIZE 4
+
+// Room needed around the data passed to sptps_send_record_inplace()
+#define SPTPS_HEADROOM (SPTPS_SESSIONID_SIZE + 5)
+#define SPTPS_TAILROOM 16
+
+// Maximum number of records encrypted or decrypted together by the batch functions
+#define SPTPS_BATCH 8
+
+#if SPTPS_HEADROOM > PACKET_HEADROOM
+#error "PACKET_HEADROOM too small for in place encryption"
+#endif
+
 // Record types
 #define SPTPS_HANDSHAKE 128   // Key exchange and authentication
 #define SPTPS_ALERT 129       // Warning or error messages
@@ -61,12 +78,19 @@ typedef struct sptps {
 	size_t buflen;
 	uint16_t reclen;
 
+	bool sessionids;                // both sides put a session ID in front of encrypted datagrams
+	uint32_t insessionid;
+	uint32_t outsessionid;
+
 	bool instate;
 	chacha_poly1305_ctx_t *incipher;
+	uint32_t inkeygen;              // changes with every new receive key, also across restarts of the session, 0 if there is none
 	uint32_t inseqno;
 	uint32_t received;
-	unsigned int replaywin;
-	char *late;
+	uint32_t lost;                  // packets that left the replay window without being received
+	unsigned int replaywin;         // size of the replay window in bytes, 0 to disable replay protection
+	unsigned int latewords;
+	uint64_t *late;
 
 	bool outstate;
 	chacha_poly1305_ctx_t *outcipher;
@@ -93,11 +117,22 @@ extern void sptps_log_stderr(sptps_t *s, int s_errno, const char *format, va_lis
 extern void (*sptps_log)(sptps_t *s, int s_errno, const char *format, va_list ap);
 extern bool sptps_start(sptps_t *s, void *handle, bool initiator, bool datagram, ecdsa_t *mykey, ecdsa_t *hiskey, const char *label, size_t labellen, send_data_t send_data, receive_record_t receive_record);
 extern bool sptps_stop(sptps_t *s);
+extern bool sptps_set_replaywin(sptps_t *s, unsigned int replaywin);
 // @return the sockerrno, 0 on success, -1 on other errors
 extern int sptps_send_record(sptps_t *s, uint8_t type, const void *data, uint16_t len);
+// @return the sockerrno, 0 on success, -1 on other errors
+extern int sptps_send_record_inplace(sptps_t *s, uint8_t type, void *data, uint16_t len);
+// @return the sockerrno of the first failed record, 0 on success, -1 on other errors
+extern int sptps_send_records(sptps_t *s, uint8_t type, void *const *data, const uint16_t *len, size_t count);
 extern bool sptps_receive_data(sptps_t *s, const void *data, size_t len);
+extern bool sptps_receive_datagram(sptps_t *s, void *data, size_t len);
+extern size_t sptps_receive_datagrams(sptps_t *s, void *const *data, const size_t *len, size_t count);
 extern bool sptps_force_kex(sptps_t *s);
 extern bool sptps_verify_datagram(sptps_t *s, const void *data, size_t len);
+extern bool sptps_copy_incipher(sptps_t *s, chacha_poly1305_ctx_t *ctx, uint32_t *keygen);
+extern bool sptps_decrypt_datagram(chacha_poly1305_ctx_t *ctx, const void *data, size_t len, void *buffer, uint32_t *seqno);
+extern bool sptps_receive_decrypted_datagram(sptps_t *s, uint32_t seqno, void *buffer, size_t len);
+extern bool sptps_datagram_sessionid(const void *data, size_t len, uint32_t *sessionid);
 // max pre-encryption payload size
 extern uint16_t sptps_maxmtu(sptps_t *s);
 // number of bytes of packet needed by sptps for encryption and compression
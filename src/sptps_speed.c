@@ -21,6 +21,9 @@
 
 #include <poll.h>
 
+#include "chacha-poly1305/chacha.h"
+#include "chacha-poly1305/chacha-poly1305.h"
+#include "chacha-poly1305/poly1305.h"
 #include "crypto.h"
 #include "ecdh.h"
 #include "ecdsa.h"
@@ -42,6 +45,22 @@ static int send_data(void *handle, uint8_t type, const void *data, size_t len) {
 	return 0;
 }
 
+// Records sent by the batch benchmark are collected here instead of being sent
+#define BATCHSIZE 32
+static char *captured[BATCHSIZE];
+static size_t capturedlen[BATCHSIZE];
+static int ncaptured;
+
+static int capture_data(void *handle, uint8_t type, const void *data, size_t len) {
+	if(type == 0 && ncaptured < BATCHSIZE) {
+		captured[ncaptured] = (char *)data;
+		capturedlen[ncaptured++] = len;
+		return 0;
+	}
+
+	return send_data(handle, type, data, len);
+}
+
 static bool receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
 	return true;
 }
@@ -77,6 +96,52 @@ static bool clock_countto(double seconds) {
 	return false;
 }
 
+// Reference implementation that encrypts and authenticates in two separate passes over the data.
+static void twopass_encrypt(struct chacha_ctx *ctx, uint64_t seqnr, const uint8_t *indata, size_t inlen, uint8_t *outdata) {
+	uint8_t seqbuf[8];
+	const uint8_t one[8] = {1};
+	uint8_t poly_key[POLY1305_KEYLEN] = {0};
+
+	for(int i = 0; i < 8; i++)
+		seqbuf[i] = seqnr >> (56 - 8 * i);
+
+	chacha_ivsetup(ctx, seqbuf, NULL);
+	chacha_encrypt_bytes(ctx, poly_key, poly_key, sizeof poly_key);
+	chacha_ivsetup(ctx, seqbuf, one);
+	chacha_encrypt_bytes(ctx, indata, outdata, inlen);
+	poly1305_auth(outdata + inlen, outdata, inlen, poly_key);
+}
+
+static bool twopass_decrypt(struct chacha_ctx *ctx, uint64_t seqnr, const uint8_t *indata, size_t inlen, uint8_t *outdata) {
+	uint8_t seqbuf[8];
+	const uint8_t one[8] = {1};
+	uint8_t poly_key[POLY1305_KEYLEN] = {0};
+	uint8_t tag[POLY1305_TAGLEN];
+
+	for(int i = 0; i < 8; i++)
+		seqbuf[i] = seqnr >> (56 - 8 * i);
+
+	chacha_ivsetup(ctx, seqbuf, NULL);
+	chacha_encrypt_bytes(ctx, poly_key, poly_key, sizeof poly_key);
+	chacha_ivsetup(ctx, seqbuf, one);
+	inlen -= POLY1305_TAGLEN;
+	poly1305_auth(tag, indata, inlen, poly_key);
+	if(memcmp(tag, indata + inlen, POLY1305_TAGLEN))
+		return false;
+	chacha_encrypt_bytes(ctx, indata, outdata, inlen);
+	return true;
+}
+
+static void print_rate(double bytes_per_second) {
+	double rate = bytes_per_second * 8;
+	if(rate > 1e9)
+		fprintf(stderr, "%8.2lf Gbit/s", rate / 1e9);
+	else if(rate > 1e6)
+		fprintf(stderr, "%8.2lf Mbit/s", rate / 1e6);
+	else
+		fprintf(stderr, "%8.2lf kbit/s", rate / 1e3);
+}
+
 int main(int argc, char *argv[]) {
 	ecdsa_t *key1, *key2;
 	ecdh_t *ecdh1, *ecdh2;
@@ -121,6 +186,89 @@ int main(int argc, char *argv[]) {
 	fprintf(stderr, "%28.2lf op/s\n", rate);
 	ecdh_free(ecdh1);
 
+	// ChaCha20 kernels, encrypting a packet per operation
+
+	static const char *impls[] = {"scalar", "sse2", "ssse3", "avx2"};
+	const char *best_impl = chacha_get_impl();
+
+	for(size_t i = 0; i < sizeof impls / sizeof *impls; i++) {
+		struct chacha_ctx ctx;
+
+		if(!chacha_set_impl(impls[i]))
+			continue;
+
+		chacha_keysetup(&ctx, (uint8_t *)buf3, 256);
+		chacha_ivsetup(&ctx, (uint8_t *)buf3 + 32, NULL);
+
+		fprintf(stderr, "ChaCha20 %-6s 1451 bytes for %lg seconds: ", impls[i], duration);
+		for(clock_start(); clock_countto(duration);)
+			chacha_encrypt_bytes(&ctx, (uint8_t *)buf1, (uint8_t *)buf2, 1451);
+		print_rate(rate * 1451);
+		fprintf(stderr, "\n");
+	}
+
+	chacha_set_impl(best_impl);
+
+	// Poly1305 implementations, authenticating a packet per operation
+
+	static const char *poly1305_impls[] = {"scalar32", "scalar64", "avx2"};
+	best_impl = poly1305_get_impl();
+
+	for(size_t i = 0; i < sizeof poly1305_impls / sizeof *poly1305_impls; i++) {
+		if(!poly1305_set_impl(poly1305_impls[i]))
+			continue;
+
+		fprintf(stderr, "Poly1305 %-8s 1451 bytes for %lg seconds: ", poly1305_impls[i], duration);
+		for(clock_start(); clock_countto(duration);)
+			poly1305_auth((uint8_t *)buf2, (uint8_t *)buf1, 1451, (uint8_t *)buf3);
+		print_rate(rate * 1451);
+		fprintf(stderr, "\n");
+	}
+
+	poly1305_set_impl(best_impl);
+
+	// ChaCha20-Poly1305, encrypting and decrypting a packet per operation
+
+	static const size_t sizes[] = {64, 256, 512, 1024, 1451, 4000};
+	uint8_t key[CHACHA_POLY1305_KEYLEN];
+	struct chacha_ctx twopass;
+	chacha_poly1305_ctx_t *fused = chacha_poly1305_init();
+
+	randomize(key, sizeof key);
+	chacha_keysetup(&twopass, key, 256);
+	chacha_poly1305_set_key(fused, key);
+
+	for(size_t i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		size_t len = sizes[i];
+
+		chacha_poly1305_encrypt(fused, i, buf1, len, buf3, NULL);
+		twopass_encrypt(&twopass, i, (uint8_t *)buf1, len, (uint8_t *)buf2);
+		if(memcmp(buf2, buf3, len + POLY1305_TAGLEN)) {
+			fprintf(stderr, "Error: two-pass and fused ChaCha20-Poly1305 disagree");
+			abort();
+		}
+
+		fprintf(stderr, "ChaCha20-Poly1305 %4zu bytes for %lg seconds: two-pass ", len, duration);
+		for(clock_start(); clock_countto(duration);) {
+			twopass_encrypt(&twopass, count, (uint8_t *)buf1, len, (uint8_t *)buf2);
+			if(!twopass_decrypt(&twopass, count, (uint8_t *)buf2, len + POLY1305_TAGLEN, (uint8_t *)buf2))
+				abort();
+		}
+		double twopass_rate = rate;
+		print_rate(twopass_rate * len);
+
+		fprintf(stderr, ", fused ");
+		for(clock_start(); clock_countto(duration);) {
+			chacha_poly1305_encrypt(fused, count, buf1, len, buf2, NULL);
+			if(!chacha_poly1305_decrypt(fused, count, buf2, len + POLY1305_TAGLEN, buf2, NULL))
+				abort();
+		}
+		print_rate(rate * len);
+		fprintf(stderr, ", gain %+.1lf%%\n", (rate / twopass_rate - 1) * 100);
+	}
+
+	chacha_poly1305_exit(fused);
+
 	// SPTPS authentication phase
 
 	int fd[2];
@@ -227,6 +375,52 @@ int main(int argc, char *argv[]) {
 	sptps_stop(&sptps1);
 	sptps_stop(&sptps2);
 
+	// SPTPS datagram crypto, one record at a time versus batches, without sending anything
+
+	static char records[BATCHSIZE][PACKET_HEADROOM + 1451 + SPTPS_TAILROOM];
+	void *data[BATCHSIZE];
+	uint16_t len[BATCHSIZE];
+
+	for(int i = 0; i < BATCHSIZE; i++) {
+		data[i] = records[i] + PACKET_HEADROOM;
+		len[i] = 1451;
+	}
+
+	sptps_start(&sptps1, fd + 0, true, true, key1, key2, "sptps_speed", 11, capture_data, receive_record);
+	sptps_start(&sptps2, fd + 1, false, true, key2, key1, "sptps_speed", 11, capture_data, receive_record);
+	while(poll(pfd, 2, 0)) {
+		if(pfd[0].revents)
+			receive_data(&sptps1);
+		if(pfd[1].revents)
+			receive_data(&sptps2);
+	}
+	fprintf(stderr, "SPTPS/UDP crypto in batches of %d for %lg seconds: single ", BATCHSIZE, duration);
+	for(clock_start(); clock_countto(duration);) {
+		ncaptured = 0;
+		for(int i = 0; i < BATCHSIZE; i++)
+			sptps_send_record_inplace(&sptps1, 0, data[i], len[i]);
+		for(int i = 0; i < ncaptured; i++)
+			if(!sptps_receive_datagram(&sptps2, captured[i], capturedlen[i])) {
+				fprintf(stderr, "Error: sptps_receive_datagram failed");
+				abort();
+			}
+	}
+	double single_rate = rate;
+	print_rate(single_rate * BATCHSIZE * 1451);
+	fprintf(stderr, ", batched ");
+	for(clock_start(); clock_countto(duration);) {
+		ncaptured = 0;
+		sptps_send_records(&sptps1, 0, data, len, BATCHSIZE);
+		if(sptps_receive_datagrams(&sptps2, (void *const *)captured, capturedlen, ncaptured) != BATCHSIZE) {
+			fprintf(stderr, "Error: sptps_receive_datagrams failed");
+			abort();
+		}
+	}
+	print_rate(rate * BATCHSIZE * 1451);
+	fprintf(stderr, ", gain %+.1lf%%\n", (rate / single_rate - 1) * 100);
+	sptps_stop(&sptps1);
+	sptps_stop(&sptps2);
+
 	// Clean up
 
 	close(fd[0]);
@@ -0,0 +1,143 @@
+/*
+    timeout_speed.c -- timeout handling benchmark
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "event.h"
+#include "meshlink/meshlink.h"
+#include "splay_tree.h"
+
+// Symbols necessary to link with event.o and logger.o
+__thread meshlink_errno_t meshlink_errno;
+void *global_log_cb;
+int global_log_level;
+bool set_non_blocking_socket(int socket) { return true; }
+
+struct timespec start;
+struct timespec end;
+double elapsed;
+double rate;
+unsigned int count;
+
+static void clock_start() {
+	count = 0;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+}
+
+static bool clock_countto(double seconds) {
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	elapsed = end.tv_sec + end.tv_nsec * 1e-9 - start.tv_sec - start.tv_nsec * 1e-9;
+	if(elapsed < seconds)
+		return ++count;
+
+	rate = count / elapsed;
+	return false;
+}
+
+// The splay tree based timeout handling, as it was before the timing wheel.
+
+typedef struct splay_timeout_t {
+	struct timeval tv;
+	struct splay_node_t node;
+} splay_timeout_t;
+
+static int splay_timeout_compare(const splay_timeout_t *a, const splay_timeout_t *b) {
+	struct timeval diff;
+	timersub(&a->tv, &b->tv, &diff);
+	if(diff.tv_sec < 0)
+		return -1;
+	if(diff.tv_sec > 0)
+		return 1;
+	if(diff.tv_usec < 0)
+		return -1;
+	if(diff.tv_usec > 0)
+		return 1;
+	if(a < b)
+		return -1;
+	if(a > b)
+		return 1;
+	return 0;
+}
+
+static void splay_timeout_set(splay_tree_t *tree, splay_timeout_t *timeout, struct timeval *now, struct timeval *tv) {
+	if(timerisset(&timeout->tv))
+		splay_unlink_node(tree, &timeout->node);
+
+	timeradd(now, tv, &timeout->tv);
+	splay_insert_node(tree, &timeout->node);
+}
+
+static void timeout_handler(event_loop_t *loop, void *data) {
+}
+
+// Rearm random timeouts with an interval of around one second, like the MTU probe timers do.
+static struct timeval *random_interval(void) {
+	static struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = rand() % 100000;
+	return &tv;
+}
+
+int main(int argc, char *argv[]) {
+	double duration = argc > 1 ? atof(argv[1]) : 10;
+
+	for(int n = 10; n <= 100000; n *= 10) {
+		// Splay tree
+
+		splay_tree_t tree = {.compare = (splay_compare_t)splay_timeout_compare};
+		splay_timeout_t *stimeouts = calloc(n, sizeof *stimeouts);
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		for(int i = 0; i < n; i++) {
+			stimeouts[i].node.data = &stimeouts[i];
+			splay_timeout_set(&tree, &stimeouts[i], &now, random_interval());
+		}
+
+		fprintf(stderr, "Splay tree rearm with %6d timeouts for %lg seconds: ", n, duration);
+		for(clock_start(); clock_countto(duration);)
+			splay_timeout_set(&tree, &stimeouts[rand() % n], &now, random_interval());
+		fprintf(stderr, "%14.2lf op/s\n", rate);
+
+		free(stimeouts);
+
+		// Timing wheel
+
+		event_loop_t *loop = calloc(1, sizeof *loop);
+		event_loop_init(loop);
+		timeout_t *timeouts = calloc(n, sizeof *timeouts);
+
+		for(int i = 0; i < n; i++)
+			timeout_add(loop, &timeouts[i], timeout_handler, &timeouts[i], random_interval());
+
+		fprintf(stderr, "Timing wheel rearm with %6d timeouts for %lg seconds: ", n, duration);
+		for(clock_start(); clock_countto(duration);)
+			timeout_set(loop, &timeouts[rand() % n], random_interval());
+		fprintf(stderr, "%12.2lf op/s\n", rate);
+
+		for(int i = 0; i < n; i++)
+			timeout_del(loop, &timeouts[i]);
+
+		event_loop_exit(loop);
+		free(timeouts);
+		free(loop);
+	}
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+    udp_speed.c -- UDP receive path benchmark
+    Copyright (C) 2026 The MeshLink contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "net.h"
+
+// Fills a loopback UDP socket with a burst of packets, then measures how fast
+// the receiving side drains it, once with one recvfrom() per packet like before,
+// and once with recvmmsg() batches. Only the time spent receiving is counted.
+
+#define BURST 64                /* small enough to fit in the default receive buffer */
+
+static int packetsize = 1000;
+
+double elapsed;
+double rate;
+unsigned int count;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int open_socket(const struct sockaddr_in *sa, bool receiver) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0) {
+		fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	if(receiver) {
+		if(bind(fd, (const struct sockaddr *)sa, sizeof *sa)) {
+			fprintf(stderr, "Could not bind socket: %s\n", strerror(errno));
+			exit(1);
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+	} else if(connect(fd, (const struct sockaddr *)sa, sizeof *sa)) {
+		fprintf(stderr, "Could not connect socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+// receive everything that is queued on the socket, return the number of packets
+static int receive_recvfrom(int fd) {
+	static uint8_t data[MAXSIZE];
+	sockaddr_t from;
+	int n = 0;
+
+	for(;;) {
+		socklen_t fromlen = sizeof from;
+		if(recvfrom(fd, data, sizeof data, 0, &from.sa, &fromlen) <= 0)
+			return n;
+		n++;
+	}
+}
+
+#ifdef HAVE_RECVMMSG
+static int receive_recvmmsg(int fd) {
+	static uint8_t data[UDP_RECV_BATCH][MAXSIZE];
+	static sockaddr_t from[UDP_RECV_BATCH];
+	static struct mmsghdr msg[UDP_RECV_BATCH];
+	static struct iovec iov[UDP_RECV_BATCH];
+	int n = 0;
+
+	for(int i = 0; i < UDP_RECV_BATCH; i++) {
+		iov[i].iov_base = data[i];
+		iov[i].iov_len = MAXSIZE;
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_name = &from[i];
+	}
+
+	for(;;) {
+		for(int i = 0; i < UDP_RECV_BATCH; i++)
+			msg[i].msg_hdr.msg_namelen = sizeof from[i];
+
+		int result = recvmmsg(fd, msg, UDP_RECV_BATCH, 0, NULL);
+		if(result <= 0)
+			return n;
+		n += result;
+	}
+}
+#endif
+
+static void run(const char *name, int (*receive)(int fd), double duration) {
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t salen = sizeof sa;
+	static char buf[MAXSIZE];
+
+	int rfd = open_socket(&sa, true);
+	getsockname(rfd, (struct sockaddr *)&sa, &salen);
+	int sfd = open_socket(&sa, false);
+
+	fprintf(stderr, "Receiving %d byte packets with %-8s for %lg seconds: ", packetsize, name, duration);
+
+	count = 0;
+	elapsed = 0;
+
+	while(elapsed < duration) {
+		for(int i = 0; i < BURST; i++)
+			send(sfd, buf, packetsize, 0);
+
+		double begin = now();
+		count += receive(rfd);
+		elapsed += now() - begin;
+	}
+
+	rate = count / elapsed;
+	fprintf(stderr, "%14.2lf packets/s\n", rate);
+
+	close(sfd);
+	close(rfd);
+}
+
+int main(int argc, char *argv[]) {
+	double duration = argc > 1 ? atof(argv[1]) : 10;
+
+	if(argc > 2)
+		packetsize = atoi(argv[2]);
+
+	if(packetsize <= 0 || packetsize > MAXSIZE) {
+		fprintf(stderr, "Usage: %s [seconds] [packet size]\n", argv[0]);
+		return 1;
+	}
+
+	run("recvfrom", receive_recvfrom, duration);
+#ifdef HAVE_RECVMMSG
+	run("recvmmsg", receive_recvmmsg, duration);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "chacha-poly1305/chacha.h"
+#include "chacha-poly1305/chacha-poly1305.h"
+#include "chacha-poly1305/poly1305.h"
+
+// Known answer tests from RFC 7539. Our ChaCha20 uses a 64 bit nonce and a 64 bit block counter,
+// with the same state layout, so the RFC's 96 bit nonce is expressed as the high counter word plus our nonce.
+
+static const uint8_t rfc_key[32] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+// Section 2.4.2
+static const char sunscreen[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+static const uint8_t sunscreen_ciphertext[114] = {
+	0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+	0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+	0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+	0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+	0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+	0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+	0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+	0x87, 0x4d,
+};
+
+// Appendix A.1, test vectors 1 and 2: the keystream for an all-zero key and nonce, blocks 0 and 1
+static const uint8_t zero_keystream[128] = {
+	0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+	0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+	0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+	0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86,
+	0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a, 0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+	0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69, 0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+	0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43, 0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+	0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45, 0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f,
+};
+
+// Section 2.5.2
+static const uint8_t poly1305_key[32] = {
+	0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+	0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b,
+};
+
+static const char poly1305_message[] = "Cryptographic Forum Research Group";
+
+static const uint8_t poly1305_tag[16] = {
+	0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9,
+};
+
+static const char *impls[] = {"scalar", "sse2", "ssse3", "avx2"};
+static const char *poly1305_impls[] = {"scalar32", "scalar64", "avx2"};
+
+static uint8_t reference[4096], data[4096], buffer[4096 + 16];
+
+static bool known_answers(void) {
+	struct chacha_ctx ctx;
+	const uint8_t counter[8] = {1, 0, 0, 0, 0, 0, 0, 0};
+	const uint8_t nonce[8] = {0, 0, 0, 0x4a, 0, 0, 0, 0};
+	const uint8_t zero[32] = {0};
+
+	chacha_keysetup(&ctx, rfc_key, 256);
+	chacha_ivsetup(&ctx, nonce, counter);
+	chacha_encrypt_bytes(&ctx, (const uint8_t *)sunscreen, buffer, sizeof sunscreen_ciphertext);
+
+	if(memcmp(buffer, sunscreen_ciphertext, sizeof sunscreen_ciphertext)) {
+		return false;
+	}
+
+	memset(buffer, 0, sizeof zero_keystream);
+	chacha_keysetup(&ctx, zero, 256);
+	chacha_ivsetup(&ctx, zero, NULL);
+	chacha_encrypt_bytes(&ctx, buffer, buffer, sizeof zero_keystream);
+
+	return !memcmp(buffer, zero_keystream, sizeof zero_keystream);
+}
+
+// Encrypt data in pieces of the given size, starting with a block counter close to wrapping around.
+static void encrypt_pieces(const uint8_t *key, size_t len, size_t piece, uint8_t *out) {
+	struct chacha_ctx ctx;
+	const uint8_t counter[8] = {0xfa, 0xff, 0xff, 0xff, 0, 0, 0, 0};
+	const uint8_t nonce[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+	chacha_keysetup(&ctx, key, 256);
+	chacha_ivsetup(&ctx, nonce, counter);
+
+	for(size_t i = 0; i < len; i += piece) {
+		chacha_encrypt_bytes(&ctx, data + i, out + i, len - i < piece ? len - i : piece);
+	}
+}
+
+// Authenticate data in pieces of the given size.
+static void poly1305_pieces(const uint8_t *key, size_t len, size_t piece, uint8_t *tag) {
+	poly1305_state_t st;
+
+	poly1305_init(&st, key);
+
+	for(size_t i = 0; i < len; i += piece) {
+		poly1305_update(&st, data + i, len - i < piece ? len - i : piece);
+	}
+
+	poly1305_finish(&st, tag);
+}
+
+static bool test_poly1305(const uint8_t *key) {
+	uint8_t tag[16], reference_tag[16];
+
+	for(size_t i = 0; i < sizeof poly1305_impls / sizeof *poly1305_impls; i++) {
+		if(!poly1305_set_impl(poly1305_impls[i])) {
+			fprintf(stderr, "Skipping unsupported Poly1305 implementation %s\n", poly1305_impls[i]);
+			continue;
+		}
+
+		poly1305_auth(tag, (const uint8_t *)poly1305_message, strlen(poly1305_message), poly1305_key);
+
+		if(memcmp(tag, poly1305_tag, sizeof tag)) {
+			fprintf(stderr, "Poly1305 implementation %s fails known answer test\n", poly1305_impls[i]);
+			return false;
+		}
+
+		// Compare against the 32 bit implementation for all lengths, both in one go and in pieces.
+
+		for(size_t len = 0; len <= 2100; len++) {
+			poly1305_set_impl("scalar32");
+			poly1305_pieces(key, len, len ? len : 1, reference_tag);
+			poly1305_set_impl(poly1305_impls[i]);
+			poly1305_pieces(key, len, len ? len : 1, tag);
+
+			if(memcmp(tag, reference_tag, sizeof tag)) {
+				fprintf(stderr, "Poly1305 implementation %s differs from scalar32 at length %zu\n", poly1305_impls[i], len);
+				return false;
+			}
+
+			poly1305_pieces(key, len, 300, tag);
+
+			if(memcmp(tag, reference_tag, sizeof tag)) {
+				fprintf(stderr, "Poly1305 implementation %s differs from scalar32 at length %zu in pieces\n", poly1305_impls[i], len);
+				return false;
+			}
+		}
+
+		// Keys with all bits set that clamping allows, and data with all bits set, give the largest intermediate values.
+
+		uint8_t max_key[32];
+		memset(max_key, 0xff, sizeof max_key);
+		memset(data, 0xff, sizeof data);
+		poly1305_set_impl("scalar32");
+		poly1305_pieces(max_key, sizeof data, sizeof data, reference_tag);
+		poly1305_set_impl(poly1305_impls[i]);
+		poly1305_pieces(max_key, sizeof data, sizeof data, tag);
+
+		for(size_t j = 0; j < sizeof data; j++) {
+			data[j] = rand();
+		}
+
+		if(memcmp(tag, reference_tag, sizeof tag)) {
+			fprintf(stderr, "Poly1305 implementation %s differs from scalar32 with maximum values\n", poly1305_impls[i]);
+			return false;
+		}
+	}
+
+	poly1305_set_impl(NULL);
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t key[CHACHA_POLY1305_KEYLEN];
+
+	srand(1);
+
+	for(size_t i = 0; i < sizeof key; i++) {
+		key[i] = rand();
+	}
+
+	for(size_t i = 0; i < sizeof data; i++) {
+		data[i] = rand();
+	}
+
+	if(!test_poly1305(key)) {
+		return 1;
+	}
+
+	for(size_t i = 0; i < sizeof impls / sizeof *impls; i++) {
+		if(!chacha_set_impl(impls[i])) {
+			fprintf(stderr, "Skipping unsupported ChaCha20 implementation %s\n", impls[i]);
+			continue;
+		}
+
+		if(!known_answers()) {
+			fprintf(stderr, "ChaCha20 implementation %s fails known answer tests\n", impls[i]);
+			return 1;
+		}
+
+		// Compare against the scalar implementation for all lengths, both in one go and in pieces.
+
+		for(size_t len = 0; len <= 1600; len++) {
+			chacha_set_impl("scalar");
+			encrypt_pieces(key, len, len ? len : 1, reference);
+			chacha_set_impl(impls[i]);
+			encrypt_pieces(key, len, len ? len : 1, buffer);
+
+			if(memcmp(buffer, reference, len)) {
+				fprintf(stderr, "ChaCha20 implementation %s differs from scalar at length %zu\n", impls[i], len);
+				return 1;
+			}
+
+			encrypt_pieces(key, len, 192, buffer);
+
+			if(memcmp(buffer, reference, len)) {
+				fprintf(stderr, "ChaCha20 implementation %s differs from scalar at length %zu in pieces\n", impls[i], len);
+				return 1;
+			}
+		}
+
+		// Round trip through the AEAD construction, in place.
+
+		chacha_poly1305_ctx_t *ctx = chacha_poly1305_init();
+		chacha_poly1305_set_key(ctx, key);
+
+		for(size_t len = 0; len <= sizeof data; len += 97) {
+			memcpy(buffer, data, len);
+			chacha_poly1305_encrypt(ctx, len, buffer, len, buffer, NULL);
+
+			if(!chacha_poly1305_decrypt(ctx, len, buffer, len + 16, buffer, NULL) || memcmp(buffer, data, len)) {
+				fprintf(stderr, "ChaCha20-Poly1305 round trip fails with %s at length %zu\n", impls[i], len);
+				return 1;
+			}
+		}
+
+		// Batches must give the same result as single records, and a bad record must not affect the others.
+
+		for(size_t count = 1; count <= 20; count++) {
+			void *records[20];
+			size_t lens[20];
+			uint64_t seqnrs[20];
+			bool valid[20];
+
+			for(size_t j = 0; j < count; j++) {
+				records[j] = buffer + j * 200;
+				lens[j] = j * 11 % 184;
+				seqnrs[j] = 1000 + j * 3;
+				memcpy(records[j], data + j, lens[j]);
+			}
+
+			chacha_poly1305_encrypt_batch(ctx, count, seqnrs, records, lens);
+
+			for(size_t j = 0; j < count; j++) {
+				chacha_poly1305_encrypt(ctx, seqnrs[j], data + j, lens[j], reference, NULL);
+
+				if(memcmp(records[j], reference, lens[j] + 16)) {
+					fprintf(stderr, "ChaCha20-Poly1305 batch encryption differs with %s for record %zu of %zu\n", impls[i], j, count);
+					return 1;
+				}
+
+				lens[j] += 16;
+			}
+
+			((uint8_t *)records[count / 2])[0] ^= 1;
+
+			if(chacha_poly1305_decrypt_batch(ctx, count, seqnrs, records, lens, valid) != count - 1) {
+				fprintf(stderr, "ChaCha20-Poly1305 batch decryption fails with %s for %zu records\n", impls[i], count);
+				return 1;
+			}
+
+			for(size_t j = 0; j < count; j++) {
+				if(valid[j] != (j != count / 2) || (valid[j] && memcmp(records[j], data + j, lens[j] - 16))) {
+					fprintf(stderr, "ChaCha20-Poly1305 batch decryption gives wrong result with %s for record %zu of %zu\n", impls[i], j, count);
+					return 1;
+				}
+			}
+		}
+
+		chacha_poly1305_exit(ctx);
+	}
+
+	return 0;
+}
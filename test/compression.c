@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "compression.h"
+
+// Round-trips a packet through every level MeshLink was built with, from one node's compression state to another's,
+// and checks which levels two nodes agree on, and keep using, depending on their dictionaries.
+
+#define MAXPACKET 1500
+
+static const int levels[] = {COMPRESS_NONE, COMPRESS_ZLIB_MIN, COMPRESS_ZLIB_MAX, COMPRESS_LZ4, COMPRESS_LZ4_DICT, COMPRESS_ZSTD, COMPRESS_ZSTD_DICT};
+
+static const char dict1[] = "{\"sensor\": \"temperature\", \"unit\": \"celsius\", \"value\": 21.5, \"timestamp\": 1500000000}";
+static const char dict2[] = "{\"sensor\": \"humidity\", \"unit\": \"percent\", \"value\": 45.0, \"timestamp\": 1500000000}";
+static const char packet[] = "{\"sensor\": \"temperature\", \"unit\": \"celsius\", \"value\": 22.0, \"timestamp\": 1500000042}";
+
+static bool roundtrip(compression_t *from, compression_t *to, int level) {
+	uint8_t compressed[MAXPACKET];
+	uint8_t uncompressed[MAXPACKET];
+
+	int clen = compress_packet(from, compressed, sizeof compressed, (const uint8_t *)packet, sizeof packet, level);
+	if(clen < 0) {
+		fprintf(stderr, "Could not compress with %s\n", compression_name(level));
+		return false;
+	}
+
+	int ulen = uncompress_packet(to, uncompressed, sizeof uncompressed, compressed, clen, level);
+	if(ulen != sizeof packet || memcmp(uncompressed, packet, sizeof packet)) {
+		fprintf(stderr, "Packet compressed with %s did not survive the round trip\n", compression_name(level));
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_roundtrip(compression_t *a, compression_t *b) {
+	int tested = 0;
+
+	for(size_t i = 0; i < sizeof levels / sizeof *levels; i++) {
+		if(!compression_supported(a, levels[i]))
+			continue;
+
+		if(!roundtrip(a, b, levels[i]) || !roundtrip(b, a, levels[i]))
+			return false;
+
+		tested++;
+	}
+
+	printf("%d compression levels round-tripped\n", tested);
+	return true;
+}
+
+static bool test_dictionary_id(compression_t *a, compression_t *b) {
+	if(compression_dictionary_id(a) != -1) {
+		fprintf(stderr, "Dictionary ID without a dictionary is not -1\n");
+		return false;
+	}
+
+	if(!compression_set_dictionary(a, dict1, sizeof dict1) || !compression_set_dictionary(b, dict1, sizeof dict1))
+		return false;
+
+	int id1 = compression_dictionary_id(a);
+	if(id1 < 0 || compression_dictionary_id(b) != id1) {
+		fprintf(stderr, "The same dictionary has different IDs\n");
+		return false;
+	}
+
+	if(!compression_set_dictionary(b, dict2, sizeof dict2))
+		return false;
+
+	int id2 = compression_dictionary_id(b);
+	if(id2 < 0 || id2 == id1) {
+		fprintf(stderr, "Different dictionaries have the same ID\n");
+		return false;
+	}
+
+	if(!compression_set_dictionary(b, NULL, 0) || compression_dictionary_id(b) != -1) {
+		fprintf(stderr, "Dictionary ID after removing the dictionary is not -1\n");
+		return false;
+	}
+
+	return true;
+}
+
+// a and b agree on a level as ans_key_h() does, with the ID that the other one sends in its ANS_KEY
+static bool negotiate(compression_t *a, compression_t *b, int level, int expected) {
+	int result = compression_negotiate(a, level, compression_dictionary_id(b));
+	if(result != expected) {
+		fprintf(stderr, "%s was negotiated as %s, expected %s\n", compression_name(level), compression_name(result), compression_name(expected));
+		return false;
+	}
+
+	return true;
+}
+
+static bool usable(compression_t *c, int level, int dictid, int expected) {
+	int result = compression_usable_level(c, level, dictid);
+	if(result != expected) {
+		fprintf(stderr, "%s agreed on is used as %s, expected %s\n", compression_name(level), compression_name(result), compression_name(expected));
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_fallback(compression_t *a, compression_t *b) {
+	// Only nodes with the same dictionary use it
+	if(!compression_set_dictionary(a, dict1, sizeof dict1) || !compression_set_dictionary(b, dict2, sizeof dict2))
+		return false;
+
+	if(!negotiate(a, b, COMPRESS_LZ4_DICT, COMPRESS_LZ4) || !negotiate(a, b, COMPRESS_ZSTD_DICT, COMPRESS_ZSTD) || !negotiate(a, b, COMPRESS_ZLIB_MIN, COMPRESS_ZLIB_MIN))
+		return false;
+
+	// Old nodes send -1
+	if(compression_negotiate(a, COMPRESS_LZ4_DICT, -1) != COMPRESS_LZ4)
+		return false;
+
+	if(!compression_set_dictionary(b, dict1, sizeof dict1))
+		return false;
+
+	if(!negotiate(a, b, COMPRESS_LZ4_DICT, COMPRESS_LZ4_DICT) || !negotiate(a, b, COMPRESS_ZSTD_DICT, COMPRESS_ZSTD_DICT))
+		return false;
+
+	// A session keeps its levels as long as the dictionary stays the same
+	int agreed = compression_dictionary_id(a);
+
+	if(!usable(a, COMPRESS_LZ4_DICT, agreed, COMPRESS_LZ4_DICT) || !usable(a, COMPRESS_ZSTD_DICT, agreed, COMPRESS_ZSTD_DICT))
+		return false;
+
+	// Once it changes, the dictionary levels cannot be used anymore, the others still can
+	if(!compression_set_dictionary(a, dict2, sizeof dict2))
+		return false;
+
+	if(!usable(a, COMPRESS_LZ4_DICT, agreed, COMPRESS_NONE) || !usable(a, COMPRESS_ZSTD_DICT, agreed, COMPRESS_NONE))
+		return false;
+
+	if(!usable(a, COMPRESS_LZ4, agreed, COMPRESS_LZ4) || !usable(a, COMPRESS_ZLIB_MAX, agreed, COMPRESS_ZLIB_MAX) || !usable(a, COMPRESS_NONE, agreed, COMPRESS_NONE))
+		return false;
+
+	// Neither can they after it is removed
+	if(!compression_set_dictionary(a, NULL, 0))
+		return false;
+
+	return usable(a, COMPRESS_LZ4_DICT, agreed, COMPRESS_NONE) && usable(a, COMPRESS_ZSTD_DICT, agreed, COMPRESS_NONE);
+}
+
+int main(int argc, char *argv[]) {
+	compression_t *a = compression_init();
+	compression_t *b = compression_init();
+
+	if(!test_roundtrip(a, b) || !test_dictionary_id(a, b))
+		return 1;
+
+	// With the same dictionary on both sides, the dictionary levels are supported too
+	if(!compression_set_dictionary(a, dict1, sizeof dict1) || !compression_set_dictionary(b, dict1, sizeof dict1) || !test_roundtrip(a, b))
+		return 1;
+
+	if(!test_fallback(a, b))
+		return 1;
+
+	compression_exit(a);
+	compression_exit(b);
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "meshlink/meshlink.h"
+#include "../src/devtools.h"
+
+// Measure how long path MTU discovery takes between two nodes on loopback,
+// with the path MTU simulated by dropping larger UDP packets on both sides.
+// Jumbo frames are allowed, loopback has a large enough MTU for them.
+
+static const uint16_t drop_sizes[] = {0, 8000, 1400, 1280, 1000, 576};
+
+static double elapsed(const struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) * 1e-6;
+}
+
+static bool exchange(meshlink_handle_t *from, meshlink_handle_t *to) {
+	char *data = meshlink_export(from);
+	if(!data)
+		return false;
+
+	bool result = meshlink_import(to, data);
+	free(data);
+	return result;
+}
+
+// Wait until foo has found the path MTU towards bar, or give up after 20 seconds
+static bool wait_for_pmtu(meshlink_handle_t *mesh, meshlink_node_t *bar, struct timeval *start, devtool_pmtu_state_t *state) {
+	while(elapsed(start) < 20) {
+		if(devtool_get_pmtu_state(mesh, bar, state) && state->complete)
+			return true;
+		usleep(1000);
+	}
+
+	return false;
+}
+
+int main(int argc, char *argv[]) {
+	meshlink_handle_t *mesh1 = meshlink_open("pmtu_conf.1", "foo", "pmtu", DEV_CLASS_BACKBONE, MESHLINK_WARNING, NULL, NULL);
+	if(!mesh1) {
+		fprintf(stderr, "Could not initialize configuration for foo\n");
+		return 1;
+	}
+
+	meshlink_handle_t *mesh2 = meshlink_open("pmtu_conf.2", "bar", "pmtu", DEV_CLASS_BACKBONE, MESHLINK_WARNING, NULL, NULL);
+	if(!mesh2) {
+		fprintf(stderr, "Could not initialize configuration for bar\n");
+		return 1;
+	}
+
+	if(!meshlink_set_max_mtu(mesh1, 9000) || !meshlink_set_max_mtu(mesh2, 9000)) {
+		fprintf(stderr, "Could not allow jumbo frames\n");
+		return 1;
+	}
+
+	if(!exchange(mesh1, mesh2) || !exchange(mesh2, mesh1)) {
+		fprintf(stderr, "Could not exchange configurations\n");
+		return 1;
+	}
+
+	// Let bar connect to foo on loopback
+
+	meshlink_node_t *foo = meshlink_get_node(mesh2, "foo");
+	meshlink_node_t *bar = meshlink_get_node(mesh1, "bar");
+	if(!foo || !bar) {
+		fprintf(stderr, "Foo and bar do not know each other\n");
+		return 1;
+	}
+
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		.sin_port = htons(meshlink_get_port(mesh1)),
+	};
+	meshlink_add_address_hint(mesh2, foo, (struct sockaddr *)&sa);
+
+	for(size_t i = 0; i < sizeof drop_sizes / sizeof *drop_sizes; i++) {
+		uint16_t size = drop_sizes[i];
+		devtool_set_udp_drop_size(mesh1, size);
+		devtool_set_udp_drop_size(mesh2, size);
+
+		struct timeval start;
+		gettimeofday(&start, NULL);
+
+		if(!meshlink_start(mesh1) || !meshlink_start(mesh2)) {
+			fprintf(stderr, "Could not start the meshes\n");
+			return 1;
+		}
+
+		devtool_pmtu_state_t state;
+
+		if(!wait_for_pmtu(mesh1, bar, &start, &state)) {
+			fprintf(stderr, "No path MTU found for drop size %u after 20 seconds\n", size);
+			return 1;
+		}
+
+		// The time until the key exchange is done is not part of the discovery
+		uint16_t mtu = state.mtu;
+		printf("Drop size %4u: MTU %4u found after %.3lf s, %.3lf s after the search started\n", size, mtu, elapsed(&start), elapsed(&state.search_start));
+
+		// An SPTPS datagram adds 21 to 25 bytes to the probe
+		if(size && (mtu + 21 > size || mtu + 25 < size)) {
+			fprintf(stderr, "MTU %u does not match drop size %u\n", mtu, size);
+			return 1;
+		}
+
+		meshlink_stop(mesh2);
+		meshlink_stop(mesh1);
+	}
+
+	meshlink_close(mesh2);
+	meshlink_close(mesh1);
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "meshlink/meshlink.h"
+#include "../src/devtools.h"
+
+// Send packets in both directions between two nodes that both receive UDP packets in extra threads,
+// before, during and after a forced key exchange.
+// The kernel picks the socket, and so the thread, that receives the packets from a node,
+// MeshLink's own thread is one of the candidates, so sending both ways makes it likely that a receive thread is used.
+
+#define PACKETS 100
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool received[2][3][PACKETS];          /* by bar and foo, per round */
+
+typedef struct test_packet {
+	int round;
+	int seqno;
+	char text[32];
+} test_packet_t;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	test_packet_t packet;
+
+	if(len != sizeof packet) {
+		fprintf(stderr, "Received a packet of %lu bytes\n", (unsigned long)len);
+		return;
+	}
+
+	memcpy(&packet, data, sizeof packet);
+
+	if(packet.round < 0 || packet.round >= 3 || packet.seqno < 0 || packet.seqno >= PACKETS || strcmp(packet.text, "Hello")) {
+		fprintf(stderr, "Received a corrupted packet\n");
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	received[strcmp(mesh->name, "bar") ? 1 : 0][packet.round][packet.seqno] = true;
+	pthread_mutex_unlock(&lock);
+}
+
+static double elapsed(const struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) * 1e-6;
+}
+
+static bool exchange(meshlink_handle_t *from, meshlink_handle_t *to) {
+	char *data = meshlink_export(from);
+	if(!data)
+		return false;
+
+	bool result = meshlink_import(to, data);
+	free(data);
+	return result;
+}
+
+static meshlink_handle_t *mesh1, *mesh2;
+static meshlink_node_t *foo, *bar;
+
+static void send_round(int round) {
+	for(int i = 0; i < PACKETS; i++) {
+		test_packet_t packet = {.round = round, .seqno = i, .text = "Hello"};
+		meshlink_send(mesh1, bar, &packet, sizeof packet);
+		meshlink_send(mesh2, foo, &packet, sizeof packet);
+		usleep(1000);
+	}
+}
+
+// the number of packets of a round that arrived at both nodes
+static int count_round(int round) {
+	int count = 0;
+
+	pthread_mutex_lock(&lock);
+	for(int i = 0; i < PACKETS; i++)
+		count += received[0][round][i] && received[1][round][i];
+	pthread_mutex_unlock(&lock);
+
+	return count;
+}
+
+// Wait until all packets of a round have arrived, or give up after 5 seconds
+static bool wait_for_round(int round) {
+	struct timeval start;
+	gettimeofday(&start, NULL);
+
+	while(count_round(round) < PACKETS && elapsed(&start) < 5)
+		usleep(10000);
+
+	return count_round(round) == PACKETS;
+}
+
+int main(int argc, char *argv[]) {
+	mesh1 = meshlink_open("receive_threads_conf.1", "foo", "receive-threads", DEV_CLASS_BACKBONE, MESHLINK_WARNING, NULL, NULL);
+	if(!mesh1) {
+		fprintf(stderr, "Could not initialize configuration for foo\n");
+		return 1;
+	}
+
+	mesh2 = meshlink_open("receive_threads_conf.2", "bar", "receive-threads", DEV_CLASS_BACKBONE, MESHLINK_WARNING, NULL, NULL);
+	if(!mesh2) {
+		fprintf(stderr, "Could not initialize configuration for bar\n");
+		return 1;
+	}
+
+	if(!meshlink_set_receive_threads(mesh1, 2) || !meshlink_set_receive_threads(mesh2, 2)) {
+		fprintf(stderr, "Could not set the number of receive threads\n");
+		return 1;
+	}
+
+	if(!exchange(mesh1, mesh2) || !exchange(mesh2, mesh1)) {
+		fprintf(stderr, "Could not exchange configurations\n");
+		return 1;
+	}
+
+	meshlink_set_receive_cb(mesh1, receive_cb);
+	meshlink_set_receive_cb(mesh2, receive_cb);
+
+	// Let bar connect to foo on loopback
+
+	foo = meshlink_get_node(mesh2, "foo");
+	bar = meshlink_get_node(mesh1, "bar");
+	if(!foo || !bar) {
+		fprintf(stderr, "Foo and bar do not know each other\n");
+		return 1;
+	}
+
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		.sin_port = htons(meshlink_get_port(mesh1)),
+	};
+	meshlink_add_address_hint(mesh2, foo, (struct sockaddr *)&sa);
+
+	if(!meshlink_start(mesh1) || !meshlink_start(mesh2)) {
+		fprintf(stderr, "Could not start the meshes\n");
+		return 1;
+	}
+
+	// Once foo found the path MTU, UDP works in both directions, so the packets no longer go over TCP
+
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	devtool_pmtu_state_t state = {.complete = false};
+
+	while(elapsed(&start) < 20 && !(devtool_get_pmtu_state(mesh1, bar, &state) && state.complete))
+		usleep(10000);
+
+	if(!state.complete) {
+		fprintf(stderr, "Foo and bar could not exchange UDP packets after 20 seconds\n");
+		return 1;
+	}
+
+	send_round(0);
+
+	if(!wait_for_round(0)) {
+		fprintf(stderr, "Only %d of %d packets arrived\n", count_round(0), PACKETS);
+		return 1;
+	}
+
+	// Rekey while packets are being sent, some of them may be lost while that happens
+
+	uint32_t keygen = devtool_get_receive_key_generation(mesh2, foo);
+
+	if(!devtool_force_key_exchange(mesh1, bar)) {
+		fprintf(stderr, "Could not force a key exchange\n");
+		return 1;
+	}
+
+	send_round(1);
+
+	gettimeofday(&start, NULL);
+
+	while(elapsed(&start) < 5 && devtool_get_receive_key_generation(mesh2, foo) == keygen)
+		usleep(10000);
+
+	if(devtool_get_receive_key_generation(mesh2, foo) == keygen) {
+		fprintf(stderr, "Bar did not get a new key after 5 seconds\n");
+		return 1;
+	}
+
+	// All packets sent with the new key have to arrive
+
+	send_round(2);
+
+	if(!wait_for_round(2)) {
+		fprintf(stderr, "Only %d of %d packets arrived after the key exchange\n", count_round(2), PACKETS);
+		return 1;
+	}
+
+	printf("Received %d, %d and %d of %d packets before, during and after the key exchange\n", count_round(0), count_round(1), count_round(2), PACKETS);
+
+	// Clean up, which also stops the receive threads
+
+	meshlink_stop(mesh2);
+	meshlink_stop(mesh1);
+	meshlink_close(mesh2);
+	meshlink_close(mesh1);
+
+	return 0;
+}
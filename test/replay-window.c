@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "crypto.h"
+#include "ecdsa.h"
+#include "ecdsagen.h"
+#include "sptps.h"
+
+// Feeds the datagrams of one SPTPS session to the other in a chosen order,
+// and checks which ones the replay window lets through.
+
+// Symbols necessary to link with logger.o
+int send_request(void *c, const char *msg, ...) { return -1; }
+void *mesh;
+void *global_log_cb;
+int global_log_level;
+int send_meta(void *c, const char *msg , int len) { return -1; }
+char *logfilename = NULL;
+struct timeval now;
+
+#define RECORDS 400
+#define QUEUESIZE 16
+
+static sptps_t a, b;
+
+// Handshake datagrams waiting to be delivered, the handle says to which session
+static struct {
+	sptps_t *to;
+	size_t len;
+	char data[512];
+} queue[QUEUESIZE];
+static int queued;
+
+// Application records sent by a, indexed by the number they carry
+static struct {
+	size_t len;
+	char data[64];
+} captured[RECORDS];
+
+static unsigned int received;
+static int last;
+
+static int send_data(void *handle, uint8_t type, const void *data, size_t len) {
+	if(type == SPTPS_HANDSHAKE) {
+		if(queued == QUEUESIZE || len > sizeof queue[queued].data)
+			abort();
+
+		queue[queued].to = handle;
+		queue[queued].len = len;
+		memcpy(queue[queued].data, data, len);
+		queued++;
+		return 0;
+	}
+
+	// records are sent in order of their index
+	static int index;
+
+	if(index == RECORDS || len > sizeof captured[index].data)
+		abort();
+
+	captured[index].len = len;
+	memcpy(captured[index].data, data, len);
+	index++;
+	return 0;
+}
+
+// The handle of each session is the other one, so records received by b have a as their handle.
+static bool receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	if(type == SPTPS_HANDSHAKE || handle != &a)
+		return true;
+
+	if(len != sizeof last)
+		return false;
+
+	memcpy(&last, data, sizeof last);
+	received++;
+	return true;
+}
+
+// Deliver the handshake datagrams, including the ones sent in response, until there are no more.
+static bool handshake(void) {
+	for(int i = 0; i < queued; i++)
+		if(!sptps_receive_datagram(queue[i].to, queue[i].data, queue[i].len))
+			return false;
+
+	queued = 0;
+	return true;
+}
+
+// Deliver the datagram of record i to b, and check whether it was accepted as expected.
+static bool deliver(int i, bool expected) {
+	char buf[sizeof captured[i].data];
+	memcpy(buf, captured[i].data, captured[i].len);
+
+	unsigned int before = received;
+	bool accepted = sptps_receive_datagram(&b, buf, captured[i].len);
+
+	if(accepted && (received != before + 1 || last != i)) {
+		fprintf(stderr, "Record %d was accepted but not delivered correctly\n", i);
+		return false;
+	}
+
+	if(accepted != expected) {
+		fprintf(stderr, "Record %d was %s, expected it to be %s\n", i, accepted ? "accepted" : "rejected", expected ? "accepted" : "rejected");
+		return false;
+	}
+
+	return true;
+}
+
+static bool deliver_range(int from, int to, bool expected) {
+	for(int i = from; i < to; i++)
+		if(!deliver(i, expected))
+			return false;
+
+	return true;
+}
+
+static bool check_lost(uint32_t expected) {
+	if(b.lost != expected) {
+		fprintf(stderr, "%u records counted as lost, expected %u\n", b.lost, expected);
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_window(void) {
+	// a window of 8 bytes covers 64 sequence numbers
+	if(!sptps_set_replaywin(&b, 8))
+		return false;
+
+	uint32_t lost = b.lost;
+
+	// In order, and duplicates of the last one and an older one
+	if(!deliver_range(0, 10, true) || !deliver(9, false) || !deliver(5, false))
+		return false;
+
+	// Reordered: 10 arrives after 11 to 19, but only once
+	if(!deliver_range(11, 20, true) || !deliver(10, true) || !deliver(10, false))
+		return false;
+
+	// Too late: 30 is more than a window behind when it arrives, 40 is not
+	if(!deliver_range(20, 30, true) || !deliver_range(31, 40, true) || !deliver_range(41, 100, true))
+		return false;
+
+	if(!check_lost(lost + 1) || !deliver(30, false) || !deliver(40, true) || !deliver(40, false))
+		return false;
+
+	// Far jump: the window now starts at 237, everything in it was never received and is still accepted,
+	// everything from 100 up to it is lost
+	if(!deliver(300, true) || !check_lost(lost + 1 + (237 - 100)))
+		return false;
+
+	if(!deliver(299, true) || !deliver(299, false) || !deliver(237, true) || !deliver(236, false) || !deliver(150, false))
+		return false;
+
+	// Growing the window keeps the state of the old one, older sequence numbers count as already received
+	if(!sptps_set_replaywin(&b, 32))
+		return false;
+
+	if(!deliver(298, true) || !deliver(299, false) || !deliver(237, false) || !deliver(250, true) || !deliver(200, false))
+		return false;
+
+	// Shrinking it keeps the state of the newest sequence numbers
+	if(!sptps_set_replaywin(&b, 8))
+		return false;
+
+	if(!deliver(260, true) || !deliver(298, false) || !deliver(250, false) || !deliver(236, false))
+		return false;
+
+	// Moving on after resizing, 301 to 309 are skipped and received later
+	if(!deliver_range(310, 360, true) || !deliver_range(301, 310, true) || !deliver_range(301, 310, false))
+		return false;
+
+	// Without a window, duplicates get through
+	if(!sptps_set_replaywin(&b, 0))
+		return false;
+
+	return deliver(359, true) && deliver(359, true) && deliver(100, true);
+}
+
+int main(int argc, char *argv[]) {
+	sptps_log = sptps_log_quiet;
+	crypto_init();
+
+	ecdsa_t *key1 = ecdsa_generate();
+	ecdsa_t *key2 = ecdsa_generate();
+
+	if(!key1 || !key2)
+		return 1;
+
+	if(!sptps_start(&a, &b, true, true, key1, key2, "replay-window", 13, send_data, receive_record)
+	                || !sptps_start(&b, &a, false, true, key2, key1, "replay-window", 13, send_data, receive_record)
+	                || !handshake() || !a.outstate || !b.instate) {
+		fprintf(stderr, "SPTPS handshake failed\n");
+		return 1;
+	}
+
+	for(int i = 0; i < RECORDS; i++)
+		if(sptps_send_record(&a, 0, &i, sizeof i)) {
+			fprintf(stderr, "Could not send record %d\n", i);
+			return 1;
+		}
+
+	int result = test_window() ? 0 : 1;
+
+	sptps_stop(&a);
+	sptps_stop(&b);
+	ecdsa_free(key1);
+	ecdsa_free(key2);
+	crypto_exit();
+
+	return result;
+}